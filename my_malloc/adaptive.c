@@ -0,0 +1,176 @@
+#include "my_malloc.h"
+#include <stdio.h>
+#include <time.h>
+
+/* Adaptive malloc/free: each thread picks its own engine at run time.
+ *
+ * A thread starts on the locking heap, which keeps the least memory idle.
+ * There, at the end of each window of calls it compares the time it spent waiting
+ * for list_lock (list_lock_wait_ns, timed by malloc and free whenever the
+ * lock was taken) with the time that passed; at ADAPT_HIGH_PCT percent or
+ * more it moves to its private cache (the thread cache of thread_cache.c,
+ * whose hits never take the lock).
+ *
+ * A private thread rarely takes the lock, so it estimates instead: every
+ * ADAPT_PROBE_OPS calls it probes list_lock with a trylock, and when at most
+ * ADAPT_LOW_PCT percent of a window's probes found the lock taken it empties
+ * its cache and moves back. The gap between the two thresholds keeps a 
+ * thread from flapping.
+ *
+ * Both engines hand out ordinary blocks of the locking heap, so a block can
+ * be free'd whatever mode either thread is in. */
+
+/* Calls and time per decision: a window lasts for at least both, so a 
+ * decision is neither made on a handful of calls nor on a burst shorter 
+ * than a lock holder's time slice */
+#define ADAPT_WINDOW_OPS 1024
+#define ADAPT_WINDOW_NS  (10 * 1000 * 1000ULL)
+
+/* Calls between two probes of list_lock in private mode */
+#define ADAPT_PROBE_OPS 64
+
+/* Time spent waiting for list_lock (percent) that moves a thread to its 
+ * private cache */
+#define ADAPT_HIGH_PCT 25
+
+/* Probes finding list_lock taken (percent) at or below which it moves back */
+#define ADAPT_LOW_PCT 6
+
+typedef struct adaptive_state_t{
+
+  unsigned ops;
+  unsigned probes;
+  unsigned contended;                 // probes that found list_lock taken
+  unsigned long long window_start_ns; // when the window began
+  unsigned long long window_wait_ns;  // list_lock_wait_ns when it began
+  ts_malloc_mode mode;
+
+} adaptive_state;
+
+static __thread adaptive_state adapt;
+
+unsigned long adaptive_to_private = 0;
+unsigned long adaptive_to_locked = 0;
+unsigned long adaptive_private_threads = 0;
+
+static pthread_key_t adapt_key;
+static pthread_once_t adapt_once = PTHREAD_ONCE_INIT;
+
+
+/* A private thread exiting no longer counts (its cache is emptied by the
+ * thread cache's own destructor) */
+static void adapt_exit(void * arg){
+  (void) arg;
+  if (adapt.mode == TS_MODE_PRIVATE){
+    adapt.mode = TS_MODE_LOCKED;
+    __atomic_sub_fetch(&adaptive_private_threads, 1, __ATOMIC_RELAXED);
+  }
+}
+
+
+static void adapt_setup(){
+  if (pthread_key_create(&adapt_key, adapt_exit) != 0){
+    fprintf(stderr, "Error: could not create the adaptive mode key\n");
+  }
+}
+
+
+/* Moves the calling thread to mode */
+static void adapt_switch(ts_malloc_mode mode){
+  if (mode == TS_MODE_PRIVATE){
+    pthread_once(&adapt_once, adapt_setup);
+    pthread_setspecific(adapt_key, &adapt); // non-NULL, so adapt_exit runs
+    __atomic_add_fetch(&adaptive_to_private, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&adaptive_private_threads, 1, __ATOMIC_RELAXED);
+  }
+  else{
+    ts_thread_cache_flush(); // give the cached blocks back for others to use
+    __atomic_add_fetch(&adaptive_to_locked, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&adaptive_private_threads, 1, __ATOMIC_RELAXED);
+  }
+  adapt.mode = mode;
+}
+
+
+static unsigned long long now_ns(){
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+
+/* Starts a new decision window */
+static void adapt_window(){
+  adapt.ops = adapt.probes = adapt.contended = 0;
+  adapt.window_start_ns = now_ns();
+  adapt.window_wait_ns = list_lock_wait_ns;
+}
+
+
+/* Counts a call, measuring contention and deciding on the mode when due */
+static inline void adapt_sample(){
+  if (__builtin_expect((++adapt.ops % ADAPT_PROBE_OPS) != 0, 1)){
+    return;
+  }
+  if (adapt.mode == TS_MODE_PRIVATE){
+    if (ts_lock_trylock(&list_lock)){
+      ts_lock_release(&list_lock);
+    }
+    else{
+      adapt.contended++;
+    }
+    adapt.probes++;
+  }
+  if (adapt.ops < ADAPT_WINDOW_OPS){
+    return;
+  }
+  if (adapt.window_start_ns == 0){ // the thread's first window only starts the clock
+    adapt_window();
+    return;
+  }
+  unsigned long long elapsed = now_ns() - adapt.window_start_ns;
+  if (elapsed < ADAPT_WINDOW_NS){
+    return;
+  }
+  if (adapt.mode == TS_MODE_LOCKED){
+    unsigned long long waited = list_lock_wait_ns - adapt.window_wait_ns;
+    if (waited * 100 >= elapsed * ADAPT_HIGH_PCT){
+      adapt_switch(TS_MODE_PRIVATE);
+    }
+  }
+  else if (adapt.contended * 100 <= adapt.probes * ADAPT_LOW_PCT){
+    adapt_switch(TS_MODE_LOCKED);
+  }
+  adapt_window();
+}
+
+
+/* Adaptive malloc: the locking heap, or the private cache while list_lock
+ * is contended. */
+void * ts_malloc(size_t size){
+  adapt_sample();
+  if (adapt.mode == TS_MODE_PRIVATE){
+    return ts_malloc_cached(size);
+  }
+  return ts_malloc_lock(size);
+}
+
+
+/* Adaptive free, in the calling thread's current mode. */
+void ts_free(void * ptr){
+  if (ptr == NULL){
+    return;
+  }
+  adapt_sample();
+  if (adapt.mode == TS_MODE_PRIVATE){
+    ts_free_cached(ptr);
+    return;
+  }
+  ts_free_lock(ptr);
+}
+
+
+/* Engine the calling thread's ts_malloc/ts_free currently use. */
+ts_malloc_mode ts_get_malloc_mode(){
+  return adapt.mode;
+}
@@ -0,0 +1,124 @@
+#include "my_malloc.h"
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+/* Best fit search kernels over a bin's packed size array.
+ *
+ * Each kernel returns the index of the smallest size that is at least 
+ * request, or n if no entry fits. Ties go to the lowest index. The vector 
+ * kernels turn every entry that does not fit into UINT32_MAX, keep a running
+ * lane-wise unsigned minimum, and then locate the first entry equal to the 
+ * minimum. bin_min_fit picks the widest kernel the CPU supports. */
+
+
+size_t bin_min_fit_scalar(const uint32_t * sizes, size_t n, uint32_t request){
+  size_t result = n;
+  uint32_t smallest = UINT32_MAX;
+  size_t i;
+  for (i = 0; i < n; i++){
+    if ((sizes[i] >= request) && ((sizes[i] < smallest) || (result == n))){
+      smallest = sizes[i];
+      result = i;
+    }
+  }
+  return result;
+}
+
+
+/* Finds the first index whose size equals value and fits the request. */
+static size_t find_first_equal(const uint32_t * sizes, size_t n, uint32_t value, uint32_t request){
+  size_t i;
+  for (i = 0; i < n; i++){
+    if ((sizes[i] == value) && (sizes[i] >= request)){
+      return i;
+    }
+  }
+  return n;
+}
+
+
+#ifdef HAVE_X86_KERNELS
+
+/* SSE2 has no unsigned 32-bit compare or min, so both are done on values 
+ * biased by 0x80000000 with the signed instructions. */
+size_t bin_min_fit_sse2(const uint32_t * sizes, size_t n, uint32_t request){
+  const __m128i bias = _mm_set1_epi32((int) 0x80000000);
+  const __m128i biased_request = _mm_set1_epi32((int)(request ^ 0x80000000));
+  __m128i minimum = _mm_set1_epi32((int) 0x7fffffff); // biased UINT32_MAX
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4){
+    __m128i values = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(sizes + i)), bias);
+    __m128i too_small = _mm_cmpgt_epi32(biased_request, values);
+    values = _mm_or_si128(_mm_andnot_si128(too_small, values), 
+			  _mm_and_si128(too_small, _mm_set1_epi32((int) 0x7fffffff)));
+    __m128i less = _mm_cmpgt_epi32(minimum, values);
+    minimum = _mm_or_si128(_mm_and_si128(less, values), _mm_andnot_si128(less, minimum));
+  }
+  uint32_t lanes[4];
+  _mm_storeu_si128((__m128i *) lanes, minimum);
+  uint32_t best = UINT32_MAX;
+  int j;
+  for (j = 0; j < 4; j++){
+    uint32_t value = lanes[j] ^ 0x80000000;
+    if (value < best){
+      best = value;
+    }
+  }
+  for (; i < n; i++){ // tail
+    if ((sizes[i] >= request) && (sizes[i] < best)){
+      best = sizes[i];
+    }
+  }
+  return find_first_equal(sizes, n, best, request);
+}
+
+
+__attribute__((target("avx2")))
+size_t bin_min_fit_avx2(const uint32_t * sizes, size_t n, uint32_t request){
+  const __m256i all_ones = _mm256_set1_epi32(-1);
+  const __m256i broadcast = _mm256_set1_epi32((int) request);
+  __m256i minimum = all_ones;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8){
+    __m256i values = _mm256_loadu_si256((const __m256i *)(sizes + i));
+    // values >= request exactly when max(values, request) == values
+    __m256i fits = _mm256_cmpeq_epi32(_mm256_max_epu32(values, broadcast), values);
+    values = _mm256_or_si256(values, _mm256_xor_si256(fits, all_ones));
+    minimum = _mm256_min_epu32(minimum, values);
+  }
+  __m128i folded = _mm_min_epu32(_mm256_castsi256_si128(minimum), _mm256_extracti128_si256(minimum, 1));
+  folded = _mm_min_epu32(folded, _mm_shuffle_epi32(folded, _MM_SHUFFLE(1, 0, 3, 2)));
+  folded = _mm_min_epu32(folded, _mm_shuffle_epi32(folded, _MM_SHUFFLE(2, 3, 0, 1)));
+  uint32_t best = (uint32_t) _mm_cvtsi128_si32(folded);
+  for (; i < n; i++){
+    if ((sizes[i] >= request) && (sizes[i] < best)){
+      best = sizes[i];
+    }
+  }
+  return find_first_equal(sizes, n, best, request);
+}
+
+#endif
+
+
+/* Kernel chosen on first use */
+static size_t (*min_fit_kernel)(const uint32_t *, size_t, uint32_t) = NULL;
+
+
+size_t bin_min_fit(const uint32_t * sizes, size_t n, uint32_t request){
+  if (min_fit_kernel == NULL){
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    min_fit_kernel = __builtin_cpu_supports("avx2") ? bin_min_fit_avx2 : bin_min_fit_sse2;
+#else
+    min_fit_kernel = bin_min_fit_scalar;
+#endif
+  }
+  if (n < 8){ // too short to be worth a vector pass
+    return bin_min_fit_scalar(sizes, n, request);
+  }
+  return min_fit_kernel(sizes, n, request);
+}
@@ -0,0 +1,210 @@
+#define _GNU_SOURCE
+#include "my_malloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* Heap chunk registry and transparent huge page (THP) backed chunks.
+ *
+ * Every range of memory grow_heap hands out is recorded as a heap_chunk.
+ * Contiguous sbrk growth extends the last sbrk chunk. In THP mode grow_heap
+ * instead carves blocks out of 2 MiB aligned anonymous mappings that are 
+ * advised with MADV_HUGEPAGE, so the whole heap (and with it the hot size 
+ * classes that the caches refill from) is backed by huge pages.
+ *
+ * All functions here are called with sbrk_mutex held unless noted. */
+
+/* Huge page size and alignment of THP chunks */
+#define HUGE_PAGE_SIZE (2UL * 1024 * 1024)
+
+/* Minimum size of a THP chunk; requests larger than half of this get a
+ * chunk of their own so the current chunk's remainder is not wasted */
+#define THP_CHUNK_SIZE (4 * HUGE_PAGE_SIZE)
+
+/* Rounds x up to a multiple of the huge page size */
+#define HUGE_ALIGN(x) (((x) + (HUGE_PAGE_SIZE - 1)) & ~(HUGE_PAGE_SIZE - 1))
+
+
+/* Registry of heap chunks, grown by remapping */
+heap_chunk * heap_chunks = NULL;
+unsigned long num_heap_chunks = 0;
+static unsigned long heap_chunks_capacity = 0;
+
+/* Index of the THP chunk currently being carved, -1 if none */
+static long current_thp_chunk = -1;
+
+/* THP mode: -1 until the TS_MALLOC_THP environment variable is read */
+static int thp_mode = -1;
+
+
+/* Appends a record to the registry, returns NULL if it cannot grow. */
+static heap_chunk * new_heap_chunk(){
+  if (num_heap_chunks == heap_chunks_capacity){
+    unsigned long new_capacity = heap_chunks_capacity ? heap_chunks_capacity * 2 : 256;
+    heap_chunk * grown = mmap(NULL, new_capacity * sizeof(heap_chunk), PROT_READ | PROT_WRITE,
+			      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (grown == MAP_FAILED){
+      fprintf(stderr, "Error: could not grow the heap chunk registry\n");
+      return NULL;
+    }
+    if (heap_chunks){
+      memcpy(grown, heap_chunks, num_heap_chunks * sizeof(heap_chunk));
+      munmap(heap_chunks, heap_chunks_capacity * sizeof(heap_chunk));
+    }
+    heap_chunks = grown;
+    heap_chunks_capacity = new_capacity;
+  }
+  heap_chunk * chunk = &heap_chunks[num_heap_chunks++];
+  memset(chunk, 0, sizeof(heap_chunk));
+  return chunk;
+}
+
+
+/* Records size bytes of sbrk growth starting at base. */
+void record_sbrk_growth(void * base, size_t size){
+  if (num_heap_chunks){
+    heap_chunk * last = &heap_chunks[num_heap_chunks - 1];
+    if ((!last->mmapped) && (last->base + last->size == (char *) base)){ // contiguous growth
+      last->size += size;
+      last->used += size;
+      page_map_extend_span(last->span, size);
+      return;
+    }
+  }
+  heap_chunk * chunk = new_heap_chunk();
+  if (chunk){
+    chunk->base = base;
+    chunk->size = chunk->used = size;
+    chunk->span = page_map_add_span(base, size);
+  }
+}
+
+
+/* Maps a 2 MiB aligned chunk of at least size bytes and advises huge pages. */
+static heap_chunk * map_thp_chunk(size_t size){
+  size_t length = HUGE_ALIGN(size > THP_CHUNK_SIZE ? size : THP_CHUNK_SIZE);
+  // over-map by one huge page so an aligned start can be cut out
+  char * raw = mmap(NULL, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, 
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (raw == MAP_FAILED){
+    fprintf(stderr, "Error: mmap of THP chunk with size %lu failed\n", length);
+    return NULL;
+  }
+  char * aligned = (char *) HUGE_ALIGN((unsigned long) raw);
+  if (aligned > raw){
+    munmap(raw, aligned - raw);
+  }
+  if (aligned + length < raw + length + HUGE_PAGE_SIZE){
+    munmap(aligned + length, (raw + length + HUGE_PAGE_SIZE) - (aligned + length));
+  }
+  heap_chunk * chunk = new_heap_chunk();
+  if (chunk == NULL){
+    munmap(aligned, length);
+    return NULL;
+  }
+  chunk->base = aligned;
+  chunk->size = length;
+  chunk->mmapped = 1;
+  chunk->span = page_map_add_span(aligned, length);
+  chunk->thp_advised = (madvise(aligned, length, MADV_HUGEPAGE) == 0);
+  data_segment_size += length;
+  return chunk;
+}
+
+
+/* Carves size bytes out of the current THP chunk, mapping a new chunk when
+ * it does not have room. Returns NULL on failure. */
+block_node * thp_chunk_alloc(size_t size){
+  heap_chunk * chunk = NULL;
+  if (current_thp_chunk >= 0){
+    chunk = &heap_chunks[current_thp_chunk];
+  }
+  if ((chunk == NULL) || (chunk->size - chunk->used < size)){
+    if ((chunk = map_thp_chunk(size)) == NULL){
+      return NULL;
+    }
+    if (size <= THP_CHUNK_SIZE / 2){ // oversized requests keep their own chunk
+      current_thp_chunk = chunk - heap_chunks;
+    }
+  }
+  block_node * new_block = (block_node *)(chunk->base + chunk->used);
+  chunk->used += size;
+  return new_block;
+}
+
+
+/* Returns whether grow_heap should carve THP chunks, reading TS_MALLOC_THP
+ * the first time it is asked. */
+int thp_chunks_enabled(){
+  if (thp_mode < 0){
+    char * env = getenv("TS_MALLOC_THP");
+    thp_mode = (env && (atoi(env) > 0));
+  }
+  return thp_mode;
+}
+
+
+/* Turns THP backed heap growth on or off. Memory already handed out stays
+ * where it is. */
+void ts_set_thp_chunks(int enable){
+  ts_lock_acquire(&sbrk_mutex);
+  thp_mode = (enable != 0);
+  ts_lock_release(&sbrk_mutex);
+}
+
+
+/* Fills in thp_bytes for the copied chunk records from the AnonHugePages 
+ * counts in /proc/self/smaps. Adjacent chunks with the same protections 
+ * share one mapping in the kernel, so a mapping's count is split between 
+ * the chunks it covers in proportion to their overlap. */
+static void read_thp_usage(heap_chunk * chunks, int count){
+  FILE * f = fopen("/proc/self/smaps", "r");
+  if (f == NULL){
+    return;
+  }
+  char line[256];
+  unsigned long start = 0, end = 0, huge_kb;
+  int i;
+  while (fgets(line, sizeof(line), f)){
+    if (sscanf(line, "%lx-%lx", &start, &end) == 2){
+      continue; // start of a new mapping
+    }
+    if ((sscanf(line, "AnonHugePages: %lu kB", &huge_kb) != 1) || (huge_kb == 0)){
+      continue;
+    }
+    for (i = 0; i < count; i++){
+      unsigned long lo = (unsigned long) chunks[i].base;
+      unsigned long hi = lo + chunks[i].size;
+      if (lo < start){
+	lo = start;
+      }
+      if (hi > end){
+	hi = end;
+      }
+      if (lo < hi){
+	chunks[i].thp_bytes += (unsigned long)((double) huge_kb * 1024 * (hi - lo) / (end - start));
+      }
+    }
+  }
+  fclose(f);
+}
+
+
+/* Copies up to max heap chunk records, including their huge page backing,
+ * into out. Returns the total number of chunks. */
+int ts_get_chunk_stats(heap_chunk * out, int max){
+  ts_lock_acquire(&sbrk_mutex);
+  int total = (int) num_heap_chunks;
+  int count = total < max ? total : max;
+  if (count > 0){
+    memcpy(out, heap_chunks, count * sizeof(heap_chunk));
+  }
+  ts_lock_release(&sbrk_mutex);
+  int i;
+  for (i = 0; i < count; i++){
+    out[i].thp_bytes = 0;
+  }
+  read_thp_usage(out, count); // file IO done without the lock
+  return total;
+}
@@ -0,0 +1,413 @@
+#define _GNU_SOURCE
+#include "my_malloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <semaphore.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/* Sampling heap profiler.
+ *
+ * Each thread counts down the bytes it allocates and samples the allocation
+ * that takes the count below zero, then draws the next count from an
+ * exponential distribution with a mean of profile_rate bytes, so on average
+ * one allocation per profile_rate bytes is sampled whatever the mix of
+ * sizes (geometric sampling, as in tcmalloc). A sample records the
+ * allocation's call stack, size and thread, is kept in a hash table by
+ * block address while the block is live, and its block is flagged with
+ * BLOCK_SAMPLED so that free only looks the table up for sampled blocks.
+ * Heap growth is profiled the same way: every grow_heap call made while
+ * profiling is on adds its call stack and size to a table of growth sites.
+ *
+ * While profiling is off malloc pays one load and branch on profile_rate,
+ * and free a test of a flag in the size it already reads.
+ *
+ * ts_profile_dump writes the live samples as a pprof legacy heap profile
+ * (prefix.heap, unsampled by pprof from the heap_v2 rate) and as folded
+ * stacks for flame graphs (prefix.folded, with sizes scaled up to estimated
+ * bytes), and the growth sites as prefix.growth.folded.
+ *
+ * Configured with TS_MALLOC_PROFILE_RATE (mean bytes between samples, unset
+ * or 0 = off), TS_MALLOC_PROFILE_SIGNAL (signal number that dumps a profile
+ * to TS_MALLOC_PROFILE_OUT.<pid>.<n>, default prefix "ts_heap") in the
+ * environment, read the first time the heap grows, or with
+ * ts_profile_set_rate. */
+
+/* Frames kept per sample */
+#define PROFILE_MAX_DEPTH 32
+
+/* Frames of the profiler and the malloc entry point at the top of every stack */
+#define PROFILE_SKIP_FRAMES 3
+
+/* Hash buckets of the live sample and growth site tables */
+#define PROFILE_BUCKETS 4096
+
+/* Records mapped at a time for the tables */
+#define PROFILE_SLAB_RECORDS 256
+
+
+// A sampled live allocation, or a heap growth call site
+
+typedef struct profile_record_t{
+
+  struct profile_record_t * next;
+  void * key;            // block of a sample, stack hash of a growth site
+  size_t size;           // requested bytes of a sample, total bytes of a site
+  unsigned long count;   // grow_heap calls of a site
+  pid_t tid;
+  int depth;
+  void * frames[PROFILE_MAX_DEPTH];
+
+} profile_record;
+
+
+/* Mean bytes between samples, 0 while profiling is off */
+size_t profile_rate = 0;
+
+/* Number of live samples (read without profile_mutex by sized frees) */
+unsigned long profile_live = 0;
+
+static profile_record * samples[PROFILE_BUCKETS];
+static profile_record * growth_sites[PROFILE_BUCKETS];
+static profile_record * free_records = NULL;
+static pthread_mutex_t profile_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t profile_once = PTHREAD_ONCE_INIT;
+
+/* Signal triggered dumps */
+static sem_t dump_sem;
+static const char * dump_prefix = "ts_heap";
+static unsigned long dump_count = 0;
+
+/* Bytes left before this thread's next sample, and its random state */
+static __thread long profile_countdown = 0;
+static __thread int profile_primed = 0;
+static __thread uint64_t profile_random = 0;
+
+
+/* Hash bucket of a key */
+static inline unsigned profile_hash(void * key){
+  uintptr_t x = (uintptr_t) key;
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdUL;
+  x ^= x >> 33;
+  return x & (PROFILE_BUCKETS - 1);
+}
+
+
+/* Takes a record from the pool, mapping a new slab if it is empty
+ * (profile_mutex held) */
+static profile_record * new_record(){
+  if (free_records == NULL){
+    profile_record * slab = mmap(NULL, PROFILE_SLAB_RECORDS * sizeof(profile_record), PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (slab == MAP_FAILED){
+      fprintf(stderr, "Error: could not map heap profile records\n");
+      return NULL;
+    }
+    int i;
+    for (i = 0; i < PROFILE_SLAB_RECORDS; i++){
+      slab[i].next = free_records;
+      free_records = &slab[i];
+    }
+  }
+  profile_record * record = free_records;
+  free_records = record->next;
+  return record;
+}
+
+
+/* Bytes to the next sample: exponentially distributed with mean profile_rate */
+static long next_sample_interval(){
+  if (profile_random == 0){
+    profile_random = ((uint64_t) syscall(SYS_gettid) << 32) ^ (uintptr_t) &profile_random ^ 0x9e3779b97f4a7c15UL;
+  }
+  profile_random ^= profile_random << 13; // xorshift64
+  profile_random ^= profile_random >> 7;
+  profile_random ^= profile_random << 17;
+  double u = ((profile_random >> 11) + 1) * (1.0 / 9007199254740992.0); // (0, 1]
+  double interval = -log(u) * (double) profile_rate;
+  return interval < (double) LONG_MAX ? (long) interval + 1 : LONG_MAX;
+}
+
+
+/* Fills in a record's call stack, without the allocator's own frames */
+static __attribute__((noinline)) void record_stack(profile_record * record){
+  void * frames[PROFILE_MAX_DEPTH + PROFILE_SKIP_FRAMES];
+  int depth = backtrace(frames, PROFILE_MAX_DEPTH + PROFILE_SKIP_FRAMES);
+  depth = depth > PROFILE_SKIP_FRAMES ? depth - PROFILE_SKIP_FRAMES : 0;
+  memcpy(record->frames, frames + PROFILE_SKIP_FRAMES, depth * sizeof(void *));
+  record->depth = depth;
+  record->tid = syscall(SYS_gettid);
+}
+
+
+/* Counts an allocation of size bytes against this thread's sampling
+ * interval, recording a sample for block when the interval runs out.
+ * Called only while profiling is on (see PROFILE_MALLOC). */
+void profile_malloc(block_node * block, size_t size){
+  if (!profile_primed){
+    profile_primed = 1;
+    profile_countdown = next_sample_interval();
+  }
+  profile_countdown -= size;
+  if (profile_countdown >= 0){
+    return;
+  }
+  profile_countdown = next_sample_interval();
+
+  profile_record sample;
+  record_stack(&sample);
+  sample.key = block;
+  sample.size = size;
+  sample.count = 1;
+  pthread_mutex_lock(&profile_mutex);
+  profile_record * record = new_record();
+  if (record){
+    unsigned bucket = profile_hash(block);
+    *record = sample;
+    record->next = samples[bucket];
+    samples[bucket] = record;
+    profile_live++;
+    block->size |= BLOCK_SAMPLED;
+  }
+  pthread_mutex_unlock(&profile_mutex);
+}
+
+
+/* Drops the sample of a sampled block that is being free'd, and clears its
+ * flag (see PROFILE_FREE). */
+void profile_free(block_node * block){
+  unsigned bucket = profile_hash(block);
+  pthread_mutex_lock(&profile_mutex);
+  profile_record ** link = &samples[bucket];
+  while (*link && ((*link)->key != block)){
+    link = &(*link)->next;
+  }
+  if (*link){
+    profile_record * record = *link;
+    *link = record->next;
+    record->next = free_records;
+    free_records = record;
+    profile_live--;
+  }
+  pthread_mutex_unlock(&profile_mutex);
+  block->size &= ~BLOCK_SAMPLED;
+}
+
+
+/* Adds a grow_heap call of size bytes to its call site's totals. Called
+ * only while profiling is on (see PROFILE_GROWTH). */
+void profile_growth(size_t size){
+  profile_record site;
+  record_stack(&site);
+  uintptr_t hash = 1469598103934665603UL; // FNV-1a over the frame addresses
+  int i;
+  for (i = 0; i < site.depth; i++){
+    hash = (hash ^ (uintptr_t) site.frames[i]) * 1099511628211UL;
+  }
+  site.key = (void *) hash;
+
+  unsigned bucket = profile_hash(site.key);
+  pthread_mutex_lock(&profile_mutex);
+  profile_record * record = growth_sites[bucket];
+  while (record && ((record->key != site.key) || (record->depth != site.depth) ||
+		    memcmp(record->frames, site.frames, site.depth * sizeof(void *)))){
+    record = record->next;
+  }
+  if ((record == NULL) && ((record = new_record()) != NULL)){
+    *record = site;
+    record->size = 0;
+    record->count = 0;
+    record->next = growth_sites[bucket];
+    growth_sites[bucket] = record;
+  }
+  if (record){
+    record->size += size;
+    record->count++;
+  }
+  pthread_mutex_unlock(&profile_mutex);
+}
+
+
+/* Estimated bytes allocated at a sample's site: a sample of size bytes
+ * stands for size / P(sampled) bytes */
+static double sample_weight(size_t size, size_t rate){
+  if (rate == 0){
+    return size;
+  }
+  return size / (1.0 - exp(-(double) size / rate));
+}
+
+
+/* Writes a call stack as a folded line, outermost frame first */
+static void write_folded(FILE * out, profile_record * record, unsigned long long bytes){
+  int i;
+  for (i = record->depth - 1; i >= 0; i--){
+    Dl_info info;
+    void * pc = (char *) record->frames[i] - 1; // the call, not the return address
+    if (dladdr(pc, &info) && info.dli_sname){
+      fprintf(out, "%s", info.dli_sname);
+    }
+    else if (dladdr(pc, &info) && info.dli_fname){
+      const char * name = strrchr(info.dli_fname, '/');
+      fprintf(out, "%s+0x%lx", name ? name + 1 : info.dli_fname, (unsigned long)((char *) pc - (char *) info.dli_fbase));
+    }
+    else{
+      fprintf(out, "%p", pc);
+    }
+    fputc(i ? ';' : ' ', out);
+  }
+  if (record->depth == 0){
+    fprintf(out, "[unknown] ");
+  }
+  fprintf(out, "%llu\n", bytes);
+}
+
+
+/* Opens prefix + suffix for writing */
+static FILE * open_dump_file(const char * prefix, const char * suffix){
+  char path[4096];
+  snprintf(path, sizeof(path), "%s%s", prefix, suffix);
+  FILE * out = fopen(path, "w");
+  if (out == NULL){
+    fprintf(stderr, "Error: could not write heap profile %s\n", path);
+  }
+  return out;
+}
+
+
+/* Writes the live samples and growth sites to prefix.heap, prefix.folded
+ * and prefix.growth.folded. Returns 0 on success, -1 if a file could not
+ * be written. */
+int ts_profile_dump(const char * prefix){
+  FILE * heap_out = open_dump_file(prefix, ".heap");
+  FILE * folded_out = open_dump_file(prefix, ".folded");
+  FILE * growth_out = open_dump_file(prefix, ".growth.folded");
+  if (!heap_out || !folded_out || !growth_out){
+    if (heap_out) fclose(heap_out);
+    if (folded_out) fclose(folded_out);
+    if (growth_out) fclose(growth_out);
+    return -1;
+  }
+
+  pthread_mutex_lock(&profile_mutex);
+  size_t rate = profile_rate;
+  unsigned long long total = 0;
+  unsigned bucket;
+  profile_record * record;
+  for (bucket = 0; bucket < PROFILE_BUCKETS; bucket++){
+    for (record = samples[bucket]; record; record = record->next){
+      total += record->size;
+    }
+  }
+  fprintf(heap_out, "heap profile: %lu: %llu [%lu: %llu] @ heap_v2/%lu\n",
+	  profile_live, total, profile_live, total, (unsigned long) rate);
+  for (bucket = 0; bucket < PROFILE_BUCKETS; bucket++){
+    for (record = samples[bucket]; record; record = record->next){
+      int i;
+      fprintf(heap_out, "1: %lu [1: %lu] @", (unsigned long) record->size, (unsigned long) record->size);
+      for (i = 0; i < record->depth; i++){
+	fprintf(heap_out, " %p", record->frames[i]);
+      }
+      fprintf(heap_out, "\n");
+      write_folded(folded_out, record, (unsigned long long) sample_weight(record->size, rate));
+    }
+    for (record = growth_sites[bucket]; record; record = record->next){
+      write_folded(growth_out, record, record->size);
+    }
+  }
+  pthread_mutex_unlock(&profile_mutex);
+
+  // pprof symbolizes the addresses with the mappings
+  fprintf(heap_out, "\nMAPPED_LIBRARIES:\n");
+  FILE * maps = fopen("/proc/self/maps", "r");
+  if (maps){
+    char line[4096];
+    while (fgets(line, sizeof(line), maps)){
+      fputs(line, heap_out);
+    }
+    fclose(maps);
+  }
+  fclose(heap_out);
+  fclose(folded_out);
+  fclose(growth_out);
+  return 0;
+}
+
+
+/* Signal handler: wakes the dump thread (sem_post is async-signal-safe) */
+static void profile_signal(int sig){
+  (void) sig;
+  sem_post(&dump_sem);
+}
+
+
+/* Body of the dump thread: writes a profile each time the signal arrives */
+static void * profile_dump_main(void * arg){
+  (void) arg;
+  for (;;){
+    if (sem_wait(&dump_sem) != 0){
+      continue; // interrupted
+    }
+    char prefix[4096];
+    snprintf(prefix, sizeof(prefix), "%s.%d.%lu", dump_prefix, (int) getpid(), dump_count++);
+    ts_profile_dump(prefix);
+  }
+  return NULL;
+}
+
+
+/* Sets the mean bytes between samples */
+static void set_profile_rate(size_t bytes){
+  if (bytes){
+    void * frames[1];
+    backtrace(frames, 1); // loads the unwinder before the first sample
+  }
+  __atomic_store_n(&profile_rate, bytes, __ATOMIC_RELAXED);
+}
+
+
+/* Reads the environment, once. */
+static void profile_setup(){
+  char * env = getenv("TS_MALLOC_PROFILE_OUT");
+  if (env && *env){
+    dump_prefix = env;
+  }
+  env = getenv("TS_MALLOC_PROFILE_SIGNAL");
+  if (env && (atoi(env) > 0)){
+    pthread_t thread;
+    sem_init(&dump_sem, 0, 0);
+    if (pthread_create(&thread, NULL, profile_dump_main, NULL) == 0){
+      pthread_detach(thread);
+      signal(atoi(env), profile_signal);
+    }
+    else{
+      fprintf(stderr, "Error: could not start the heap profile dump thread\n");
+    }
+  }
+  env = getenv("TS_MALLOC_PROFILE_RATE");
+  if (env && (atol(env) > 0)){
+    set_profile_rate(atol(env));
+  }
+}
+
+
+/* Sets up profiling from the environment (first call only) */
+void profile_init(){
+  pthread_once(&profile_once, profile_setup);
+}
+
+
+/* Sets the mean bytes between samples, 0 turns sampling off. Samples of
+ * blocks that are still live are kept either way. */
+void ts_profile_set_rate(size_t bytes){
+  profile_init();
+  set_profile_rate(bytes);
+}
@@ -0,0 +1,285 @@
+#include "my_malloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* Heap walker and heap map export.
+ *
+ * Blocks tile each heap chunk from its base to the bytes handed out so far,
+ * so every block is reached by stepping from one block to the next by its
+ * size. Chunks are walked in address order, which lets the free state of a
+ * block be read off the address-ordered free list (and the sorted quick
+ * list blocks) with a cursor that only moves forward: the whole walk is
+ * linear in the number of blocks.
+ *
+ * The heap map summarizes the walk for fragmentation analysis, as CSV:
+ *
+ *   chunk,<id>,<base>,<bytes>,<allocated>,<free>,<cached>,<blocks>,<free blocks>,<largest free>
+ *   slice,<chunk id>,<slice>,<allocated>,<free>,<cached>   (MAP_SLICE_BYTES each)
+ *   hist,<allocated|free|free_run>,<lower bound>,<count>,<bytes>
+ *   total,<bytes>,<allocated>,<free>,<cached>,<blocks>,<free blocks>,<largest free>,<free runs>
+ *
+ * A free run is a stretch of adjacent free or cached blocks; with deferred
+ * coalescing on, several cached blocks can make up one run. */
+
+/* Bytes of a chunk per slice line of the heap map */
+#define MAP_SLICE_BYTES (64 * 1024)
+
+/* Power of two size classes of the histograms */
+#define MAP_HIST_CLASSES 48
+
+
+/* Orders heap chunks by base address */
+static int compare_chunks(const void * a, const void * b){
+  const heap_chunk * x = *(const heap_chunk * const *) a;
+  const heap_chunk * y = *(const heap_chunk * const *) b;
+  return (x->base > y->base) - (x->base < y->base);
+}
+
+
+/* Orders blocks by address */
+static int compare_blocks(const void * a, const void * b){
+  const block_node * x = *(const block_node * const *) a;
+  const block_node * y = *(const block_node * const *) b;
+  return (x > y) - (x < y);
+}
+
+
+/* Visits every block of every chunk in address order (see my_malloc.h). */
+int ts_heap_walk(ts_heap_visitor visit, void * arg){
+  block_node * quick[QUICK_THRESHOLD];
+  int ret = 0;
+
+  ts_lock_acquire(&list_lock);
+  ts_lock_acquire(&sbrk_mutex);
+  unsigned long num_chunks = num_heap_chunks;
+  size_t order_bytes = (num_chunks + 1) * sizeof(heap_chunk *);
+  heap_chunk ** order = mmap(NULL, order_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (order == MAP_FAILED){
+    ts_lock_release(&sbrk_mutex);
+    ts_lock_release(&list_lock);
+    fprintf(stderr, "Error: no memory to walk %lu heap chunks\n", num_chunks);
+    return -1;
+  }
+  unsigned long i;
+  for (i = 0; i < num_chunks; i++){
+    order[i] = &heap_chunks[i];
+  }
+  qsort(order, num_chunks, sizeof(heap_chunk *), compare_chunks);
+  unsigned long num_quick = get_quick_blocks(quick, QUICK_THRESHOLD);
+  qsort(quick, num_quick, sizeof(block_node *), compare_blocks);
+
+  block_node * free_cursor = free_list_head;
+  unsigned long q = 0;
+  for (i = 0; (i < num_chunks) && (ret == 0); i++){
+    char * current = order[i]->base;
+    char * end = order[i]->base + order[i]->used;
+    while (current < end){
+      block_node * block = (block_node *) current;
+      size_t size = BLOCK_SIZE(block);
+      if ((size < META_DATA_SIZE) || (size > (size_t)(end - current))){
+	fprintf(stderr, "Error: heap walk found a block of bad size %lu at %p\n", size, (void *) block);
+	ret = -1;
+	break;
+      }
+      while (free_cursor && (free_cursor < block)){
+	free_cursor = free_cursor->next;
+      }
+      while ((q < num_quick) && (quick[q] < block)){
+	q++;
+      }
+      block_state state = BLOCK_ALLOCATED;
+      if (free_cursor == block){
+	state = BLOCK_FREE;
+      }
+      else if ((q < num_quick) && (quick[q] == block)){
+	state = BLOCK_CACHED;
+      }
+      if (visit(order[i], block, size, state, arg)){
+	ret = 1;
+	break;
+      }
+      current += size;
+    }
+  }
+  ts_lock_release(&sbrk_mutex);
+  ts_lock_release(&list_lock);
+  munmap(order, order_bytes);
+  return ret < 0 ? -1 : 0;
+}
+
+
+// Totals for the whole heap or one chunk
+
+typedef struct map_totals_t{
+
+  unsigned long long bytes[3];   // by block_state
+  unsigned long blocks;
+  unsigned long free_blocks;     // free and cached
+  unsigned long long largest_free;
+  unsigned long free_runs;
+
+} map_totals;
+
+
+// State of a heap map export
+
+typedef struct heap_map_t{
+
+  FILE * out;
+  const heap_chunk * chunk;      // chunk being walked
+  long chunk_id;
+  map_totals chunk_totals;
+  map_totals totals;
+  unsigned long long slice[3];   // bytes of the current slice by block_state
+  size_t slice_index;
+  unsigned long long run_bytes;  // free run in progress
+  unsigned long long hist_count[3][MAP_HIST_CLASSES];
+  unsigned long long hist_bytes[3][MAP_HIST_CLASSES];
+
+} heap_map;
+
+
+/* Histogram class of a size: floor(log2(size)) */
+static unsigned hist_class(unsigned long long size){
+  unsigned log = size ? 63 - __builtin_clzll(size) : 0;
+  return log < MAP_HIST_CLASSES ? log : MAP_HIST_CLASSES - 1;
+}
+
+
+/* Adds bytes to the histogram of kind (allocated, free or free run) */
+static void hist_add(heap_map * map, int kind, unsigned long long bytes){
+  unsigned c = hist_class(bytes);
+  map->hist_count[kind][c]++;
+  map->hist_bytes[kind][c] += bytes;
+}
+
+
+/* Ends the free run in progress, if any */
+static void end_free_run(heap_map * map){
+  if (map->run_bytes){
+    hist_add(map, 2, map->run_bytes);
+    map->chunk_totals.free_runs++;
+    if (map->run_bytes > map->chunk_totals.largest_free){
+      map->chunk_totals.largest_free = map->run_bytes;
+    }
+    map->run_bytes = 0;
+  }
+}
+
+
+/* Writes the current slice line and clears it */
+static void flush_slice(heap_map * map){
+  if (map->slice[0] || map->slice[1] || map->slice[2]){
+    fprintf(map->out, "slice,%ld,%lu,%llu,%llu,%llu\n", map->chunk_id, map->slice_index,
+	    map->slice[0], map->slice[1], map->slice[2]);
+  }
+  memset(map->slice, 0, sizeof(map->slice));
+}
+
+
+/* Writes the chunk line of the chunk just walked and adds it to the totals */
+static void end_chunk(heap_map * map){
+  if (map->chunk == NULL){
+    return;
+  }
+  end_free_run(map);
+  flush_slice(map);
+  map_totals * t = &map->chunk_totals;
+  fprintf(map->out, "chunk,%ld,%p,%lu,%llu,%llu,%llu,%lu,%lu,%llu\n", map->chunk_id,
+	  (void *) map->chunk->base, (unsigned long) map->chunk->used, t->bytes[BLOCK_ALLOCATED],
+	  t->bytes[BLOCK_FREE], t->bytes[BLOCK_CACHED], t->blocks, t->free_blocks, t->largest_free);
+  int s;
+  for (s = 0; s < 3; s++){
+    map->totals.bytes[s] += t->bytes[s];
+  }
+  map->totals.blocks += t->blocks;
+  map->totals.free_blocks += t->free_blocks;
+  map->totals.free_runs += t->free_runs;
+  if (t->largest_free > map->totals.largest_free){
+    map->totals.largest_free = t->largest_free;
+  }
+  memset(t, 0, sizeof(*t));
+}
+
+
+/* Heap walk visitor of the export */
+static int map_block(const heap_chunk * chunk, block_node * block, size_t size,
+		     block_state state, void * arg){
+  heap_map * map = arg;
+  if (chunk != map->chunk){
+    end_chunk(map);
+    map->chunk = chunk;
+    map->chunk_id++;
+    map->slice_index = 0;
+  }
+  map->chunk_totals.bytes[state] += size;
+  map->chunk_totals.blocks++;
+  if (state == BLOCK_ALLOCATED){
+    end_free_run(map);
+    hist_add(map, 0, size);
+  }
+  else{
+    map->run_bytes += size;
+    map->chunk_totals.free_blocks++;
+    hist_add(map, 1, size);
+  }
+
+  // spread the block over the slices it covers
+  size_t offset = (char *) block - chunk->base;
+  while (size){
+    size_t index = offset / MAP_SLICE_BYTES;
+    if (index != map->slice_index){
+      flush_slice(map);
+      map->slice_index = index;
+    }
+    size_t part = (index + 1) * MAP_SLICE_BYTES - offset;
+    if (part > size){
+      part = size;
+    }
+    map->slice[state] += part;
+    offset += part;
+    size -= part;
+  }
+  return 0;
+}
+
+
+/* Writes the heap map CSV to path (see above). Returns 0 on success. */
+int ts_heap_map_export(const char * path){
+  heap_map * map = mmap(NULL, sizeof(heap_map), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED){
+    return -1;
+  }
+  if ((map->out = fopen(path, "w")) == NULL){
+    fprintf(stderr, "Error: could not write heap map %s\n", path);
+    munmap(map, sizeof(heap_map));
+    return -1;
+  }
+  map->chunk_id = -1;
+  fprintf(map->out, "# ts_malloc heap map, slices of %d bytes\n", MAP_SLICE_BYTES);
+  int ret = ts_heap_walk(map_block, map);
+  end_chunk(map);
+
+  static const char * kinds[3] = {"allocated", "free", "free_run"};
+  int kind;
+  unsigned c;
+  for (kind = 0; kind < 3; kind++){
+    for (c = 0; c < MAP_HIST_CLASSES; c++){
+      if (map->hist_count[kind][c]){
+	fprintf(map->out, "hist,%s,%llu,%llu,%llu\n", kinds[kind], 1ULL << c,
+		map->hist_count[kind][c], map->hist_bytes[kind][c]);
+      }
+    }
+  }
+  map_totals * t = &map->totals;
+  fprintf(map->out, "total,%llu,%llu,%llu,%llu,%lu,%lu,%llu,%lu\n",
+	  t->bytes[0] + t->bytes[1] + t->bytes[2], t->bytes[BLOCK_ALLOCATED], t->bytes[BLOCK_FREE],
+	  t->bytes[BLOCK_CACHED], t->blocks, t->free_blocks, t->largest_free, t->free_runs);
+  if (fclose(map->out) != 0){
+    ret = -1;
+  }
+  munmap(map, sizeof(heap_map));
+  return ret;
+}
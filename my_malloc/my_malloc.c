@@ -1,7 +1,12 @@
+#define _GNU_SOURCE
 #include "my_malloc.h"
 #include <unistd.h>
 #include <stdio.h>
 #include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
 
 /***************************************************************** 
  * ECE650 Homework Assignment 2: Implementing Thread-Safe Malloc *
@@ -11,23 +16,41 @@
 
 /** NOTES: 
  * 
- * -Alignment macros not used in final implementation.
+ * -Block sizes are rounded up with ALIGN so they stay multiples of 8.
+ * -Free blocks are kept in an address-ordered list for coalescing and in
+ *  size-segregated bins (dense arrays of packed sizes) for searching.
  *  
  */
 
-/* For alignment purposes */
-#define ALIGNMENT 8
+/* Minimum size threshold that determines if a block is split. 
+ * This is only the starting value: the threshold used for each request bin 
+ * adapts to the observed request sizes (see adapt_split_thresholds) unless it
+ * is set explicitly with ts_set_split_threshold. It must be at least 
+ * MIN_BLOCK_SIZE so the leftover can be a free block. */
+#define MIN_SIZE META_DATA_SIZE + 128
 
-/* Macro for finding the nearest multiple of 8 for alignment */
-#define ALIGN(x) (((x) + (ALIGNMENT - 1)) & ~(ALIGNMENT-1))
+/* Number of requests a thread records before folding them into the shared
+ * histogram and recomputing the thresholds */
+#define ADAPT_INTERVAL 4096
 
-/* Size of meta data struct (offset to payload in memory, 24 bytes) */
-#define META_DATA_SIZE sizeof(block_node) 
+/* Leftover a block must have to be split, indexed by the request's bin */
+size_t split_threshold[NUM_BINS];
 
-/* Minimum size threshold that determines if a block is split. 
- * This parameter can be set based on the target workload,
- * but must be at least the size of the block_node struct to avoid error */
-#define MIN_SIZE META_DATA_SIZE + 128
+/* Whether the thresholds adapt (0 once set explicitly) */
+int split_adaptive = 1;
+
+/* Shared request size histogram (by bin) and internal fragmentation totals,
+ * protected by adapt_lock */
+pthread_mutex_t adapt_lock = PTHREAD_MUTEX_INITIALIZER;
+unsigned long request_histogram[NUM_BINS];
+unsigned long long requested_bytes = 0;
+unsigned long long slack_bytes = 0;
+
+/* Per-thread counts, folded into the shared ones every ADAPT_INTERVAL requests */
+__thread unsigned long thread_request_histogram[NUM_BINS];
+__thread unsigned thread_requests = 0;
+__thread unsigned long long thread_requested_bytes = 0;
+__thread unsigned long long thread_slack_bytes = 0;
 
 
 /* Thread local storage for free list 
@@ -35,6 +58,9 @@
 __thread block_node * thread_head = NULL;
 __thread block_node * thread_tail = NULL;
 __thread size_t thread_list_size = 0;
+__thread block_node * thread_rover = NULL;
+__thread bin_array thread_bins[NUM_BINS];
+__thread unsigned long thread_bin_map = 0;
 
 
 /* Free list head */
@@ -46,17 +72,87 @@ block_node * free_list_tail = NULL;
 /* Free list size */
 unsigned long free_size = 0;
 
+/* Roving pointer for next fit: the free block the next search starts at */
+block_node * rover = NULL;
 
-/* Synchronization primitives for locking malloc/free and sbrk calls:
+/* Size-segregated bins over the free list and the bitmap of non-empty bins */
+bin_array bins[NUM_BINS];
+unsigned long bin_map = 0;
+
+
+/* Synchronization primitives for locking malloc/free and sbrk calls.
+ * Their type is selected with LOCK= in the Makefile (see ts_lock.h):
  * 
- * -NOTE- According to man pages:
+ * -NOTE- For the default pthread mutex, according to man pages:
  * In cases where default mutex attributes are appropriate, the macro PTHREAD_MUTEX_INITIALIZER 
  * can be used to initialize mutexes that are statically allocated. The effect shall be equivalent
  * to dynamic initialization by a call to pthread_mutex_init() with parameter attr specified as 
  * NULL, except that no error checks are performed. 
  */
-pthread_mutex_t sbrk_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t list_lock = PTHREAD_MUTEX_INITIALIZER;
+ts_lock_t sbrk_mutex = TS_LOCK_INITIALIZER;
+ts_lock_t list_lock = TS_LOCK_INITIALIZER;
+
+/* Spin rounds before a lock waiter yields (see ts_lock.h) */
+int ts_spin_limit = -1;
+
+#if TS_LOCK_TYPE == TS_LOCK_MCS
+/* MCS queue nodes of this thread, one per lock held (see ts_lock.h) */
+__thread mcs_node mcs_nodes[MCS_MAX_NESTING];
+__thread int mcs_depth = 0;
+#endif
+
+
+/* Deferred coalescing: small blocks are free'd onto quick lists, one per 
+ * block size, without being merged. They are consolidated into the free 
+ * list in one batch when QUICK_THRESHOLD of them have piled up, or when a 
+ * request too large for the quick lists finds nothing to re-use. */
+#define QUICK_MAX_BLOCK (SMALL_SIZE_MAX + META_DATA_SIZE)
+#define NUM_QUICK_BINS (QUICK_MAX_BLOCK / ALIGNMENT + 1)
+
+int deferred_coalescing = 0;
+block_node * quick_bins[NUM_QUICK_BINS];
+unsigned long quick_count = 0;
+__thread block_node * thread_quick_bins[NUM_QUICK_BINS];
+__thread unsigned long thread_quick_count = 0;
+
+
+/* Set by grow_heap when it hands the calling thread memory straight from 
+ * the OS, which the kernel has already zeroed (read by calloc) */
+__thread int fresh_from_os = 0;
+
+/* Nanoseconds the calling thread has waited for list_lock in malloc and 
+ * free (read by the adaptive ts_malloc/ts_free) */
+__thread unsigned long long list_lock_wait_ns = 0;
+
+
+/* Takes list_lock for malloc or free, timing the wait when it is contended */
+static inline void acquire_list_lock(){
+  if (ts_lock_trylock(&list_lock)){
+    return;
+  }
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  ts_lock_acquire(&list_lock);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  list_lock_wait_ns += (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+}
+
+/* Recycled calloc payloads at least this large are zeroed by dropping 
+ * their pages with MADV_DONTNEED instead of with memset */
+#define CALLOC_MADVISE_MIN (128 * 1024)
+
+/* Blocks of at least this size get an mmap mapping of their own, which is 
+ * unmapped when free'd and resized by realloc without copying */
+#define MMAP_THRESHOLD (128 * 1024)
+
+/* Bytes currently mapped for large blocks */
+unsigned long mmapped_bytes = 0;
+
+
+/* Placement policy and the good fit search bounds */
+placement_policy current_policy = DEFAULT_POLICY;
+unsigned good_fit_candidates = 8;
+unsigned good_fit_tolerance = 10;
 
 
 /* Global variable for determining size of entire data segment */
@@ -132,6 +228,330 @@ void thread_print_free(){
 }
 
 
+/* Returns the bin for a free block of the given size. Blocks below 1 KiB
+ * get bins 32 bytes apart, larger blocks get 4 bins per power of two and
+ * everything from 256 KiB up shares the last bin. Every block in a bin is 
+ * smaller than every block in the bins above it. */
+unsigned bin_index(size_t size){
+  if (size < 1024){
+    return size >> 5;
+  }
+  unsigned log = 63 - __builtin_clzl(size); // >= 10
+  unsigned index = 32 + ((log - 10) << 2) + ((size >> (log - 2)) & 3);
+  return index < NUM_BINS ? index : NUM_BINS - 1;
+}
+
+
+/* Smallest block size that falls in a bin (inverse of bin_index) */
+static size_t bin_lower_bound(unsigned index){
+  if (index < 32){
+    return (size_t) index << 5;
+  }
+  unsigned log = 10 + ((index - 32) >> 2);
+  return (1UL << log) + ((size_t)((index - 32) & 3) << (log - 2));
+}
+
+
+/* Splitting threshold for a request of size block_size */
+static inline size_t get_split_threshold(size_t block_size){
+  size_t threshold = split_threshold[bin_index(block_size)];
+  return threshold ? threshold : MIN_SIZE; // zero until first set
+}
+
+
+/* Recomputes the split thresholds from the request histogram (adapt_lock 
+ * held). A leftover smaller than nearly every request is unlikely to be 
+ * re-used before it is coalesced again, so the base threshold is the 
+ * smallest request size in the 5th percentile of recent requests. Larger
+ * request bins tolerate proportionally more slack before paying for a split:
+ * their threshold is at least 1/8 of the bin's smallest block. The histogram 
+ * is halved afterwards so older phases of the program fade out. */
+static void adapt_split_thresholds(){
+  unsigned long total = 0;
+  unsigned long running = 0;
+  unsigned index;
+  for (index = 0; index < NUM_BINS; index++){
+    total += request_histogram[index];
+  }
+  if (total == 0){
+    return;
+  }
+  for (index = 0; index < NUM_BINS - 1; index++){
+    running += request_histogram[index];
+    if (running * 20 >= total){
+      break;
+    }
+  }
+  size_t base = bin_lower_bound(index);
+  if (base < MIN_BLOCK_SIZE){
+    base = MIN_BLOCK_SIZE;
+  }
+  for (index = 0; index < NUM_BINS; index++){
+    size_t proportional = bin_lower_bound(index) / 8;
+    split_threshold[index] = proportional > base ? proportional : base;
+    request_histogram[index] >>= 1;
+  }
+}
+
+
+/* Folds the calling thread's request counts into the shared ones and, if 
+ * the thresholds are adaptive, recomputes them. */
+static void fold_request_counts(){
+  unsigned index;
+  pthread_mutex_lock(&adapt_lock);
+  for (index = 0; index < NUM_BINS; index++){
+    request_histogram[index] += thread_request_histogram[index];
+    thread_request_histogram[index] = 0;
+  }
+  requested_bytes += thread_requested_bytes;
+  slack_bytes += thread_slack_bytes;
+  thread_requested_bytes = thread_slack_bytes = 0;
+  thread_requests = 0;
+  if (split_adaptive){
+    adapt_split_thresholds();
+  }
+  pthread_mutex_unlock(&adapt_lock);
+}
+
+
+/* Records a malloc request of size block_size. */
+static inline void note_request(size_t block_size){
+  thread_request_histogram[bin_index(block_size)]++;
+  thread_requested_bytes += block_size;
+  if (++thread_requests >= ADAPT_INTERVAL){
+    fold_request_counts();
+  }
+}
+
+
+/* Sets the leftover (in bytes, counting its block_node) a block must have to
+ * be split, for every request size. 0 goes back to adaptive thresholds. */
+void ts_set_split_threshold(size_t bytes){
+  unsigned index;
+  pthread_mutex_lock(&adapt_lock);
+  split_adaptive = (bytes == 0);
+  if (bytes && (bytes < MIN_BLOCK_SIZE)){
+    bytes = MIN_BLOCK_SIZE; // the leftover must be able to hold a free block
+  }
+  for (index = 0; index < NUM_BINS; index++){
+    split_threshold[index] = bytes;
+  }
+  if (split_adaptive){
+    adapt_split_thresholds();
+  }
+  pthread_mutex_unlock(&adapt_lock);
+}
+
+
+/* Packed size of a block for the bin's size array */
+#define PACKED_SIZE(size) ((size) < UINT32_MAX ? (uint32_t)(size) : UINT32_MAX)
+
+/* Doubles the capacity of a bin's arrays. Returns 0 on failure. */
+static int bin_array_grow(bin_array * bin){
+  size_t new_capacity = bin->capacity ? bin->capacity * 2 : 1024;
+  uint32_t * sizes;
+  block_node ** blocks;
+  if (bin->capacity == 0){
+    sizes = mmap(NULL, new_capacity * sizeof(uint32_t), PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    blocks = mmap(NULL, new_capacity * sizeof(block_node *), PROT_READ | PROT_WRITE,
+		  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  }
+  else{
+    sizes = mremap(bin->sizes, bin->capacity * sizeof(uint32_t), 
+		   new_capacity * sizeof(uint32_t), MREMAP_MAYMOVE);
+    blocks = mremap(bin->blocks, bin->capacity * sizeof(block_node *), 
+		    new_capacity * sizeof(block_node *), MREMAP_MAYMOVE);
+  }
+  if ((sizes == MAP_FAILED) || (blocks == MAP_FAILED)){
+    fprintf(stderr, "Error: could not grow free list bin to %lu blocks\n", new_capacity);
+    if (bin->capacity == 0){ // a first mapping that succeeded alone is not kept
+      if (sizes != MAP_FAILED){
+	munmap(sizes, new_capacity * sizeof(uint32_t));
+      }
+      if (blocks != MAP_FAILED){
+	munmap(blocks, new_capacity * sizeof(block_node *));
+      }
+      return 0;
+    }
+    if (sizes != MAP_FAILED){ // moved at the old capacity
+      bin->sizes = sizes;
+    }
+    if (blocks != MAP_FAILED){
+      bin->blocks = blocks;
+    }
+    return 0;
+  }
+  bin->sizes = sizes;
+  bin->blocks = blocks;
+  bin->capacity = new_capacity;
+  return 1;
+}
+
+
+/* Appends a free block to its bin in bins and marks the bin non-empty in map */
+static void bin_array_insert(bin_array * bins, unsigned long * map, block_node * to_add){
+  unsigned index = bin_index(to_add->size);
+  bin_array * bin = &bins[index];
+  if ((bin->count == bin->capacity) && !bin_array_grow(bin)){
+    return; // the block stays on the free list for coalescing but cannot be searched
+  }
+  bin->sizes[bin->count] = PACKED_SIZE(to_add->size);
+  bin->blocks[bin->count] = to_add;
+  BIN_POS(to_add) = bin->count++;
+  *map |= 1UL << index;
+}
+
+
+/* Removes a free block from its bin by moving the bin's last entry into its
+ * slot. Must be called before the block's size changes. */
+static void bin_array_remove(bin_array * bins, unsigned long * map, block_node * to_remove){
+  unsigned index = bin_index(to_remove->size);
+  bin_array * bin = &bins[index];
+  size_t pos = BIN_POS(to_remove);
+  if ((pos >= bin->count) || (bin->blocks[pos] != to_remove)){
+    return; // never made it into the bin
+  }
+  size_t last = --bin->count;
+  if (pos != last){
+    bin->sizes[pos] = bin->sizes[last];
+    bin->blocks[pos] = bin->blocks[last];
+    BIN_POS(bin->blocks[pos]) = pos;
+  }
+  if (bin->count == 0){
+    *map &= ~(1UL << index); // bin now empty
+  }
+}
+
+
+/* Best fit over the bins: the first non-empty bin at or above the request's
+ * bin comes from one masked count-trailing-zeros on the bitmap, and only that
+ * bin needs searching, since a block in any higher bin is larger than every
+ * block in it. The search within a bin is a vector min over packed sizes. */
+static block_node * bin_array_best_fit(bin_array * bins, unsigned long map, size_t size){
+  unsigned long candidates = map & (~0UL << bin_index(size));
+  while (candidates){
+    bin_array * bin = &bins[__builtin_ctzl(candidates)];
+    size_t pos = bin_min_fit(bin->sizes, bin->count, PACKED_SIZE(size));
+    if (pos < bin->count){
+      block_node * result = bin->blocks[pos];
+      if (result->size < size){ // request beyond 4 GiB, compare the real sizes
+	size_t i;
+	result = NULL;
+	for (i = 0; i < bin->count; i++){
+	  if ((bin->blocks[i]->size >= size) && ((result == NULL) || (bin->blocks[i]->size < result->size))){
+	    result = bin->blocks[i];
+	  }
+	}
+      }
+      if (result){
+	return result;
+      }
+    }
+    candidates &= candidates - 1; // nothing fits in this bin, try the next one up
+  }
+  return NULL;
+}
+
+
+/* Good fit over the bins: walks the packed sizes from the request's bin up and
+ * stops after max_candidates fitting blocks, or at the first block that 
+ * wastes no more than good_enough bytes. */
+static block_node * bin_array_good_fit(bin_array * bins, unsigned long map, size_t size,
+				       unsigned max_candidates, size_t good_enough){
+  unsigned long candidates = map & (~0UL << bin_index(size));
+  size_t smallest_diff = ULONG_MAX;
+  unsigned seen = 0;
+  block_node * result = NULL;
+  while (candidates && (seen < max_candidates)){
+    bin_array * bin = &bins[__builtin_ctzl(candidates)];
+    size_t i;
+    for (i = 0; (i < bin->count) && (seen < max_candidates); i++){
+      size_t current_size = bin->blocks[i]->size;
+      if (bin->sizes[i] < UINT32_MAX){ // avoid loading the block unless it is huge
+	current_size = bin->sizes[i];
+      }
+      if (current_size >= size){
+	seen++;
+	if (current_size - size < smallest_diff){
+	  smallest_diff = current_size - size;
+	  result = bin->blocks[i];
+	  if (smallest_diff <= good_enough){
+	    return result; // close enough, stop searching
+	  }
+	}
+      }
+    }
+    candidates &= candidates - 1;
+  }
+  return result;
+}
+
+
+/* Adds a free block to its bin, stamped with the current purge tick */
+static void bin_insert(block_node * to_add){
+  BIN_STAMP(to_add) = __atomic_load_n(&purge_epoch, __ATOMIC_RELAXED);
+  bin_array_insert(bins, &bin_map, to_add);
+}
+
+
+/* Removes a free block from its bin, must be called before its size changes */
+static void bin_remove(block_node * to_remove){
+  bin_array_remove(bins, &bin_map, to_remove);
+}
+
+
+/* Set while the calling thread's bin arrays are to be unmapped at its exit */
+static __thread int thread_bins_registered = 0;
+
+static pthread_key_t thread_bins_key;
+static pthread_once_t thread_bins_once = PTHREAD_ONCE_INIT;
+
+
+/* Unmaps the exiting thread's bin arrays. A free in a later destructor 
+ * maps them again and registers again, so this runs once more. */
+static void thread_bins_exit(void * arg){
+  (void) arg;
+  unsigned i;
+  for (i = 0; i < NUM_BINS; i++){
+    bin_array * bin = &thread_bins[i];
+    if (bin->capacity){
+      munmap(bin->sizes, bin->capacity * sizeof(uint32_t));
+      munmap(bin->blocks, bin->capacity * sizeof(block_node *));
+    }
+    bin->sizes = NULL;
+    bin->blocks = NULL;
+    bin->count = bin->capacity = 0;
+  }
+  thread_bin_map = 0;
+  thread_bins_registered = 0;
+}
+
+
+static void thread_bins_setup(){
+  if (pthread_key_create(&thread_bins_key, thread_bins_exit) != 0){
+    fprintf(stderr, "Error: could not create the thread bins key\n");
+  }
+}
+
+
+/* Adds a free block to its bin (thread local storage version) */
+static void thread_bin_insert(block_node * to_add){
+  if (__builtin_expect(!thread_bins_registered, 0)){
+    pthread_once(&thread_bins_once, thread_bins_setup);
+    pthread_setspecific(thread_bins_key, thread_bins); // non-NULL, so thread_bins_exit runs
+    thread_bins_registered = 1;
+  }
+  bin_array_insert(thread_bins, &thread_bin_map, to_add);
+}
+
+
+/* Removes a free block from its bin (thread local storage version) */
+static void thread_bin_remove(block_node * to_remove){
+  bin_array_remove(thread_bins, &thread_bin_map, to_remove);
+}
+
+
 /* Adds to the free list in sorted order. 
  * Sorted insert is used to ensure that free blocks that form a contiguous 
  * segment in the heap are neighbors in the list and can be easily coalesced. */
@@ -168,6 +588,7 @@ void add_to_free_list(block_node * to_add){
     current->next = to_add;
   } 
   free_size++;
+  bin_insert(to_add);
 }
 
 
@@ -207,20 +628,204 @@ void thread_add_to_free_list(block_node * to_add){
     current->next = to_add;
   } 
   thread_list_size++;
+  thread_bin_insert(to_add);
+}
+
+
+
+/* Adds to the free list in sorted order, searching forward from hint, a free
+ * block at a lower address than to_add (starts at the head if hint is NULL). */
+static void add_to_free_list_after(block_node * hint, block_node * to_add){
+  if (hint == NULL){
+    add_to_free_list(to_add);
+    return;
+  }
+  block_node * current = hint;
+  while ((current->next) && (to_add > current->next)){
+    current = current->next;
+  }
+  to_add->next = current->next;
+  to_add->prev = current;
+  if (current->next){
+    current->next->prev = to_add;
+  }
+  else{
+    free_list_tail = to_add;
+  }
+  current->next = to_add;
+  free_size++;
+  bin_insert(to_add);
+}
+
+
+/* Adds to the free list in sorted order, searching forward from hint 
+ * (thread local storage version). */
+static void thread_add_to_free_list_after(block_node * hint, block_node * to_add){
+  if (hint == NULL){
+    thread_add_to_free_list(to_add);
+    return;
+  }
+  block_node * current = hint;
+  while ((current->next) && (to_add > current->next)){
+    current = current->next;
+  }
+  to_add->next = current->next;
+  to_add->prev = current;
+  if (current->next){
+    current->next->prev = to_add;
+  }
+  else{
+    thread_tail = to_add;
+  }
+  current->next = to_add;
+  thread_list_size++;
+  thread_bin_insert(to_add);
+}
+
+
+/* Merge sorts a list of blocks linked through next by address. */
+static block_node * sort_by_address(block_node * list){
+  if ((list == NULL) || (list->next == NULL)){
+    return list;
+  }
+  block_node * slow = list;
+  block_node * fast = list->next;
+  while (fast && fast->next){ // find the middle
+    slow = slow->next;
+    fast = fast->next->next;
+  }
+  block_node * second = slow->next;
+  slow->next = NULL;
+  list = sort_by_address(list);
+  second = sort_by_address(second);
+  block_node head;
+  block_node * tail = &head;
+  while (list && second){
+    if (list < second){
+      tail->next = list;
+      list = list->next;
+    }
+    else{
+      tail->next = second;
+      second = second->next;
+    }
+    tail = tail->next;
+  }
+  tail->next = list ? list : second;
+  return head.next;
 }
 
 
+/* Copies up to max of the blocks waiting on the quick lists into out and
+ * returns how many were copied (list_lock held). */
+unsigned long get_quick_blocks(block_node ** out, unsigned long max){
+  unsigned long count = 0;
+  unsigned i;
+  for (i = 0; i < NUM_QUICK_BINS; i++){
+    block_node * current;
+    for (current = quick_bins[i]; current && (count < max); current = current->next){
+      out[count++] = current;
+    }
+  }
+  return count;
+}
+
+
+/* Moves every block on the quick lists into the free list and coalesces it.
+ * The batch is sorted by address first so it is merged in a single forward
+ * pass over the free list. */
+void consolidate(){
+  block_node * batch = NULL;
+  block_node * current = NULL;
+  unsigned i;
+  for (i = 0; i < NUM_QUICK_BINS; i++){
+    while ((current = quick_bins[i])){
+      quick_bins[i] = current->next;
+      current->next = batch;
+      batch = current;
+    }
+  }
+  quick_count = 0;
+  batch = sort_by_address(batch);
+
+  block_node * hint = NULL;
+  while (batch){
+    block_node * next = batch->next;
+    add_to_free_list_after(hint, batch);
+    block_node * before = batch->prev;
+    coalesce(batch);
+    if (before && ((char *) before + before->size > (char *) batch)){
+      hint = before; // merged into the previous block
+    }
+    else{
+      hint = batch;
+    }
+    batch = next;
+  }
+}
+
+
+/* Moves every block on the quick lists into the free list and coalesces it
+ * (thread local storage version). */
+void thread_consolidate(){
+  block_node * batch = NULL;
+  block_node * current = NULL;
+  unsigned i;
+  for (i = 0; i < NUM_QUICK_BINS; i++){
+    while ((current = thread_quick_bins[i])){
+      thread_quick_bins[i] = current->next;
+      current->next = batch;
+      batch = current;
+    }
+  }
+  thread_quick_count = 0;
+  batch = sort_by_address(batch);
+
+  block_node * hint = NULL;
+  while (batch){
+    block_node * next = batch->next;
+    thread_add_to_free_list_after(hint, batch);
+    block_node * before = batch->prev;
+    thread_coalesce(batch);
+    if (before && ((char *) before + before->size > (char *) batch)){
+      hint = before;
+    }
+    else{
+      hint = batch;
+    }
+    batch = next;
+  }
+}
+
+
+/* Turns deferred coalescing on or off. Turning it off consolidates the 
+ * locking free list's quick lists right away; each thread's own quick lists
+ * are consolidated on its next no-lock malloc. */
+void ts_set_deferred_coalescing(int enable){
+  ts_lock_acquire(&list_lock);
+  deferred_coalescing = (enable != 0);
+  if (!deferred_coalescing){
+    consolidate();
+  }
+  ts_lock_release(&list_lock);
+}
+
 
 /* Splits a previously allocated block that has been selected for a malloc request.
- * The block should only be split if it can hold the minimum set size (MIN_SIZE). 
+ * The block should only be split if the leftover reaches the split threshold
+ * for this request size (MIN_SIZE until the thresholds adapt). 
  * The size_needed parameter is the whole block size (for the malloc request AND block_node).
  * This function essentially creates a block within another block and
  * adds it to the list of free blocks.*/
 void attempt_split(block_node * to_split, size_t size_needed){  
-  if (to_split->size - size_needed >= MIN_SIZE){
+  if (to_split->size - size_needed < get_split_threshold(size_needed)){
+    thread_slack_bytes += to_split->size - size_needed; // kept as internal fragmentation
+  }
+  else{
 
     //num_splits++; // collect for performance analysis
 
+    bin_remove(to_split); // re-binned below with its new size
     block_node * new_block = (block_node *) ((char *) to_split + size_needed);
     new_block->size = to_split->size - size_needed; // set new block's size to remaining size
     new_block->next = to_split->next;
@@ -234,21 +839,28 @@ void attempt_split(block_node * to_split, size_t size_needed){
     to_split->size = size_needed; // update the size for the split block
     to_split->next = new_block;
     free_size++; // update free list size
+    bin_insert(to_split);
+    bin_insert(new_block);
   }
 }  
 
 
 
 /* Splits a previously allocated block that has been selected for a malloc request.
- * The block should only be split if it can hold the minimum set size (MIN_SIZE). 
+ * The block should only be split if the leftover reaches the split threshold
+ * for this request size (MIN_SIZE until the thresholds adapt). 
  * The size_needed parameter is the whole block size (for the malloc request AND block_node).
  * This function essentially creates a block within another block and
  * adds it to the list of free blocks (thread local storage version) */
 void thread_attempt_split(block_node * to_split, size_t size_needed){  
-  if (to_split->size - size_needed >= MIN_SIZE){
+  if (to_split->size - size_needed < get_split_threshold(size_needed)){
+    thread_slack_bytes += to_split->size - size_needed;
+  }
+  else{
 
     //num_splits++; // collect for performance analysis
     
+    thread_bin_remove(to_split);
     block_node * new_block = (block_node *) ((char *) to_split + size_needed);
     new_block->size = to_split->size - size_needed; // set new block's size to remaining size
     new_block->next = to_split->next;
@@ -262,6 +874,8 @@ void thread_attempt_split(block_node * to_split, size_t size_needed){
     to_split->size = size_needed; // update the size for the split block
     to_split->next = new_block;
     thread_list_size++;
+    thread_bin_insert(to_split);
+    thread_bin_insert(new_block);
   }
 }  
 
@@ -279,8 +893,10 @@ void coalesce(block_node * free_block){
 
 	//num_cos++; // collect for performance analysis
 
+	bin_remove(free_block); // size changes, re-bin after the merge
 	free_block->size += free_block->next->size;
 	remove_from_free_list(free_block->next);	
+	bin_insert(free_block);
 	if (free_size == 1){
 	  return; // no blocks left to coalesce
 	}
@@ -292,8 +908,11 @@ void coalesce(block_node * free_block){
 	
 	//num_cos++; // collect for performance analysis
 
-	free_block->prev->size += free_block->size;
+	block_node * merged = free_block->prev;
+	bin_remove(merged);
+	merged->size += free_block->size;
 	remove_from_free_list(free_block);
+	bin_insert(merged);
       }
     }
   }
@@ -303,15 +922,17 @@ void coalesce(block_node * free_block){
 /* Coalesces either 2 or 3 adjacent free blocks together and 
  * updates the free list accordingly (thread local storage version). */
 void thread_coalesce(block_node * free_block){
-  if(free_size > 1){
+  if(thread_list_size > 1){
     if (free_block->next){
       block_node * next_location = (block_node *)((char*) free_block + free_block->size); 
       if (next_location == free_block->next){ 
 	
 	//num_cos++; // collect for performance analysis
 
+	thread_bin_remove(free_block);
 	free_block->size += free_block->next->size;
 	thread_remove_from_free_list(free_block->next);
+	thread_bin_insert(free_block);
 	if (thread_list_size == 1){
 	  return; // no blocks left to coalesce
 	}
@@ -323,8 +944,11 @@ void thread_coalesce(block_node * free_block){
 	
 	//num_cos++; // collect for performance analysis
 
-	free_block->prev->size += free_block->size;
+	block_node * merged = free_block->prev;
+	thread_bin_remove(merged);
+	merged->size += free_block->size;
 	thread_remove_from_free_list(free_block);
+	thread_bin_insert(merged);
       }
     }
   }
@@ -341,6 +965,10 @@ void remove_from_free_list(block_node * to_remove){
     fprintf(stderr, "Error: target block_node to remove from free list is NULL\n");
     return;
   }
+  bin_remove(to_remove);
+  if (to_remove == rover){ // keep the next fit pointer on a free block
+    rover = to_remove->next;
+  }
   if (to_remove == free_list_head){
     free_size--;
     free_list_head = free_list_head->next;
@@ -382,6 +1010,10 @@ void thread_remove_from_free_list(block_node * to_remove){
     return;
     fprintf(stderr, "Error: target block_node to remove from free list is NULL\n");
   }
+  thread_bin_remove(to_remove);
+  if (to_remove == thread_rover){
+    thread_rover = to_remove->next;
+  }
   if (to_remove == thread_head){
     thread_list_size--;
     thread_head = thread_head->next;
@@ -413,43 +1045,104 @@ void thread_remove_from_free_list(block_node * to_remove){
 }
 
 
+/* Maps a block of its own for a large request. The block's size is the 
+ * whole mapping, flagged with BLOCK_MMAPPED. */
+static block_node * mmap_block(size_t size){
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t length = (size + page - 1) & ~(page - 1);
+  block_node * new_block = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (new_block == MAP_FAILED){
+    fprintf(stderr, "Error: mmap call with size %lu failed\n", length);
+    return NULL;
+  }
+  if (page_map_add_mapping(new_block, length) != 0){
+    munmap(new_block, length);
+    return NULL;
+  }
+  __atomic_add_fetch(&mmapped_bytes, length, __ATOMIC_RELAXED);
+  fresh_from_os = 1;
+  new_block->size = length | BLOCK_MMAPPED;
+  return new_block;
+}
+
+
+/* Returns a large block's mapping of length bytes to the OS */
+static void munmap_block(block_node * to_free, size_t length){
+  page_map_remove_mapping(to_free); // before the address can be mapped again
+  __atomic_sub_fetch(&mmapped_bytes, length, __ATOMIC_RELAXED);
+  if (munmap(to_free, length) != 0){
+    fprintf(stderr, "Error: munmap of block %p failed\n", (void *) to_free);
+  }
+}
+
+
+/* Resizes a large block's mapping with mremap, which moves page table 
+ * entries rather than copying the contents. Returns NULL on failure, when
+ * the old mapping is left as it was. */
+static block_node * mremap_block(block_node * block, size_t size){
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t old_length = BLOCK_SIZE(block);
+  size_t length = (size + page - 1) & ~(page - 1);
+  if (length == old_length){
+    return block;
+  }
+  page_map_remove_mapping(block);
+  block_node * new_block = mremap(block, old_length, length, MREMAP_MAYMOVE);
+  if (new_block == MAP_FAILED){
+    fprintf(stderr, "Error: mremap call with size %lu failed\n", length);
+    page_map_add_mapping(block, old_length);
+    return NULL;
+  }
+  page_map_add_mapping(new_block, length);
+  if (length > old_length){
+    __atomic_add_fetch(&mmapped_bytes, length - old_length, __ATOMIC_RELAXED);
+  }
+  else{
+    __atomic_sub_fetch(&mmapped_bytes, old_length - length, __ATOMIC_RELAXED);
+  }
+  new_block->size = length | BLOCK_MMAPPED;
+  return new_block;
+}
+
+
 /* Extends the heap by size bytes and returns a block_node pointer to the old 
  * break location, which will be the address of the added block.
+ * In THP mode the block is carved out of a huge page backed chunk instead.
  * This function is used by both the locking and non-locking malloc. */   
 block_node * grow_heap(size_t size){
   block_node * new_block = NULL;
 
-  pthread_mutex_lock(&sbrk_mutex);
-  if ((new_block = sbrk(size)) == (void *) -1){ // check if sbrk failed, return NULL if true
-    pthread_mutex_unlock(&sbrk_mutex);
-    fprintf(stderr, "Error: sbrk call with size %lu failed\n", size);	
-    return NULL;
+  purge_init();
+  profile_init();
+  PROFILE_GROWTH(size);
+  ts_lock_acquire(&sbrk_mutex);
+  if (thp_chunks_enabled()){ // carve from a huge page backed chunk instead
+    if ((new_block = thp_chunk_alloc(size)) == NULL){
+      ts_lock_release(&sbrk_mutex);
+      return NULL;
+    }
   }
-  pthread_mutex_unlock(&sbrk_mutex);
-
-  //data_segment_size += size; // keep track of data segment size
+  else{
+    if ((new_block = sbrk(size)) == (void *) -1){ // check if sbrk failed, return NULL if true
+      ts_lock_release(&sbrk_mutex);
+      fprintf(stderr, "Error: sbrk call with size %lu failed\n", size);	
+      return NULL;
+    }
+    record_sbrk_growth(new_block, size);
+    data_segment_size += size; // keep track of data segment size
+  }
+  new_block->size = size; // set under sbrk_mutex, so ts_heap_walk never sees it unset
+  ts_lock_release(&sbrk_mutex);
   
-  new_block->size = size; // set size of the block   
+  fresh_from_os = 1;
   return new_block;
 }
 
 
-/* Search for free'd block to use, only search free list for performance. */
+/* Search for free'd block to use, only search free list for performance. 
+ * Only the bins that can hold the request are searched (see bin_array_best_fit). */
 block_node * try_block_reuse_bf(size_t size){
-  block_node * current_block = free_list_head; // get the head of the free list
-  size_t smallest_diff = ULONG_MAX; 
-  size_t current_diff;
-  block_node * result = NULL;
-  while (current_block){
-    if (current_block->size >= size){ // if the current block can accomodate request
-      current_diff = current_block->size - size;
-      if (current_diff < smallest_diff){
-	smallest_diff = current_diff; 
-	result = current_block; // update best fitting block
-      }
-    }
-    current_block = current_block->next; 
-  }
+  block_node * result = bin_array_best_fit(bins, bin_map, size);
   if (result){ // if block found, attempt to split it
     attempt_split(result, size);
   }
@@ -460,47 +1153,201 @@ block_node * try_block_reuse_bf(size_t size){
 /* Search for free'd block to use, only search free list for performance 
  * (thread local storage version). */
 block_node * thread_try_block_reuse_bf(size_t size){
-  block_node * current_block = thread_head; 
-  size_t smallest_diff = ULONG_MAX; 
-  size_t current_diff;
-  block_node * result = NULL;
-  while (current_block){ 
-    if (current_block->size >= size){ 
-      current_diff = current_block->size - size;
-      if (current_diff < smallest_diff){
-	smallest_diff = current_diff; 
-	result = current_block;
-      }
+  block_node * result = bin_array_best_fit(thread_bins, thread_bin_map, size);
+  if (result){
+    thread_attempt_split(result, size);
+  }
+  return result;
+}
+  
+
+/* First fit: takes the lowest addressed free block that can hold the request. */
+block_node * try_block_reuse_ff(size_t size){
+  block_node * result = free_list_head;
+  while (result && (result->size < size)){
+    result = result->next;
+  }
+  if (result){
+    attempt_split(result, size);
+  }
+  return result;
+}
+
+
+/* First fit (thread local storage version). */
+block_node * thread_try_block_reuse_ff(size_t size){
+  block_node * result = thread_head;
+  while (result && (result->size < size)){
+    result = result->next;
+  }
+  if (result){
+    thread_attempt_split(result, size);
+  }
+  return result;
+}
+
+
+/* Next fit: first fit that starts at the roving pointer and wraps around to
+ * the head of the list. The rover is left just past the chosen block (on the
+ * remainder if the block is split). */
+block_node * try_block_reuse_nf(size_t size){
+  block_node * start = rover ? rover : free_list_head;
+  block_node * result = start;
+  while (result && (result->size < size)){
+    result = result->next;
+  }
+  if (result == NULL){ // wrap around
+    result = free_list_head;
+    while ((result != start) && (result->size < size)){
+      result = result->next;
+    }
+    if (result == start){
+      return NULL;
     }
-    current_block = current_block->next;
   }
+  attempt_split(result, size);
+  rover = result->next;
+  return result;
+}
+
+
+/* Next fit (thread local storage version). */
+block_node * thread_try_block_reuse_nf(size_t size){
+  block_node * start = thread_rover ? thread_rover : thread_head;
+  block_node * result = start;
+  while (result && (result->size < size)){
+    result = result->next;
+  }
+  if (result == NULL){
+    result = thread_head;
+    while ((result != start) && (result->size < size)){
+      result = result->next;
+    }
+    if (result == start){
+      return NULL;
+    }
+  }
+  thread_attempt_split(result, size);
+  thread_rover = result->next;
+  return result;
+}
+
+
+/* Good fit: best fit over the bins that gives up early, after looking at 
+ * good_fit_candidates blocks that fit or at the first block that wastes no 
+ * more than good_fit_tolerance percent of the request. */
+block_node * try_block_reuse_gf(size_t size){
+  block_node * result = bin_array_good_fit(bins, bin_map, size, good_fit_candidates,
+					   size / 100 * good_fit_tolerance);
+  if (result){
+    attempt_split(result, size);
+  }
+  return result;
+}
+
+
+/* Good fit (thread local storage version). */
+block_node * thread_try_block_reuse_gf(size_t size){
+  block_node * result = bin_array_good_fit(thread_bins, thread_bin_map, size, good_fit_candidates,
+					   size / 100 * good_fit_tolerance);
   if (result){
     thread_attempt_split(result, size);
   }
   return result;
 }
+
+
+/* Re-uses a free'd block with the selected placement policy. */
+block_node * try_block_reuse(size_t size){
+  switch (current_policy){
+  case POLICY_FIRST_FIT:
+    return try_block_reuse_ff(size);
+  case POLICY_NEXT_FIT:
+    return try_block_reuse_nf(size);
+  case POLICY_GOOD_FIT:
+    return try_block_reuse_gf(size);
+  default:
+    return try_block_reuse_bf(size);
+  }
+}
+
+
+/* Re-uses a free'd block with the selected placement policy 
+ * (thread local storage version). */
+block_node * thread_try_block_reuse(size_t size){
+  switch (current_policy){
+  case POLICY_FIRST_FIT:
+    return thread_try_block_reuse_ff(size);
+  case POLICY_NEXT_FIT:
+    return thread_try_block_reuse_nf(size);
+  case POLICY_GOOD_FIT:
+    return thread_try_block_reuse_gf(size);
+  default:
+    return thread_try_block_reuse_bf(size);
+  }
+}
+
+
+/* Selects the placement policy used by both malloc versions. */
+void ts_set_placement_policy(placement_policy policy, unsigned max_candidates, unsigned tolerance_pct){
+  ts_lock_acquire(&list_lock);
+  current_policy = policy;
+  if (max_candidates){
+    good_fit_candidates = max_candidates;
+  }
+  good_fit_tolerance = tolerance_pct;
+  ts_lock_release(&list_lock);
+}
   
 
 /* Thread-safe malloc lock version. */
 void * ts_malloc_lock(size_t size){
-  size_t block_size = size + META_DATA_SIZE;
+  if (size > SIZE_MAX - 2 * META_DATA_SIZE){ // block size would overflow
+    return NULL;
+  }
+  size_t block_size = ALIGN(size) + META_DATA_SIZE;
+  if (block_size < MIN_BLOCK_SIZE){ // room for the bin links once freed
+    block_size = MIN_BLOCK_SIZE;
+  }
   block_node * target_block = NULL;
 
+  if (block_size >= MMAP_THRESHOLD){ // large blocks bypass the free list
+    if ((target_block = mmap_block(block_size)) == NULL){
+      return NULL;
+    }
+    PROFILE_MALLOC(target_block, size);
+    return (char*)target_block + META_DATA_SIZE;
+  }
+
   if (original_break){ // if blocks have been allocated
 
-    pthread_mutex_lock(&list_lock);// lock list for attempted search and removal
+    acquire_list_lock();// lock list for attempted search and removal
     
     //num_mallocs++;
     //sum_malloc_requests += block_size; // collect data for performance analysis
+    note_request(block_size);
+
+    if (deferred_coalescing && (block_size <= QUICK_MAX_BLOCK) && quick_bins[block_size / ALIGNMENT]){ 
+      target_block = quick_bins[block_size / ALIGNMENT]; // exact size on a quick list
+      quick_bins[block_size / ALIGNMENT] = target_block->next;
+      quick_count--;
+      ts_lock_release(&list_lock);
+      PROFILE_MALLOC(target_block, size);
+      return (char*)target_block + META_DATA_SIZE;
+    }
 
-    target_block = try_block_reuse_bf(block_size);
+    target_block = try_block_reuse(block_size);
+    if ((target_block == NULL) && quick_count && (block_size > QUICK_MAX_BLOCK)){
+      consolidate(); // large request missed, merge the quick lists and retry
+      target_block = try_block_reuse(block_size);
+    }
     
     if (target_block){ // if block found for re-use 
       remove_from_free_list(target_block);       
-      pthread_mutex_unlock(&(list_lock)); // unlock after free list modified 
+      ts_lock_release(&list_lock); // unlock after free list modified 
     }
     else{ // extend the heap if no block found
-      pthread_mutex_unlock(&(list_lock)); // unlock after failed search and removal
+      ts_lock_release(&list_lock); // unlock after failed search and removal
       if ((target_block = grow_heap(block_size)) == NULL){ // check grow_heap function
 	return NULL;
       }
@@ -512,6 +1359,7 @@ void * ts_malloc_lock(size_t size){
     }
     original_break = target_block; 
   }
+  PROFILE_MALLOC(target_block, size);
   return (char*)target_block + META_DATA_SIZE;
 }
 
@@ -521,16 +1369,36 @@ void ts_free_lock(void * ptr){
   if (ptr == NULL){ // freeing NULL does nothing 
     return;
   }
+  size_t owner = page_map_lookup(ptr); // rejects foreign pointers before their header is trusted
+  if (owner == 0){
+    page_map_reject(ptr, "ts_free_lock");
+    return;
+  }
   // get address of meta data (block_node):
   block_node * to_free = (block_node *)((char *)ptr - META_DATA_SIZE);  
+  PROFILE_FREE(to_free);
+  TAG_FREE(to_free);
+  if (owner > 1){ // large block of owner bytes, not on the free list
+    munmap_block(to_free, owner);
+    return;
+  }
   
-  pthread_mutex_lock(&(list_lock)); // lock list for insertion and coalesce attempt
+  acquire_list_lock(); // lock list for insertion and coalesce attempt
 
   //num_frees++; // collect for performance analysis 
-  add_to_free_list(to_free);
-  coalesce(to_free);
+  if (deferred_coalescing && (to_free->size <= QUICK_MAX_BLOCK)){ // defer the merge
+    to_free->next = quick_bins[to_free->size / ALIGNMENT];
+    quick_bins[to_free->size / ALIGNMENT] = to_free;
+    if (++quick_count >= QUICK_THRESHOLD){
+      consolidate();
+    }
+  }
+  else{
+    add_to_free_list(to_free);
+    coalesce(to_free);
+  }
  
-  pthread_mutex_unlock(&(list_lock)); // unlock after insertion and attempted coalesce 
+  ts_lock_release(&list_lock); // unlock after insertion and attempted coalesce 
 }
 
 
@@ -575,14 +1443,43 @@ char is_valid_address(block_node * to_check){
 
 /* Thread-safe malloc no-lock version. */
 void * ts_malloc_nolock(size_t size){
-  size_t block_size = size + META_DATA_SIZE;
+  if (size > SIZE_MAX - 2 * META_DATA_SIZE){
+    return NULL;
+  }
+  size_t block_size = ALIGN(size) + META_DATA_SIZE;
+  if (block_size < MIN_BLOCK_SIZE){
+    block_size = MIN_BLOCK_SIZE;
+  }
+  if (block_size >= MMAP_THRESHOLD){
+    block_node * target_block = mmap_block(block_size);
+    if (target_block == NULL){
+      return NULL;
+    }
+    PROFILE_MALLOC(target_block, size);
+    return (char*)target_block + META_DATA_SIZE;
+  }
 
   //num_mallocs++;
   //sum_malloc_requests += block_size; // collect data for performance analysis
+  note_request(block_size);
 
   block_node * target_block = NULL;
   if (original_break){ // if blocks have been allocated
-    target_block = thread_try_block_reuse_bf(block_size);
+    if (thread_quick_count && !deferred_coalescing){ // deferred coalescing was turned off
+      thread_consolidate();
+    }
+    if (deferred_coalescing && (block_size <= QUICK_MAX_BLOCK) && thread_quick_bins[block_size / ALIGNMENT]){
+      target_block = thread_quick_bins[block_size / ALIGNMENT];
+      thread_quick_bins[block_size / ALIGNMENT] = target_block->next;
+      thread_quick_count--;
+      PROFILE_MALLOC(target_block, size);
+      return (char*)target_block + META_DATA_SIZE;
+    }
+    target_block = thread_try_block_reuse(block_size);
+    if ((target_block == NULL) && thread_quick_count && (block_size > QUICK_MAX_BLOCK)){
+      thread_consolidate();
+      target_block = thread_try_block_reuse(block_size);
+    }
     if (target_block){ // if block found for re-use 
       thread_remove_from_free_list(target_block); 
     }
@@ -598,6 +1495,7 @@ void * ts_malloc_nolock(size_t size){
     }
     original_break = target_block;
   }
+  PROFILE_MALLOC(target_block, size);
   return (char*)target_block + META_DATA_SIZE;
 }
 
@@ -608,12 +1506,188 @@ void ts_free_nolock(void * ptr){
   if (ptr == NULL){ // freeing NULL does nothing 
     return;
   }
+  size_t owner = page_map_lookup(ptr);
+  if (owner == 0){
+    page_map_reject(ptr, "ts_free_nolock");
+    return;
+  }
   block_node * to_free = (block_node *)((char *)ptr - META_DATA_SIZE);  
+  PROFILE_FREE(to_free);
+  TAG_FREE(to_free);
+  if (owner > 1){
+    munmap_block(to_free, owner);
+    return;
+  }
+  if (deferred_coalescing && (to_free->size <= QUICK_MAX_BLOCK)){
+    to_free->next = thread_quick_bins[to_free->size / ALIGNMENT];
+    thread_quick_bins[to_free->size / ALIGNMENT] = to_free;
+    if (++thread_quick_count >= QUICK_THRESHOLD){
+      thread_consolidate();
+    }
+    return;
+  }
   thread_add_to_free_list(to_free);
   thread_coalesce(to_free);
 }
 
 
+/* Thread-safe sized free lock version.
+ * The caller supplies the size it requested from malloc, which is enough to
+ * pick a size class without loading the block_node header. Blocks on the
+ * address-ordered free list keep their links in the header, so until a
+ * size-classed cache sits in front of it this goes through the normal path. */
+void ts_free_sized_lock(void * ptr, size_t size){
+  (void) size; // not needed by the address-ordered list
+  ts_free_lock(ptr);
+}
+
+
+/* Thread-safe sized free no-lock version (thread local storage). */
+void ts_free_sized_nolock(void * ptr, size_t size){
+  (void) size;
+  ts_free_nolock(ptr);
+}
+
+
+/* Shared realloc logic. Large blocks are resized in place or moved by 
+ * mremap, so growing them costs no copy; a heap block that already holds
+ * the new size is kept, anything else is moved to a new block with
+ * do_malloc and the old one released with do_free. */
+static void * realloc_block(void * ptr, size_t size, void * (*do_malloc)(size_t), void (*do_free)(void *)){
+  if (ptr == NULL){
+    return do_malloc(size);
+  }
+  if (size == 0){
+    do_free(ptr);
+    return NULL;
+  }
+  if (size > SIZE_MAX - 2 * META_DATA_SIZE){
+    return NULL;
+  }
+  size_t owner = page_map_lookup(ptr);
+  if (owner == 0){
+    page_map_reject(ptr, "ts_realloc");
+    return NULL;
+  }
+  block_node * block = (block_node *)((char *)ptr - META_DATA_SIZE);
+  size_t block_size = ALIGN(size) + META_DATA_SIZE;
+  unsigned tag = BLOCK_TAG(block); // carried over to the resized block
+  if (owner > 1){ // large block
+    if (block_size >= MMAP_THRESHOLD){ // stays large: remap
+      PROFILE_FREE(block); // the sample would be left at the old address
+      TAG_FREE(block);     // counted again at the new size
+      block_node * moved = mremap_block(block, block_size);
+      if (tag){
+	tag_block(moved ? moved : block, tag);
+      }
+      return moved ? (char *)moved + META_DATA_SIZE : NULL;
+    }
+  }
+  else if (block_size <= BLOCK_SIZE(block)){
+    return ptr; // already big enough
+  }
+  void * new_ptr = do_malloc(size);
+  if (new_ptr == NULL){
+    return NULL; // the old block is left untouched
+  }
+  size_t old_payload = BLOCK_SIZE(block) - META_DATA_SIZE;
+  memcpy(new_ptr, ptr, (old_payload < size) ? old_payload : size);
+  do_free(ptr);
+  if (tag){
+    tag_block((block_node *)((char *)new_ptr - META_DATA_SIZE), tag);
+  }
+  return new_ptr;
+}
+
+
+/* Thread-safe realloc lock version. */
+void * ts_realloc_lock(void * ptr, size_t size){
+  return realloc_block(ptr, size, ts_malloc_lock, ts_free_lock);
+}
+
+
+/* Thread-safe realloc no-lock version (thread local storage). */
+void * ts_realloc_nolock(void * ptr, size_t size){
+  return realloc_block(ptr, size, ts_malloc_nolock, ts_free_nolock);
+}
+
+
+/* Zeroes n bytes of a recycled payload. For large payloads the whole pages
+ * are dropped with MADV_DONTNEED, so the kernel maps zero pages on the next
+ * touch, and only the partial pages at either end are cleared by memset. */
+static void zero_recycled(char * ptr, size_t n){
+  if (n >= CALLOC_MADVISE_MIN){
+    size_t page = sysconf(_SC_PAGESIZE);
+    char * first = (char *)(((uintptr_t) ptr + page - 1) & ~(page - 1));
+    char * last = (char *)(((uintptr_t) ptr + n) & ~(page - 1));
+    if ((first < last) && (madvise(first, last - first, MADV_DONTNEED) == 0)){
+      memset(ptr, 0, first - ptr);
+      memset(last, 0, ptr + n - last);
+      return;
+    }
+  }
+  memset(ptr, 0, n);
+}
+
+
+/* Thread-safe calloc lock version. Memory that grow_heap just took from 
+ * the OS is already zero, so only recycled blocks are cleared. */
+void * ts_calloc_lock(size_t nmemb, size_t size){
+  if (size && (nmemb > SIZE_MAX / size)){ // nmemb * size overflows
+    return NULL;
+  }
+  fresh_from_os = 0;
+  char * ptr = ts_malloc_lock(nmemb * size);
+  if (ptr && !fresh_from_os){
+    zero_recycled(ptr, nmemb * size);
+  }
+  return ptr;
+}
+
+
+/* Thread-safe calloc no-lock version (thread local storage). */
+void * ts_calloc_nolock(size_t nmemb, size_t size){
+  if (size && (nmemb > SIZE_MAX / size)){
+    return NULL;
+  }
+  fresh_from_os = 0;
+  char * ptr = ts_malloc_nolock(nmemb * size);
+  if (ptr && !fresh_from_os){
+    zero_recycled(ptr, nmemb * size);
+  }
+  return ptr;
+}
+
+
+/* Fills in allocator statistics. Request and fragmentation totals include
+ * other threads' counts as of their last fold (every ADAPT_INTERVAL requests). */
+void ts_get_stats(ts_stats * stats){
+  fold_request_counts();
+  pthread_mutex_lock(&adapt_lock);
+  stats->split_adaptive = split_adaptive;
+  stats->split_threshold = split_threshold[0] ? split_threshold[0] : MIN_SIZE;
+  stats->requested_bytes = requested_bytes;
+  stats->slack_bytes = slack_bytes;
+  pthread_mutex_unlock(&adapt_lock);
+  ts_lock_acquire(&list_lock);
+  stats->purged_bytes = purged_bytes;
+  ts_lock_release(&list_lock);
+  stats->internal_fragmentation = 0;
+  if (stats->requested_bytes){
+    stats->internal_fragmentation = (double) stats->slack_bytes / 
+      (double)(stats->requested_bytes + stats->slack_bytes);
+  }
+  stats->heap_bytes = data_segment_size;
+  stats->mmapped_bytes = __atomic_load_n(&mmapped_bytes, __ATOMIC_RELAXED);
+  stats->adaptive_to_private = __atomic_load_n(&adaptive_to_private, __ATOMIC_RELAXED);
+  stats->adaptive_to_locked = __atomic_load_n(&adaptive_to_locked, __ATOMIC_RELAXED);
+  stats->adaptive_private_threads = __atomic_load_n(&adaptive_private_threads, __ATOMIC_RELAXED);
+  ts_lock_acquire(&list_lock);
+  stats->free_bytes = get_data_segment_free_space_size();
+  ts_lock_release(&list_lock);
+}
+
+
 unsigned long get_data_segment_size(){
   return data_segment_size;
 }
@@ -626,6 +1700,12 @@ unsigned long get_data_segment_free_space_size(){
     free_space += current->size;
     current = current->next;
   }
+  unsigned i;
+  for (i = 0; i < NUM_QUICK_BINS; i++){ // blocks waiting to be coalesced
+    for (current = quick_bins[i]; current; current = current->next){
+      free_space += current->size;
+    }
+  }
   return free_space;
 }
 
@@ -637,6 +1717,12 @@ unsigned long thread_get_data_segment_free_space_size(){
     free_space += current->size;
     current = current->next;
   }
+  unsigned i;
+  for (i = 0; i < NUM_QUICK_BINS; i++){
+    for (current = thread_quick_bins[i]; current; current = current->next){
+      free_space += current->size;
+    }
+  }
   return free_space;
 }
 
@@ -1,5 +1,15 @@
+#ifndef MY_MALLOC_H
+#define MY_MALLOC_H
+
 #include <stdlib.h>
+#include <stdint.h>
 #include <pthread.h>
+#include "ts_lock.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 // Meta data for alloaced blocks
 
 typedef struct block_node_t{
@@ -11,8 +21,230 @@ typedef struct block_node_t{
 } block_node;
 
 
+/* For alignment purposes */
+#define ALIGNMENT 8
+
+/* Macro for finding the nearest multiple of 8 for alignment */
+#define ALIGN(x) (((x) + (ALIGNMENT - 1)) & ~(ALIGNMENT-1))
+
+/* Size of meta data struct (offset to payload in memory, 24 bytes) */
+#define META_DATA_SIZE sizeof(block_node) 
+
+/* Flag in the size of an allocated block: the block is a mapping of its own
+ * (large requests), never on a free list */
+#define BLOCK_MMAPPED 1UL
+
+/* Flag in the size of an allocated block: the heap profiler holds a sample 
+ * of it (see heap_profile.c) */
+#define BLOCK_SAMPLED 2UL
+
+/* Top byte of the size of an allocated block: its accounting tag (see 
+ * tag.c), 0 for untagged blocks. Cleared when the block is free'd. */
+#define BLOCK_TAG_SHIFT 56
+#define BLOCK_TAG_MASK (~(size_t)0 << BLOCK_TAG_SHIFT)
+#define BLOCK_TAG(b) ((unsigned)((b)->size >> BLOCK_TAG_SHIFT))
+
+/* Size of a block without its flag and tag bits */
+#define BLOCK_SIZE(b) ((b)->size & ~(size_t)(ALIGNMENT - 1) & ~BLOCK_TAG_MASK)
+
+
+// Size-segregated free list bin. Block sizes are packed into a dense array 
+// so best fit can be found with vector compare-and-min instead of by 
+// chasing pointers, with the blocks themselves in a parallel array.
+
+typedef struct bin_array_t{
+
+  uint32_t * sizes;      // block sizes, clamped to UINT32_MAX
+  block_node ** blocks;
+  size_t count;
+  size_t capacity;
+
+} bin_array;
+
+/* Index of a free block in its bin's arrays, kept in the first word of its payload */
+#define BIN_POS(b) (*(size_t *)((char *)(b) + META_DATA_SIZE))
+
+/* Purge tick at which a free block on the locking list was last changed, 
+ * kept in the second word of its payload (see purge.c) */
+#define BIN_STAMP(b) (*(unsigned long *)((char *)(b) + META_DATA_SIZE + sizeof(size_t)))
+
+/* Flag in BIN_STAMP: the block's pages have been purged since */
+#define PURGE_CLEAN (1UL << 63)
+
+/* Smallest block: a 16 byte payload holds a free block's bookkeeping */
+#define MIN_BLOCK_SIZE (META_DATA_SIZE + 16)
+
+/* Blocks on the quick lists (deferred coalescing) that trigger a consolidation */
+#define QUICK_THRESHOLD 1024
+
+/* Number of free list bins, one bit each in the non-empty bin bitmap */
+#define NUM_BINS 64
+
+
+/* Small size classes: payloads of 16 to 512 bytes in 16 byte steps */
+#define SIZE_CLASS_GRANULE 16
+#define NUM_SIZE_CLASSES 32
+#define SMALL_SIZE_MAX (SIZE_CLASS_GRANULE * NUM_SIZE_CLASSES)
+
+/* Size class serving a request of size bytes (size <= SMALL_SIZE_MAX) */
+#define SIZE_CLASS(size) ((size) ? ((size) - 1) / SIZE_CLASS_GRANULE : 0)
+
+/* Payload size of a size class */
+#define CLASS_SIZE(c) (((c) + 1) * SIZE_CLASS_GRANULE)
+
+
+// Range of memory handed out by grow_heap (sbrk growth or a THP chunk)
+
+typedef struct heap_chunk_t{
+
+  char * base;
+  size_t size;          // bytes reserved
+  size_t used;          // bytes handed out so far
+  int mmapped;          // 1 for a THP chunk, 0 for sbrk growth
+  int thp_advised;      // madvise(MADV_HUGEPAGE) succeeded
+  size_t thp_bytes;     // bytes backed by huge pages (filled by ts_get_chunk_stats)
+  void * span;          // page map record of the chunk (see page_map.c)
+
+} heap_chunk;
+
+
+// States of a block visited by the heap walker
+
+typedef enum block_state_t{
+
+  BLOCK_ALLOCATED,
+  BLOCK_FREE,     // on the locking free list
+  BLOCK_CACHED    // free'd onto a quick list, not yet coalesced
+
+} block_state;
+
+/* Called by ts_heap_walk for each block; returning non-zero stops the walk */
+typedef int (*ts_heap_visitor)(const heap_chunk * chunk, block_node * block, size_t size,
+			       block_state state, void * arg);
+
+
+// Allocator statistics (see ts_get_stats)
+
+typedef struct ts_stats_t{
+
+  unsigned long heap_bytes;          // bytes obtained through grow_heap
+  unsigned long mmapped_bytes;       // bytes mapped for large blocks
+  unsigned long free_bytes;          // bytes on the locking free list
+  unsigned long split_threshold;     // leftover needed to split, for the smallest requests
+  int split_adaptive;                // thresholds follow the request histogram
+  unsigned long long requested_bytes;  // block bytes requested by malloc
+  unsigned long long slack_bytes;      // bytes left in blocks that were not split
+  double internal_fragmentation;     // slack_bytes / (requested_bytes + slack_bytes)
+  unsigned long long purged_bytes;   // free bytes returned to the OS by the purge thread
+  unsigned long adaptive_to_private; // ts_malloc/ts_free threads moved to their private cache
+  unsigned long adaptive_to_locked;  // and back to the locking heap
+  unsigned long adaptive_private_threads; // threads in private mode now
+
+} ts_stats;
+
+
+// Accounting tags (see ts_malloc_tagged): tag 0 is untagged
+
+#define TS_NUM_TAGS 256
+
+// Usage of one tag, summed over every thread (see ts_get_tag_stats)
+
+typedef struct ts_tag_stats_t{
+
+  long long bytes;          // usable bytes of the tag's live blocks
+  long long blocks;         // live blocks
+  size_t limit;             // soft limit, 0 if none
+  unsigned long limit_hits; // times the limit callback ran
+
+} ts_tag_stats;
+
+/* Called by the thread whose allocation took tag over its soft limit, with
+ * the tag's bytes at the time; no allocator lock is held */
+typedef void (*ts_tag_limit_callback)(unsigned tag, size_t bytes, size_t limit, void * arg);
+
+
+// Thread cache of small blocks behind the inline fast path (see ts_fast.h
+// and thread_cache.c): a stack of blocks per size class, linked through the
+// first word of their payloads
+
+typedef struct ts_thread_cache_t{
+
+  void * bins[NUM_SIZE_CLASSES];
+  unsigned counts[NUM_SIZE_CLASSES];
+  unsigned limit;    // blocks kept per class, 0 until the thread's first miss
+
+} ts_thread_cache;
+
+
+// Engines of the adaptive ts_malloc/ts_free
+
+typedef enum ts_malloc_mode_t{
+
+  TS_MODE_LOCKED,   // the locking heap
+  TS_MODE_PRIVATE   // the thread's private cache, while list_lock is contended
+
+} ts_malloc_mode;
+
 
-// All malloc functions implemented with best-fit policy 
+// Region (arena) chunk header, stored at the start of each chunk's payload
+
+typedef struct region_chunk_t{
+
+  struct region_chunk_t * next;
+  char * cur; // bump pointer
+  char * end; 
+
+} region_chunk;
+
+
+// Region handle, stored in the region's first chunk
+
+typedef struct ts_region_t{
+
+  region_chunk * chunks; // most recently added chunk first
+
+} ts_region;
+
+
+
+// Header at the start of a shared heap mapping (see shm_heap.c). Blocks in
+// the heap are linked by offsets from the header, since each process may
+// map it at a different address.
+
+typedef struct ts_shm_heap_t{
+
+  uint64_t magic;          // set once the header is initialized
+  uint64_t size;           // bytes in the mapping, header included
+  uint64_t bins[NUM_BINS]; // offsets of the first free block in each bin, 0 if empty
+  unsigned long bin_map;   // bit i set if bins[i] is non-empty
+  uint64_t free_bytes;     // bytes on the free list
+  uint64_t recoveries;     // times the free lists were rebuilt after a process died holding lock
+  uint64_t root;           // offset of the root object of a persistent heap, 0 if none
+  pthread_mutex_t lock;    // process-shared, robust
+
+} ts_shm_heap;
+
+
+
+// Placement policies for re-using free'd blocks
+
+typedef enum placement_policy_t{
+
+  POLICY_BEST_FIT,   // smallest block that fits
+  POLICY_FIRST_FIT,  // lowest addressed block that fits
+  POLICY_NEXT_FIT,   // first fit resuming from where the last search stopped
+  POLICY_GOOD_FIT    // best of the first K fits, or the first within X% of the request
+
+} placement_policy;
+
+/* Policy used until ts_set_placement_policy is called (set with POLICY= in the Makefile) */
+#ifndef DEFAULT_POLICY
+#define DEFAULT_POLICY POLICY_BEST_FIT
+#endif
+
+
+
+// All malloc functions use the selected placement policy (best fit by default)
 
 // Locking malloc/free
 
@@ -30,6 +262,209 @@ void ts_free_nolock(void * ptr);
 
 
 
+// Selects the placement policy. For POLICY_GOOD_FIT the search stops after 
+// max_candidates fitting blocks, or at the first block that wastes at most
+// tolerance_pct percent of the request (both are ignored by other policies)
+
+void ts_set_placement_policy(placement_policy policy, unsigned max_candidates, unsigned tolerance_pct);
+
+
+
+// Split threshold: leftover (in bytes, including its block_node) a free'd 
+// block must have to be split when re-used. It adapts per request size to the
+// observed request histogram; a non-zero value fixes it, 0 makes it adaptive again
+
+void ts_set_split_threshold(size_t bytes);
+
+
+
+// Deferred coalescing: when enabled, small blocks are free'd onto per-size 
+// quick lists and merged into the free list in batches
+
+void ts_set_deferred_coalescing(int enable);
+
+
+
+// Zeroed allocation of nmemb * size bytes (NULL if the product overflows)
+
+void * ts_calloc_lock(size_t nmemb, size_t size);
+
+void * ts_calloc_nolock(size_t nmemb, size_t size);
+
+
+
+// Resizes a block, keeping its contents up to the smaller of the two sizes.
+// Large blocks (own mappings) are grown with mremap, without copying.
+
+void * ts_realloc_lock(void * ptr, size_t size);
+
+void * ts_realloc_nolock(void * ptr, size_t size);
+
+
+
+// Sized free: size must be the size that was passed to malloc for ptr
+
+void ts_free_sized_lock(void * ptr, size_t size);
+
+void ts_free_sized_nolock(void * ptr, size_t size);
+
+
+
+// Per-CPU cached malloc/free for small sizes, backed by the locking heap.
+// Falls back to the thread local storage lists when the current CPU cannot
+// be determined (no rseq registration and no sched_getcpu support).
+
+void * ts_malloc_percpu(size_t size);
+
+void ts_free_percpu(void * ptr);
+
+void ts_free_sized_percpu(void * ptr, size_t size);
+
+// Returns every block held by the per-CPU caches to the free list
+void ts_percpu_flush();
+
+
+
+// Thread cached malloc/free for small sizes, backed by the locking heap.
+// These are the out-of-line paths of the inline ts_malloc_fast family in 
+// ts_fast.h; blocks cached by a thread go back to the free list when it
+// exits. A sized free must pass the size given to ts_malloc_cached/_fast.
+
+void * ts_malloc_cached(size_t size);
+
+void ts_free_cached(void * ptr);
+
+void ts_free_sized_cached(void * ptr, size_t size);
+
+// Miss path of ts_malloc_fast for a size class resolved at compile time
+void * ts_malloc_class(unsigned cls);
+
+// Returns every block held by the calling thread's cache to the free list
+void ts_thread_cache_flush();
+
+// The calling thread's cache, read and written inline by ts_fast.h
+extern __thread ts_thread_cache ts_tcache;
+
+
+
+// Adaptive malloc/free: each thread samples contention on list_lock and 
+// moves to a private cache of small blocks while it is high, and back to 
+// the locking heap when it drops (see adaptive.c). Blocks can be free'd by
+// any thread in either mode. The switches are counted in ts_get_stats.
+
+void * ts_malloc(size_t size);
+
+void ts_free(void * ptr);
+
+// Engine the calling thread currently uses
+ts_malloc_mode ts_get_malloc_mode();
+
+
+
+// Tagged allocation: ts_malloc_tagged allocates from the locking heap and
+// stores tag (1 to TS_NUM_TAGS - 1) in the block's header, so every free
+// function and realloc credits the block back to its tag. Each thread 
+// counts its own tagged bytes without atomics; ts_get_tag_stats sums the
+// threads. A soft limit calls back once when a tag's bytes reach it, and
+// again only after they have dropped below it (see tag.c).
+
+void * ts_malloc_tagged(size_t size, unsigned tag);
+
+// Fills in the usage of tag, returns -1 for a tag out of range
+int ts_get_tag_stats(unsigned tag, ts_tag_stats * stats);
+
+// Sets tag's soft limit in bytes with its callback (0 removes the limit)
+int ts_tag_set_limit(unsigned tag, size_t bytes, ts_tag_limit_callback callback, void * arg);
+
+
+
+// Region (arena) allocation: bump allocation out of heap chunks, 
+// every object in a region is released at once by ts_region_destroy.
+// A region must only be used by one thread at a time.
+
+ts_region * ts_region_create();
+
+void * ts_region_alloc(ts_region * region, size_t size);
+
+void ts_region_destroy(ts_region * region);
+
+
+
+// Background purging: a thread returns the pages of free blocks that have 
+// been idle on the locking free list to the OS, on a decay curve with a 
+// period of ms milliseconds (0 stops it). Also enabled by TS_MALLOC_DECAY_MS
+// and TS_MALLOC_PURGE=free|dontneed in the environment. Returns -1 if the
+// thread could not be started.
+
+int ts_set_purge_decay(unsigned long ms, int use_madv_free);
+
+// Purges every free block on the locking free list right away
+void ts_purge_now();
+
+
+
+// Shared-memory heap: a heap in a MAP_SHARED mapping that every process 
+// mapping it can allocate from and free into, so objects are passed between
+// processes without copying. Objects are referred to across processes by
+// their offsets (ts_shm_offset/ts_shm_ptr). A NULL name creates an anonymous
+// memfd heap, shared with children by fork. The heap does not grow.
+
+ts_shm_heap * ts_shm_create(const char * name, size_t size);
+
+ts_shm_heap * ts_shm_attach(const char * name);
+
+ts_shm_heap * ts_shm_attach_fd(int fd);
+
+void ts_shm_detach(ts_shm_heap * heap);
+
+void * ts_shm_malloc(ts_shm_heap * heap, size_t size);
+
+void ts_shm_free(ts_shm_heap * heap, void * ptr);
+
+uint64_t ts_shm_offset(ts_shm_heap * heap, void * ptr);
+
+void * ts_shm_ptr(ts_shm_heap * heap, uint64_t offset);
+
+// Bytes free in a shared heap
+size_t ts_shm_free_space(ts_shm_heap * heap);
+
+
+
+// Persistent heap: a shared heap in a file (see persist_heap.c). Opening 
+// the file again after a restart finds every block allocated before still 
+// valid, and the root object (set with ts_heap_set_root) leads to the rest.
+// Objects must link to each other by offset (ts_shm_offset/ts_shm_ptr), as
+// the file may be mapped at another address. size is only used to create 
+// the file. Allocate and free with ts_shm_malloc/ts_shm_free.
+
+ts_shm_heap * ts_heap_open(const char * path, size_t size);
+
+// Writes the heap back to its file and unmaps it
+void ts_heap_close(ts_shm_heap * heap);
+
+// Writes the heap back to its file (msync)
+int ts_heap_sync(ts_shm_heap * heap);
+
+void ts_heap_set_root(ts_shm_heap * heap, void * root);
+
+void * ts_heap_get_root(ts_shm_heap * heap);
+
+
+
+// Sampling heap profiler: samples about one allocation per bytes allocated
+// (0 turns it off) with its call stack, and keeps the samples of live blocks.
+// Also enabled by TS_MALLOC_PROFILE_RATE in the environment, and
+// TS_MALLOC_PROFILE_SIGNAL=<signal number> dumps a profile to
+// TS_MALLOC_PROFILE_OUT.<pid>.<n> when the signal arrives.
+
+void ts_profile_set_rate(size_t bytes);
+
+// Writes prefix.heap (pprof), prefix.folded (live samples as folded stacks)
+// and prefix.growth.folded (grow_heap call sites). Returns -1 on failure.
+int ts_profile_dump(const char * prefix);
+
+
+
 // Performance (fragmentation) functions 
 
 unsigned long get_data_segment_size();
@@ -38,6 +473,80 @@ unsigned long get_data_segment_free_space_size();
 
 unsigned long thread_get_data_segment_free_space_size();
 
+// Fills in allocator statistics
+void ts_get_stats(ts_stats * stats);
+
+// Copies up to max heap chunk records (with huge page usage) into out, 
+// returns the total number of chunks
+int ts_get_chunk_stats(heap_chunk * out, int max);
+
+// Ownership: whether ptr was handed out by this allocator (and not free'd,
+// for large blocks), found from the page map without reading the object.
+// Every ts_free_* and ts_realloc_* rejects foreign pointers with an error
+// instead of trusting a block_node that is not there; the inline
+// ts_free_sized_fast path does not check.
+int ts_owns(const void * ptr);
+
+// Usable bytes of the block holding ptr (at least the size requested), 0 
+// for a foreign pointer. Large blocks are sized from the page map alone.
+size_t ts_malloc_usable_size(void * ptr);
+
+// Heap walker: visits every block of every heap chunk in address order, 
+// with list_lock and sbrk_mutex held (the visitor must not allocate from
+// this library). Free blocks of the non-locking lists and blocks held by 
+// the per-CPU and thread caches are seen as allocated, and large blocks with mappings
+// of their own are not visited. Returns -1 if a corrupt block was found.
+int ts_heap_walk(ts_heap_visitor visit, void * arg);
+
+// Writes a CSV heap map to path: per chunk totals and largest free block, 
+// occupancy per 64 KiB slice, and histograms of allocated block, free block
+// and free run sizes. thread_tests/heap_map_view renders it.
+int ts_heap_map_export(const char * path);
+
+
+
+// Transparent huge pages: when enabled (or TS_MALLOC_THP=1 is set in the 
+// environment) the heap grows in 2 MiB aligned chunks advised with MADV_HUGEPAGE
+
+void ts_set_thp_chunks(int enable);
+
+
+// Shared state of the locking free list (defined in my_malloc.c)
+
+extern ts_lock_t list_lock;
+
+extern ts_lock_t sbrk_mutex;
+
+extern unsigned long data_segment_size;
+
+extern bin_array bins[NUM_BINS];
+
+extern block_node * free_list_head;
+
+extern heap_chunk * heap_chunks;
+
+extern unsigned long num_heap_chunks;
+
+extern unsigned long bin_map;
+
+extern unsigned long purge_epoch;
+
+extern unsigned long long purged_bytes;
+
+extern size_t profile_rate;
+
+extern unsigned long profile_live;
+
+extern unsigned long adaptive_to_private;
+
+extern unsigned long adaptive_to_locked;
+
+extern unsigned long adaptive_private_threads;
+
+extern __thread unsigned long long list_lock_wait_ns;
+
+extern unsigned long tags_used;
+
 
 // Helper functions:
 
@@ -50,6 +559,14 @@ void attempt_split(block_node * to_split, size_t size_needed);
 // Tries to re-use free'd blocks instead of growing heap
 block_node * try_block_reuse_bf(size_t size);
 
+// Re-use with the other placement policies
+block_node * try_block_reuse_ff(size_t size);
+block_node * try_block_reuse_nf(size_t size);
+block_node * try_block_reuse_gf(size_t size);
+
+// Re-use with the selected placement policy
+block_node * try_block_reuse(size_t size);
+
 // Removes a previously allocated block from the free list (it has been re-used)
 void remove_from_free_list(block_node * to_remove);
 
@@ -59,6 +576,88 @@ block_node * grow_heap(size_t size);
 // Coalesces free'd blocks if they exist around free_block
 void coalesce(block_node * free_block);
 
+// Merges every block on the quick lists into the free list
+void consolidate();
+
+// Copies up to max blocks waiting on the quick lists into out
+unsigned long get_quick_blocks(block_node ** out, unsigned long max);
+
+// Records sbrk growth in the heap chunk registry (sbrk_mutex held)
+void record_sbrk_growth(void * base, size_t size);
+
+// Carves a block out of the current THP chunk (sbrk_mutex held)
+block_node * thp_chunk_alloc(size_t size);
+
+// Whether the heap grows in THP chunks (sbrk_mutex held)
+int thp_chunks_enabled();
+
+// Starts the purge thread if the environment asks for it (first call only)
+void purge_init();
+
+// Sets up the heap profiler from the environment (first call only)
+void profile_init();
+
+// Counts an allocation against the sampling interval, sampling it when due
+void profile_malloc(block_node * block, size_t size);
+
+// Drops the sample of a block being free'd
+void profile_free(block_node * block);
+
+// Records a grow_heap call site
+void profile_growth(size_t size);
+
+/* Profiler hooks: one load and branch while profiling is off */
+#define PROFILE_MALLOC(block, size) do{ if (__builtin_expect(profile_rate != 0, 0)) profile_malloc(block, size); }while(0)
+#define PROFILE_FREE(block) do{ if (__builtin_expect((block)->size & BLOCK_SAMPLED, 0)) profile_free(block); }while(0)
+#define PROFILE_GROWTH(size) do{ if (__builtin_expect(profile_rate != 0, 0)) profile_growth(size); }while(0)
+
+// Tags a block just allocated and counts it for the calling thread
+void tag_block(block_node * block, unsigned tag);
+
+// Credits a tagged block being free'd back to its tag and clears the tag
+void tag_free(block_node * block);
+
+/* Tag hook of the free paths: one branch on the header for untagged blocks */
+#define TAG_FREE(block) do{ if (__builtin_expect(((block)->size & BLOCK_TAG_MASK) != 0, 0)) tag_free(block); }while(0)
+
+// Maps a shared heap from fd, initializing it (size bytes) when create is set
+ts_shm_heap * shm_heap_map(int fd, size_t size, int create);
+
+// Re-initializes a shared heap's mutex and rebuilds its free list, for a 
+// heap no process has mapped (e.g. a persistent heap after a crash)
+int shm_heap_reset(ts_shm_heap * heap);
+
+
+// Page map (see page_map.c): records a new range of heap memory and 
+// returns its record, or grows a record by contiguous memory (sbrk_mutex held)
+void * page_map_add_span(char * base, size_t size);
+void page_map_extend_span(void * span, size_t size);
+
+// Enters or removes a large block's own mapping in the page map
+int page_map_add_mapping(block_node * block, size_t length);
+void page_map_remove_mapping(block_node * block);
+
+// Mapping length of ptr's block if it is a large block, 1 if ptr is in the
+// heap, 0 if it is not this allocator's
+size_t page_map_lookup(const void * ptr);
+
+// Reports a foreign pointer passed to function
+void page_map_reject(const void * ptr, const char * function);
+
+
+// Bin that holds free blocks of the given block size
+unsigned bin_index(size_t size);
+
+// Index of the smallest of n packed sizes that is at least request (n if none)
+size_t bin_min_fit(const uint32_t * sizes, size_t n, uint32_t request);
+
+// The individual kernels behind bin_min_fit
+size_t bin_min_fit_scalar(const uint32_t * sizes, size_t n, uint32_t request);
+#if defined(__x86_64__) || defined(__i386__)
+size_t bin_min_fit_sse2(const uint32_t * sizes, size_t n, uint32_t request);
+size_t bin_min_fit_avx2(const uint32_t * sizes, size_t n, uint32_t request);
+#endif
+
 
 // Adds to list of free blocks 
 void thread_add_to_free_list(block_node * to_add);
@@ -69,9 +668,25 @@ void thread_attempt_split(block_node * to_split, size_t size_needed);
 // Tries to re-use free'd blocks instead of growing heap
 block_node * thread_try_block_reuse_bf(size_t size);
 
+// Re-use with the other placement policies
+block_node * thread_try_block_reuse_ff(size_t size);
+block_node * thread_try_block_reuse_nf(size_t size);
+block_node * thread_try_block_reuse_gf(size_t size);
+
+// Re-use with the selected placement policy
+block_node * thread_try_block_reuse(size_t size);
+
 // Removes a previously allocated block from the free list (it has been re-used)
 void thread_remove_from_free_list(block_node * to_remove);
 
 // Coalesces free'd blocks if they exist around free_block
 void thread_coalesce(block_node * free_block);
 
+// Merges every block on the quick lists into the free list
+void thread_consolidate();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,272 @@
+#include "my_malloc.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* Page map: a three level radix tree from page number to the memory that
+ * owns the page, so the allocator can tell its own pointers from foreign
+ * ones without touching the object.
+ *
+ * The 48 bit address space is cut into 4 KiB pages and the 36 bit page
+ * number into three 12 bit indexes: a static root, then mid and leaf nodes
+ * mapped on first use and never freed. A lookup is three dependent loads
+ * (four for heap pages, which go on to their span record). Nodes are
+ * installed with a compare-and-swap, so readers never take a lock.
+ *
+ * A leaf entry holds one of:
+ *
+ *   0                  not this allocator's page
+ *   span | PM_SPAN     heap memory (sbrk growth or a THP chunk), span holds
+ *                      its bounds; the end only ever grows
+ *   length | PM_MMAP   first page of a large block with a mapping of its
+ *                      own, length bytes long. Only the first page is
+ *                      entered, since the block's pointer is always in it.
+ *   PM_SHARED          a page shared by two spans (sbrk growth that another
+ *                      brk user interleaved with), resolved by scanning the
+ *                      span records
+ *
+ * Heap span entries are written with sbrk_mutex held; large block entries
+ * by the thread mapping or unmapping the block, which owns those pages. */
+
+#define PM_PAGE_SHIFT 12
+#define PM_LEVEL_BITS 12
+#define PM_LEVEL_SIZE (1UL << PM_LEVEL_BITS)
+#define PM_ADDRESS_BITS (PM_PAGE_SHIFT + 3 * PM_LEVEL_BITS)
+
+/* Kind of a leaf entry, in its low bits */
+#define PM_SPAN   1UL
+#define PM_MMAP   2UL
+#define PM_SHARED 3UL
+#define PM_KIND(e) ((e) & 3UL)
+#define PM_VALUE(e) ((e) & ~3UL)
+
+/* Bounds of a range of heap memory */
+typedef struct pm_span_t{
+
+  char * base;
+  char * end;    // grows with contiguous sbrk growth
+
+} pm_span;
+
+/* Span records, allocated a page at a time and never freed */
+typedef struct span_pool_t{
+
+  struct span_pool_t * next;
+  unsigned long count;
+  pm_span spans[(4096 - 2 * sizeof(void *)) / sizeof(pm_span)];
+
+} span_pool;
+
+#define SPANS_PER_POOL (sizeof(((span_pool *) 0)->spans) / sizeof(pm_span))
+
+static void ** pm_root[PM_LEVEL_SIZE];
+
+static span_pool * span_pools = NULL;
+
+
+/* Maps a zeroed node of PM_LEVEL_SIZE words, NULL on failure */
+static void * pm_new_node(){
+  void * node = mmap(NULL, PM_LEVEL_SIZE * sizeof(void *), PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (node == MAP_FAILED){
+    fprintf(stderr, "Error: could not map a page map node\n");
+    return NULL;
+  }
+  return node;
+}
+
+
+/* Returns the child in slot, installing a new node if it is empty */
+static void * pm_child(void ** slot){
+  void * child = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+  if (child){
+    return child;
+  }
+  void * node = pm_new_node();
+  if (node == NULL){
+    return NULL;
+  }
+  if (__atomic_compare_exchange_n(slot, &child, node, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+    return node;
+  }
+  munmap(node, PM_LEVEL_SIZE * sizeof(void *)); // another thread installed one first
+  return child;
+}
+
+
+/* Returns the leaf entry of address's page, or NULL if the path to it
+ * cannot be created (create) or does not exist (!create) */
+static uintptr_t * pm_entry(uintptr_t address, int create){
+  if (address >> PM_ADDRESS_BITS){
+    return NULL;
+  }
+  uintptr_t page = address >> PM_PAGE_SHIFT;
+  unsigned long i1 = page >> (2 * PM_LEVEL_BITS);
+  unsigned long i2 = (page >> PM_LEVEL_BITS) & (PM_LEVEL_SIZE - 1);
+  unsigned long i3 = page & (PM_LEVEL_SIZE - 1);
+  void ** mid;
+  uintptr_t * leaf;
+  if (create){
+    if ((mid = pm_child((void **) &pm_root[i1])) == NULL){
+      return NULL;
+    }
+    if ((leaf = pm_child(&mid[i2])) == NULL){
+      return NULL;
+    }
+  }
+  else{
+    if ((mid = __atomic_load_n(&pm_root[i1], __ATOMIC_ACQUIRE)) == NULL){
+      return NULL;
+    }
+    if ((leaf = __atomic_load_n(&mid[i2], __ATOMIC_ACQUIRE)) == NULL){
+      return NULL;
+    }
+  }
+  return &leaf[i3];
+}
+
+
+/* Whether a span record covers the block_node of ptr */
+static inline int span_holds(const pm_span * span, uintptr_t ptr){
+  return ((uintptr_t) span->base + META_DATA_SIZE <= ptr) &&
+    (ptr < (uintptr_t) __atomic_load_n(&span->end, __ATOMIC_ACQUIRE));
+}
+
+
+/* Slow path for pages shared by two spans: checks every span record */
+static int span_scan(uintptr_t ptr){
+  span_pool * pool;
+  unsigned long i;
+  for (pool = __atomic_load_n(&span_pools, __ATOMIC_ACQUIRE); pool; pool = pool->next){
+    unsigned long count = __atomic_load_n(&pool->count, __ATOMIC_ACQUIRE);
+    for (i = 0; i < count; i++){
+      if (span_holds(&pool->spans[i], ptr)){
+	return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+
+/* Enters every page of [from, to) as part of span (sbrk_mutex held) */
+static void pm_mark_span(pm_span * span, char * from, char * to){
+  uintptr_t value = (uintptr_t) span | PM_SPAN;
+  uintptr_t page;
+  for (page = (uintptr_t) from >> PM_PAGE_SHIFT; page <= ((uintptr_t) to - 1) >> PM_PAGE_SHIFT; page++){
+    uintptr_t * entry = pm_entry(page << PM_PAGE_SHIFT, 1);
+    if (entry == NULL){
+      continue; // lookups of this page fail; its blocks are leaked rather than corrupted
+    }
+    uintptr_t old = __atomic_load_n(entry, __ATOMIC_RELAXED);
+    __atomic_store_n(entry, (old && (old != value)) ? PM_SHARED : value, __ATOMIC_RELEASE);
+  }
+}
+
+
+/* Records a new range of heap memory, returns its span record, or NULL if
+ * no record could be allocated (sbrk_mutex held). */
+void * page_map_add_span(char * base, size_t size){
+  span_pool * pool = span_pools;
+  if ((pool == NULL) || (pool->count == SPANS_PER_POOL)){
+    pool = mmap(NULL, sizeof(span_pool), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pool == MAP_FAILED){
+      fprintf(stderr, "Error: could not map page map span records\n");
+      return NULL;
+    }
+    pool->next = span_pools;
+    __atomic_store_n(&span_pools, pool, __ATOMIC_RELEASE);
+  }
+  pm_span * span = &pool->spans[pool->count];
+  span->base = base;
+  span->end = base;
+  __atomic_store_n(&pool->count, pool->count + 1, __ATOMIC_RELEASE);
+  page_map_extend_span(span, size);
+  return span;
+}
+
+
+/* Grows a span by size bytes of contiguous memory (sbrk_mutex held). The
+ * pages are entered before the end moves, so a lookup never finds the end
+ * past a page it cannot reach. */
+void page_map_extend_span(void * handle, size_t size){
+  pm_span * span = handle;
+  if ((span == NULL) || (size == 0)){
+    return;
+  }
+  pm_mark_span(span, span->end, span->end + size);
+  __atomic_store_n(&span->end, span->end + size, __ATOMIC_RELEASE);
+}
+
+
+/* Enters a large block's mapping; returns -1 if its page cannot be entered */
+int page_map_add_mapping(block_node * block, size_t length){
+  uintptr_t * entry = pm_entry((uintptr_t) block, 1);
+  if (entry == NULL){
+    return -1;
+  }
+  __atomic_store_n(entry, (uintptr_t) length | PM_MMAP, __ATOMIC_RELEASE);
+  return 0;
+}
+
+
+/* Removes a large block's mapping, before it is unmapped */
+void page_map_remove_mapping(block_node * block){
+  uintptr_t * entry = pm_entry((uintptr_t) block, 0);
+  if (entry){
+    __atomic_store_n(entry, 0, __ATOMIC_RELEASE);
+  }
+}
+
+
+/* Returns the mapping length of ptr's block if it is a large block of its
+ * own, 1 if ptr lies in the heap, and 0 if this allocator did not hand it
+ * out. Never reads the object or its block_node. */
+size_t page_map_lookup(const void * ptr){
+  uintptr_t address = (uintptr_t) ptr;
+  if (address & (ALIGNMENT - 1)){
+    return 0;
+  }
+  uintptr_t * slot = pm_entry(address, 0);
+  if (slot == NULL){
+    return 0;
+  }
+  uintptr_t entry = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+  switch (PM_KIND(entry)){
+  case PM_SPAN:
+    return span_holds((const pm_span *) PM_VALUE(entry), address);
+  case PM_MMAP:
+    return ((address & ((1UL << PM_PAGE_SHIFT) - 1)) == META_DATA_SIZE) ? PM_VALUE(entry) : 0;
+  case PM_SHARED:
+    return span_scan(address);
+  default:
+    return 0;
+  }
+}
+
+
+/* Whether ptr is a pointer this allocator handed out (see my_malloc.h) */
+int ts_owns(const void * ptr){
+  return page_map_lookup(ptr) != 0;
+}
+
+
+/* Usable bytes of the block holding ptr, 0 if it is not this allocator's.
+ * Large blocks are sized from the page map alone. */
+size_t ts_malloc_usable_size(void * ptr){
+  size_t found = page_map_lookup(ptr);
+  if (found > 1){
+    return found - META_DATA_SIZE;
+  }
+  if (found == 0){
+    return 0;
+  }
+  block_node * block = (block_node *)((char *) ptr - META_DATA_SIZE);
+  return BLOCK_SIZE(block) - META_DATA_SIZE;
+}
+
+
+/* Reports a pointer passed to function that this allocator did not hand out */
+void page_map_reject(const void * ptr, const char * function){
+  fprintf(stderr, "Error: %s of %p, which was not allocated by this heap\n", function, ptr);
+}
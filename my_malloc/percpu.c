@@ -0,0 +1,238 @@
+#define _GNU_SOURCE
+#include "my_malloc.h"
+#include <sched.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#ifdef __has_include
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define HAVE_RSEQ 1
+#endif
+#endif
+
+/* Per-CPU caches of small blocks.
+ *
+ * Each CPU owns one cache with a singly linked stack of blocks per size 
+ * class, so the number of caches follows the core count rather than the
+ * thread count. A thread finds its cache from the cpu_id field of its rseq
+ * area (registered by glibc >= 2.35) or from sched_getcpu. 
+ *
+ * A cache is claimed with a single atomic exchange and never waited on: if
+ * the claim fails (the owner was preempted or migrated mid-operation, which 
+ * is what an rseq abort would catch) the request goes straight to the 
+ * locking heap instead. Cached blocks are ordinary allocated blocks of the 
+ * locking heap, so they can be handed back with ts_free_lock at any time.
+ *
+ * The stack link is kept in the first word of the payload, which leaves the
+ * block_node header untouched while a block sits in a cache. */
+
+/* Maximum number of blocks kept per size class in one cache */
+#define PERCPU_CLASS_LIMIT 64
+
+typedef struct cpu_cache_t{
+
+  int busy; // claimed by a thread
+  unsigned counts[NUM_SIZE_CLASSES];
+  void * bins[NUM_SIZE_CLASSES];
+
+} __attribute__((aligned(64))) cpu_cache;
+
+
+/* One cache per configured CPU, mapped on first use */
+static cpu_cache * cpu_caches = NULL;
+static long num_cpu_caches = 0;
+
+/* Set when the current CPU cannot be determined */
+static int percpu_fallback = 0;
+
+static pthread_once_t percpu_once = PTHREAD_ONCE_INIT;
+
+
+/* Returns the CPU the calling thread is running on, or -1 if unknown. */
+static inline int current_cpu(){
+#ifdef HAVE_RSEQ
+  if (__rseq_size > 0){ // rseq registered by libc, cpu_id is kept current by the kernel
+    struct rseq * rs = (struct rseq *)((char *) __builtin_thread_pointer() + __rseq_offset);
+    int cpu = (int) __atomic_load_n(&rs->cpu_id, __ATOMIC_RELAXED);
+    if (cpu >= 0){
+      return cpu;
+    }
+  }
+#endif
+  return sched_getcpu();
+}
+
+
+/* Maps the cache array, one cache per configured CPU. */
+static void percpu_init(){
+  num_cpu_caches = sysconf(_SC_NPROCESSORS_CONF);
+  if (num_cpu_caches < 1){
+    num_cpu_caches = 1;
+  }
+  if (current_cpu() < 0){
+    percpu_fallback = 1;
+    return;
+  }
+  cpu_caches = mmap(NULL, num_cpu_caches * sizeof(cpu_cache), PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (cpu_caches == MAP_FAILED){
+    fprintf(stderr, "Error: mmap of %ld per-CPU caches failed\n", num_cpu_caches);
+    cpu_caches = NULL;
+    percpu_fallback = 1;
+  }
+}
+
+
+/* Claims the current CPU's cache, returns NULL if it is already claimed. */
+static inline cpu_cache * claim_cache(){
+  int cpu = current_cpu();
+  if (cpu < 0){
+    return NULL;
+  }
+  cpu_cache * cache = &cpu_caches[cpu % num_cpu_caches];
+  if (__atomic_exchange_n(&cache->busy, 1, __ATOMIC_ACQUIRE)){
+    return NULL;
+  }
+  return cache;
+}
+
+
+static inline void release_cache(cpu_cache * cache){
+  __atomic_store_n(&cache->busy, 0, __ATOMIC_RELEASE);
+}
+
+
+/* Per-CPU malloc: pops a block of the request's size class from the current
+ * CPU's cache, otherwise allocates one from the locking heap. */
+void * ts_malloc_percpu(size_t size){
+  pthread_once(&percpu_once, percpu_init);
+  if (percpu_fallback){
+    return ts_malloc_nolock(size);
+  }
+  if (size > SMALL_SIZE_MAX){
+    return ts_malloc_lock(size);
+  }
+  unsigned cls = SIZE_CLASS(size);
+  cpu_cache * cache = claim_cache();
+  if (cache){
+    void * result = cache->bins[cls];
+    if (result){
+      cache->bins[cls] = *(void **) result;
+      cache->counts[cls]--;
+      release_cache(cache);
+      PROFILE_MALLOC((block_node *)((char *) result - META_DATA_SIZE), size);
+      return result;
+    }
+    release_cache(cache);
+  }
+  return ts_malloc_lock(CLASS_SIZE(cls)); // miss, allocate a whole class sized block
+}
+
+
+/* Pushes a block on the current CPU's cache for size class cls, handing it 
+ * back to the locking heap when the cache is claimed or full. */
+static void percpu_push(void * ptr, unsigned cls){
+  cpu_cache * cache = claim_cache();
+  if (cache){
+    if (cache->counts[cls] < PERCPU_CLASS_LIMIT){
+      *(void **) ptr = cache->bins[cls];
+      cache->bins[cls] = ptr;
+      cache->counts[cls]++;
+      release_cache(cache);
+      return;
+    }
+    release_cache(cache);
+  }
+  ts_free_lock(ptr);
+}
+
+
+/* Per-CPU free. The size class is found from the block_node header. */
+void ts_free_percpu(void * ptr){
+  if (ptr == NULL){
+    return;
+  }
+  pthread_once(&percpu_once, percpu_init);
+  if (percpu_fallback){
+    ts_free_nolock(ptr);
+    return;
+  }
+  if (page_map_lookup(ptr) == 0){
+    page_map_reject(ptr, "ts_free_percpu");
+    return;
+  }
+  block_node * to_free = (block_node *)((char *)ptr - META_DATA_SIZE);
+  PROFILE_FREE(to_free);
+  TAG_FREE(to_free);
+  size_t payload = BLOCK_SIZE(to_free) - META_DATA_SIZE;
+  if ((payload < SIZE_CLASS_GRANULE) || (payload > SMALL_SIZE_MAX)){
+    ts_free_lock(ptr);
+    return;
+  }
+  percpu_push(ptr, payload / SIZE_CLASS_GRANULE - 1); // largest class the block can serve
+}
+
+
+/* Per-CPU sized free. When the request was a whole size class, the caller's
+ * size picks the class and the block_node header is not loaded. Any other
+ * size may belong to a block of the lock or nolock heap, which holds only
+ * ALIGN(size) bytes and would be too small for its rounded up class, so 
+ * such blocks are classed by their header like in ts_free_percpu. */
+void ts_free_sized_percpu(void * ptr, size_t size){
+  if (ptr == NULL){
+    return;
+  }
+  pthread_once(&percpu_once, percpu_init);
+  if (percpu_fallback){
+    ts_free_nolock(ptr);
+    return;
+  }
+  if (size > SMALL_SIZE_MAX){
+    ts_free_lock(ptr);
+    return;
+  }
+  if (ALIGN(size) != CLASS_SIZE(SIZE_CLASS(size))){
+    ts_free_percpu(ptr);
+    return;
+  }
+  if (page_map_lookup(ptr) == 0){
+    page_map_reject(ptr, "ts_free_sized_percpu");
+    return;
+  }
+  if (__builtin_expect((profile_live | tags_used) != 0, 0)){ // the header is only read while samples or tags are live
+    block_node * to_free = (block_node *)((char *)ptr - META_DATA_SIZE);
+    PROFILE_FREE(to_free);
+    TAG_FREE(to_free);
+  }
+  percpu_push(ptr, SIZE_CLASS(size));
+}
+
+
+/* Empties every per-CPU cache into the free list. Caches that are claimed
+ * at the time are skipped. */
+void ts_percpu_flush(){
+  pthread_once(&percpu_once, percpu_init);
+  if (percpu_fallback){
+    return;
+  }
+  long i;
+  unsigned cls;
+  for (i = 0; i < num_cpu_caches; i++){
+    cpu_cache * cache = &cpu_caches[i];
+    if (__atomic_exchange_n(&cache->busy, 1, __ATOMIC_ACQUIRE)){
+      continue;
+    }
+    for (cls = 0; cls < NUM_SIZE_CLASSES; cls++){
+      void * current = cache->bins[cls];
+      cache->bins[cls] = NULL;
+      cache->counts[cls] = 0;
+      while (current){
+	void * next = *(void **) current;
+	ts_free_lock(current);
+	current = next;
+      }
+    }
+    release_cache(cache);
+  }
+}
@@ -0,0 +1,164 @@
+#include "my_malloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+/* Persistent (file-backed) heaps.
+ *
+ * A persistent heap is a shared heap (see shm_heap.c) whose mapping is a
+ * regular file, so its blocks outlive the process: block metadata is
+ * already position independent, and the header's root slot holds the
+ * offset of an object from which the program finds everything else. A
+ * restarted program maps the file and pages its data back in instead of
+ * rebuilding it.
+ *
+ * Every process with the heap open holds a shared flock on the file. The
+ * first to open it (the exclusive lock is free) knows nobody else has it
+ * mapped, so it re-initializes the mutex, which may name an owner from
+ * before a crash or reboot, and rebuilds the free list from the block
+ * chain. Data written before a process crash is in the page cache and
+ * survives it; surviving a machine crash takes a ts_heap_sync (msync)
+ * at points where the heap's contents are consistent. */
+
+/* Persistent heaps one process can have open at once */
+#define MAX_OPEN_HEAPS 16
+
+
+// An open persistent heap and the descriptor holding its flock
+
+typedef struct open_heap_t{
+
+  ts_shm_heap * heap;
+  int fd;
+
+} open_heap;
+
+static open_heap open_heaps[MAX_OPEN_HEAPS];
+static pthread_mutex_t open_heaps_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* Maps the heap in fd, creating it with size bytes if the file is empty.
+ * The caller holds an exclusive flock when first is set. */
+static ts_shm_heap * map_heap_file(int fd, size_t size, int first){
+  struct stat st;
+  if (fstat(fd, &st) != 0){
+    return NULL;
+  }
+  if (st.st_size == 0){ // new file
+    if (!first){
+      fprintf(stderr, "Error: persistent heap file is empty\n");
+      return NULL;
+    }
+    size_t page = sysconf(_SC_PAGESIZE);
+    if ((size == 0) || (size > SIZE_MAX - page)){
+      fprintf(stderr, "Error: bad persistent heap size %lu\n", size);
+      return NULL;
+    }
+    return shm_heap_map(fd, (size + page - 1) & ~(page - 1), 1);
+  }
+  ts_shm_heap * heap = shm_heap_map(fd, 0, 0);
+  if (heap && first && (shm_heap_reset(heap) != 0)){
+    munmap(heap, heap->size);
+    return NULL;
+  }
+  return heap;
+}
+
+
+/* Opens the persistent heap in the file at path, creating a heap of size
+ * bytes (rounded up to whole pages) if the file does not exist or is empty.
+ * Blocks allocated by earlier runs are still valid. Returns NULL if the
+ * file holds something else or the heap is corrupt. */
+ts_shm_heap * ts_heap_open(const char * path, size_t size){
+  int fd = open(path, O_RDWR | O_CREAT, 0600);
+  if (fd < 0){
+    fprintf(stderr, "Error: could not open persistent heap file %s\n", path);
+    return NULL;
+  }
+  int first = (flock(fd, LOCK_EX | LOCK_NB) == 0); // nobody else has it open
+  if (!first && (flock(fd, LOCK_SH) != 0)){
+    fprintf(stderr, "Error: could not lock persistent heap file %s\n", path);
+    close(fd);
+    return NULL;
+  }
+  ts_shm_heap * heap = map_heap_file(fd, size, first);
+  if (first){
+    flock(fd, LOCK_SH); // set up, let other processes in
+  }
+  if (heap == NULL){
+    fprintf(stderr, "Error: could not map persistent heap file %s\n", path);
+    close(fd);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&open_heaps_mutex);
+  int i;
+  for (i = 0; i < MAX_OPEN_HEAPS; i++){
+    if (open_heaps[i].heap == NULL){
+      open_heaps[i].heap = heap;
+      open_heaps[i].fd = fd;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&open_heaps_mutex);
+  if (i == MAX_OPEN_HEAPS){
+    fprintf(stderr, "Error: more than %d persistent heaps open\n", MAX_OPEN_HEAPS);
+    munmap(heap, heap->size);
+    close(fd);
+    return NULL;
+  }
+  return heap;
+}
+
+
+/* Writes the heap's pages back to its file. Returns 0 on success. */
+int ts_heap_sync(ts_shm_heap * heap){
+  if (msync(heap, heap->size, MS_SYNC) != 0){
+    fprintf(stderr, "Error: msync of persistent heap %p failed\n", (void *) heap);
+    return -1;
+  }
+  return 0;
+}
+
+
+/* Writes the heap back to its file, unmaps it and drops its flock. Objects
+ * in it must not be used afterwards. */
+void ts_heap_close(ts_shm_heap * heap){
+  if (heap == NULL){
+    return;
+  }
+  int fd = -1;
+  int i;
+  pthread_mutex_lock(&open_heaps_mutex);
+  for (i = 0; i < MAX_OPEN_HEAPS; i++){
+    if (open_heaps[i].heap == heap){
+      fd = open_heaps[i].fd;
+      open_heaps[i].heap = NULL;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&open_heaps_mutex);
+  if (fd < 0){
+    fprintf(stderr, "Error: %p is not an open persistent heap\n", (void *) heap);
+    return;
+  }
+  ts_heap_sync(heap);
+  ts_shm_detach(heap);
+  close(fd);
+}
+
+
+/* Sets the heap's root object (NULL clears it). root must be in the heap. */
+void ts_heap_set_root(ts_shm_heap * heap, void * root){
+  __atomic_store_n(&heap->root, ts_shm_offset(heap, root), __ATOMIC_RELEASE);
+}
+
+
+/* The heap's root object, NULL if none has been set */
+void * ts_heap_get_root(ts_shm_heap * heap){
+  return ts_shm_ptr(heap, __atomic_load_n(&heap->root, __ATOMIC_ACQUIRE));
+}
@@ -0,0 +1,327 @@
+#define _GNU_SOURCE
+#include "my_malloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* Background purging of idle free blocks (locking free list only).
+ *
+ * Free'd memory stays resident until it is re-used, so a program that frees
+ * a large part of its heap keeps paying for it. Returning the pages from
+ * ts_free_lock would put a system call on the hot path, so instead a
+ * background thread ticks DECAY_STEPS times per decay period, and every free
+ * block remembers the tick it was last changed at (BIN_STAMP). On each tick
+ * the dirty (still resident) bytes are counted by age, and the oldest blocks
+ * are purged with madvise until the dirty bytes are within a limit that
+ * decays each age's bytes along a smoothstep curve: recently free'd bytes
+ * are all allowed to stay, bytes idle for a whole decay period are not, much
+ * like jemalloc's dirty page decay.
+ *
+ * list_lock is only held for bounded batches: the census takes it for
+ * CENSUS_BATCH bin entries at a time, and blocks being purged are taken off
+ * the free list so the madvise calls run without it. The block_node, BIN_POS
+ * and BIN_STAMP words at the start of a block are never purged.
+ *
+ * Configured with TS_MALLOC_DECAY_MS (decay period, unset or 0 = off) and
+ * TS_MALLOC_PURGE (dontneed or free) in the environment, read the first
+ * time the heap grows, or with ts_set_purge_decay. */
+
+/* Ticks per decay period (also the number of age buckets) */
+#define DECAY_STEPS 20
+
+/* Bin entries looked at per list_lock hold */
+#define CENSUS_BATCH 256
+
+/* Blocks taken off the free list per madvise round */
+#define PURGE_BATCH 32
+
+/* Current tick, stamped into free blocks by bin_insert */
+unsigned long purge_epoch = 0;
+
+/* Bytes returned with madvise so far (list_lock held) */
+unsigned long long purged_bytes = 0;
+
+/* Bytes purged from blocks stamped at each of the last DECAY_STEPS + 1 
+ * ticks, indexed by tick modulo DECAY_STEPS + 1 (list_lock held) */
+static unsigned long long purged_by_stamp[DECAY_STEPS + 1];
+
+static pthread_mutex_t purge_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t purge_cond;
+static pthread_once_t purge_once = PTHREAD_ONCE_INIT;
+static pthread_t purge_thread;
+static int purge_running = 0;
+static int purge_stop = 0;
+static unsigned long decay_ms = 0;
+static int purge_advice = MADV_DONTNEED;
+
+static size_t page_size = 0;
+
+
+/* Finds the whole pages of a free block that can be purged. Returns 0 if
+ * there are none. */
+static int purge_range(block_node * block, char ** start, size_t * len){
+  uintptr_t first = ((uintptr_t) block + META_DATA_SIZE + 2 * sizeof(size_t) + page_size - 1) & ~(page_size - 1);
+  uintptr_t last = ((uintptr_t) block + block->size) & ~(page_size - 1);
+  if (last <= first){
+    return 0;
+  }
+  *start = (char *) first;
+  *len = last - first;
+  return 1;
+}
+
+
+/* Number of ticks since a dirty block was last changed */
+static unsigned long block_age(block_node * block, unsigned long now){
+  unsigned long stamp = BIN_STAMP(block);
+  return stamp < now ? now - stamp : 0;
+}
+
+
+/* Age bucket of a dirty block (ages past the decay period share the last) */
+static unsigned age_bucket(block_node * block, unsigned long now){
+  unsigned long age = block_age(block, now);
+  return age < DECAY_STEPS ? age : DECAY_STEPS;
+}
+
+
+/* Fraction of the bytes of a given age that may stay dirty: 1 when just
+ * free'd, falling along a smoothstep curve to 0 after DECAY_STEPS ticks. */
+static double decay_allowance(unsigned long age){
+  if (age >= DECAY_STEPS){
+    return 0.0;
+  }
+  double x = (double) age / DECAY_STEPS;
+  return 1.0 - x * x * (3.0 - 2.0 * x);
+}
+
+
+/* Counts the purgeable dirty bytes of the free list by age bucket. */
+static void purge_census(unsigned long long * dirty, unsigned long now){
+  unsigned index;
+  memset(dirty, 0, (DECAY_STEPS + 1) * sizeof(*dirty));
+  for (index = 0; index < NUM_BINS; index++){
+    size_t pos = 0;
+    int more = 1;
+    while (more){
+      ts_lock_acquire(&list_lock);
+      size_t end = pos + CENSUS_BATCH;
+      for (; (pos < bins[index].count) && (pos < end); pos++){
+	block_node * block = bins[index].blocks[pos];
+	char * start;
+	size_t len;
+	if ((BIN_STAMP(block) & PURGE_CLEAN) || !purge_range(block, &start, &len)){
+	  continue;
+	}
+	dirty[age_bucket(block, now)] += len;
+      }
+      more = (pos < bins[index].count);
+      ts_lock_release(&list_lock);
+    }
+  }
+}
+
+
+/* Purges dirty blocks while the budget for their age bucket lasts. Blocks
+ * are taken off the free list while their pages are advised, then put back
+ * (and coalesced) marked clean. */
+static void purge_by_age(unsigned long long * budget, unsigned long now){
+  unsigned index;
+  for (index = 0; index < NUM_BINS; index++){
+    size_t pos = 0;
+    int more = 1;
+    while (more){
+      block_node * batch[PURGE_BATCH];
+      int num = 0;
+      int i;
+
+      ts_lock_acquire(&list_lock);
+      size_t end = pos + CENSUS_BATCH;
+      while ((pos < bins[index].count) && (pos < end) && (num < PURGE_BATCH)){
+	block_node * block = bins[index].blocks[pos];
+	unsigned bucket = age_bucket(block, now);
+	char * start;
+	size_t len;
+	if (!(BIN_STAMP(block) & PURGE_CLEAN) && budget[bucket] &&
+	    purge_range(block, &start, &len)){
+	  budget[bucket] -= len < budget[bucket] ? len : budget[bucket];
+	  purged_by_stamp[BIN_STAMP(block) % (DECAY_STEPS + 1)] += len;
+	  batch[num++] = block;
+	  remove_from_free_list(block); // moves the bin's last entry into pos
+	  end--;
+	}
+	else{
+	  pos++;
+	}
+      }
+      more = (pos < bins[index].count);
+      ts_lock_release(&list_lock);
+
+      if (num == 0){
+	continue;
+      }
+      unsigned long long advised = 0;
+      for (i = 0; i < num; i++){
+	char * start = NULL;
+	size_t len = 0;
+	if (!purge_range(batch[i], &start, &len)){
+	  continue; // no whole page left to purge
+	}
+	if (madvise(start, len, purge_advice) == 0){
+	  advised += len;
+	}
+      }
+
+      ts_lock_acquire(&list_lock);
+      for (i = 0; i < num; i++){
+	add_to_free_list(batch[i]);
+	BIN_STAMP(batch[i]) = PURGE_CLEAN | now;
+	coalesce(batch[i]); // a merge makes the result dirty again
+      }
+      purged_bytes += advised;
+      ts_lock_release(&list_lock);
+    }
+  }
+}
+
+
+/* One tick of the decay curve. The bytes of each age that may stay dirty 
+ * are a fraction of the bytes that were free'd at that tick (still dirty 
+ * plus already purged), so the curve is followed rather than compounded
+ * from tick to tick; each age's excess is purged. */
+static void purge_tick(){
+  unsigned long long dirty[DECAY_STEPS + 1];
+  unsigned long long budget[DECAY_STEPS + 1];
+  unsigned long now = __atomic_add_fetch(&purge_epoch, 1, __ATOMIC_RELAXED);
+  unsigned long age;
+  int any = 0;
+
+  ts_lock_acquire(&list_lock);
+  purged_by_stamp[now % (DECAY_STEPS + 1)] = 0; // slot of a tick now too old to matter
+  ts_lock_release(&list_lock);
+
+  purge_census(dirty, now);
+  ts_lock_acquire(&list_lock);
+  for (age = 0; age <= DECAY_STEPS; age++){
+    unsigned long long freed = dirty[age];
+    if (age < DECAY_STEPS){
+      freed += purged_by_stamp[(now - age) % (DECAY_STEPS + 1)];
+    }
+    double allowed = freed * decay_allowance(age);
+    budget[age] = dirty[age] > allowed ? dirty[age] - (unsigned long long) allowed : 0;
+    any |= (budget[age] != 0);
+  }
+  ts_lock_release(&list_lock);
+  if (any){
+    purge_by_age(budget, now);
+  }
+}
+
+
+/* Body of the purge thread: ticks DECAY_STEPS times per decay period until
+ * it is stopped. */
+static void * purge_main(void * arg){
+  (void) arg;
+  pthread_mutex_lock(&purge_mutex);
+  while (!purge_stop){
+    struct timespec wake;
+    clock_gettime(CLOCK_MONOTONIC, &wake);
+    unsigned long tick_ns = decay_ms * 1000000UL / DECAY_STEPS;
+    wake.tv_sec += tick_ns / 1000000000UL;
+    wake.tv_nsec += tick_ns % 1000000000UL;
+    if (wake.tv_nsec >= 1000000000L){
+      wake.tv_sec++;
+      wake.tv_nsec -= 1000000000L;
+    }
+    if ((pthread_cond_timedwait(&purge_cond, &purge_mutex, &wake) == 0) || purge_stop){
+      continue; // woken early by ts_set_purge_decay
+    }
+    pthread_mutex_unlock(&purge_mutex);
+    purge_tick();
+    pthread_mutex_lock(&purge_mutex);
+  }
+  pthread_mutex_unlock(&purge_mutex);
+  return NULL;
+}
+
+
+/* Sets the decay period and advice, starting or stopping the thread */
+static int set_purge_decay(unsigned long ms, int use_madv_free){
+  pthread_mutex_lock(&purge_mutex);
+  purge_advice = use_madv_free ? MADV_FREE : MADV_DONTNEED;
+  if (ms == 0){
+    if (purge_running){
+      purge_stop = 1;
+      pthread_cond_signal(&purge_cond);
+      pthread_mutex_unlock(&purge_mutex);
+      pthread_join(purge_thread, NULL);
+      pthread_mutex_lock(&purge_mutex);
+      purge_running = 0;
+    }
+    decay_ms = 0;
+    pthread_mutex_unlock(&purge_mutex);
+    return 0;
+  }
+  decay_ms = ms;
+  if (purge_running){
+    pthread_cond_signal(&purge_cond); // pick up the new period
+    pthread_mutex_unlock(&purge_mutex);
+    return 0;
+  }
+  purge_stop = 0;
+  if (pthread_create(&purge_thread, NULL, purge_main, NULL) != 0){
+    decay_ms = 0;
+    pthread_mutex_unlock(&purge_mutex);
+    fprintf(stderr, "Error: could not start the purge thread\n");
+    return -1;
+  }
+  purge_running = 1;
+  pthread_mutex_unlock(&purge_mutex);
+  return 0;
+}
+
+
+/* Sets up the condition variable and reads the environment, once. */
+static void purge_setup(){
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&purge_cond, &attr);
+  pthread_condattr_destroy(&attr);
+  page_size = sysconf(_SC_PAGESIZE);
+
+  char * env = getenv("TS_MALLOC_DECAY_MS");
+  if (env && (atol(env) > 0)){
+    char * advice = getenv("TS_MALLOC_PURGE");
+    set_purge_decay(atol(env), advice && (strcasecmp(advice, "free") == 0));
+  }
+}
+
+
+/* Starts the purge thread if TS_MALLOC_DECAY_MS is set (first call only) */
+void purge_init(){
+  pthread_once(&purge_once, purge_setup);
+}
+
+
+/* Sets the decay period in milliseconds, starting the purge thread if
+ * needed; 0 stops it. use_madv_free selects MADV_FREE (pages are reclaimed
+ * lazily, under memory pressure) over MADV_DONTNEED. Returns 0 on success,
+ * -1 if the thread could not be started. */
+int ts_set_purge_decay(unsigned long ms, int use_madv_free){
+  purge_init();
+  return set_purge_decay(ms, use_madv_free);
+}
+
+
+/* Purges every dirty free block right away, whatever its age. */
+void ts_purge_now(){
+  unsigned long long budget[DECAY_STEPS + 1];
+  memset(budget, 0xff, sizeof(budget));
+  purge_init();
+  purge_by_age(budget, __atomic_load_n(&purge_epoch, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,113 @@
+#include "my_malloc.h"
+#include <stdio.h>
+
+/* Region (arena) allocator built on top of the locking heap.
+ *
+ * A region hands out memory by bumping a pointer through chunks that are 
+ * taken from the heap with ts_malloc_lock (so they come from the free list
+ * or from grow_heap). Objects are never freed individually; destroying the
+ * region gives every chunk back to the free list under a single acquisition
+ * of list_lock. */
+
+/* Default chunk size requested from the heap. Requests that do not fit in a
+ * chunk of this size get a chunk of their own. */
+#define REGION_CHUNK_SIZE (64 * 1024)
+
+/* Space taken by the chunk header at the start of each chunk */
+#define REGION_CHUNK_HEADER ALIGN(sizeof(region_chunk))
+
+
+/* Takes a new chunk from the heap that can hold at least size bytes and 
+ * pushes it on the front of the region's chunk list. */
+static region_chunk * region_add_chunk(ts_region * region, size_t size){
+  if (size > SIZE_MAX - REGION_CHUNK_HEADER){ // chunk size would overflow
+    return NULL;
+  }
+  size_t chunk_size = REGION_CHUNK_SIZE;
+  if (size + REGION_CHUNK_HEADER > chunk_size){ // oversized request
+    chunk_size = size + REGION_CHUNK_HEADER;
+  }
+  region_chunk * chunk = ts_malloc_lock(chunk_size);
+  if (chunk == NULL){
+    fprintf(stderr, "Error: region chunk allocation of size %lu failed\n", chunk_size);
+    return NULL;
+  }
+  chunk->cur = (char *) chunk + REGION_CHUNK_HEADER;
+  chunk->end = (char *) chunk + chunk_size;
+  if (region){
+    chunk->next = region->chunks;
+    region->chunks = chunk;
+  }
+  else{
+    chunk->next = NULL;
+  }
+  return chunk;
+}
+
+
+/* Creates an empty region. The region handle is bump allocated out of the 
+ * region's first chunk, so it is released along with everything else. */
+ts_region * ts_region_create(){
+  region_chunk * first = region_add_chunk(NULL, sizeof(ts_region));
+  if (first == NULL){
+    return NULL;
+  }
+  ts_region * region = (ts_region *) first->cur;
+  first->cur += ALIGN(sizeof(ts_region));
+  region->chunks = first;
+  return region;
+}
+
+
+/* Bump allocates size bytes from the region. Returned memory is aligned 
+ * to ALIGNMENT and stays valid until the region is destroyed. Returns NULL
+ * for sizes that cannot be allocated. */
+void * ts_region_alloc(ts_region * region, size_t size){
+  if ((region == NULL) || (size > SIZE_MAX - (ALIGNMENT - 1))){ // ALIGN would wrap to 0
+    return NULL;
+  }
+  size = ALIGN(size);
+  region_chunk * chunk = region->chunks;
+  if ((size_t)(chunk->end - chunk->cur) < size){ // current chunk exhausted
+    if ((chunk = region_add_chunk(region, size)) == NULL){
+      return NULL;
+    }
+  }
+  void * result = chunk->cur;
+  chunk->cur += size;
+  return result;
+}
+
+
+/* Destroys a region, returning all of its chunks to the free list at once.
+ * Oversized chunks that got a mapping of their own (BLOCK_MMAPPED) are 
+ * unmapped first, since they can never go on the free list. */
+void ts_region_destroy(ts_region * region){
+  if (region == NULL){
+    return;
+  }
+  region_chunk ** link = &region->chunks; // the handle's own chunk is never mapped
+  region_chunk * chunk = NULL;
+  region_chunk * next = NULL;
+  while ((chunk = *link) != NULL){
+    if (((block_node *)((char *) chunk - META_DATA_SIZE))->size & BLOCK_MMAPPED){
+      *link = chunk->next;
+      ts_free_lock(chunk);
+    }
+    else{
+      link = &chunk->next;
+    }
+  }
+
+  chunk = region->chunks;
+  ts_lock_acquire(&list_lock); // one lock acquisition for the whole region
+  while (chunk){
+    next = chunk->next; // read before the chunk's payload is reused by the list
+    block_node * to_free = (block_node *)((char *) chunk - META_DATA_SIZE);
+    PROFILE_FREE(to_free);
+    add_to_free_list(to_free);
+    coalesce(to_free);
+    chunk = next;
+  }
+  ts_lock_release(&list_lock);
+}
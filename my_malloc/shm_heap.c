@@ -0,0 +1,441 @@
+#define _GNU_SOURCE
+#include "my_malloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Shared-memory heap for several processes.
+ *
+ * The heap lives in one MAP_SHARED mapping (a POSIX shared memory object, a
+ * memfd or any other file descriptor), headed by a ts_shm_heap. Each process
+ * may map it at a different address, so blocks are linked by their offsets
+ * from the header instead of by pointers, and objects are passed between
+ * processes as offsets (ts_shm_offset / ts_shm_ptr).
+ *
+ * Free blocks sit on doubly linked lists in the header, one per bin with
+ * the same size ranges as the private heap's bins (bin_index), so a bin is
+ * searched best fit and any block in a higher bin fits. Free blocks keep
+ * their size in their last word too, and the block after a free block is
+ * flagged SHM_PREV_FREE, so both neighbours are found and merged in O(1) on
+ * free. Everything is protected by a process-shared robust mutex in the 
+ * header (not the TS_LOCK_TYPE lock, which only works within a process).
+ *
+ * Blocks tile the heap from the first block to the end of the mapping, and
+ * every update keeps that chain of sizes valid, with free blocks flagged
+ * SHM_FREE; a merge is a single store of the merged size. If a process dies
+ * holding the mutex, the next process to take it rebuilds the bins, footers
+ * and SHM_PREV_FREE flags from the chain, so a crash can leak the block
+ * being allocated or free'd at the time but cannot corrupt the heap. */
+
+/* Identifies an initialized heap header */
+#define SHM_MAGIC 0x74735f73686d6870UL
+
+/* Flags in a shared block's size: the block is free, the block before it is free */
+#define SHM_FREE      1UL
+#define SHM_PREV_FREE 2UL
+
+/* Size of a shared block without its flag bits */
+#define SHM_SIZE(b) ((b)->size & ~(uint64_t)(ALIGNMENT - 1))
+
+/* Size of a free block, kept in its last word */
+#define SHM_FOOTER(b) (*(uint64_t *)((char *)(b) + SHM_SIZE(b) - sizeof(uint64_t)))
+
+/* Offset of the first block, just past the header */
+#define SHM_FIRST_BLOCK ALIGN(sizeof(ts_shm_heap))
+
+/* Smallest shared block: a 16 byte payload, as on the private heap */
+#define SHM_MIN_BLOCK (sizeof(shm_block) + 16)
+
+
+// Meta data of a block in a shared heap, links are offsets (0 = none)
+
+typedef struct shm_block_t{
+
+  uint64_t size;
+  uint64_t next;
+  uint64_t prev;
+
+} shm_block;
+
+
+/* Block at an offset from the heap header */
+static inline shm_block * shm_at(ts_shm_heap * heap, uint64_t offset){
+  return offset ? (shm_block *)((char *) heap + offset) : NULL;
+}
+
+
+/* Offset of a block from the heap header */
+static inline uint64_t shm_off(ts_shm_heap * heap, shm_block * block){
+  return block ? (uint64_t)((char *) block - (char *) heap) : 0;
+}
+
+
+/* Block physically after a block, NULL at the end of the heap */
+static inline shm_block * shm_next_block(ts_shm_heap * heap, shm_block * block){
+  uint64_t next = shm_off(heap, block) + SHM_SIZE(block);
+  return next < heap->size ? shm_at(heap, next) : NULL;
+}
+
+
+/* Pushes a free block (size and flags already set) onto its bin and writes
+ * its footer */
+static void shm_bin_insert(ts_shm_heap * heap, shm_block * block){
+  unsigned index = bin_index(SHM_SIZE(block));
+  uint64_t offset = shm_off(heap, block);
+  SHM_FOOTER(block) = SHM_SIZE(block);
+  block->prev = 0;
+  block->next = heap->bins[index];
+  if (block->next){
+    shm_at(heap, block->next)->prev = offset;
+  }
+  heap->bins[index] = offset;
+  heap->bin_map |= 1UL << index;
+}
+
+
+/* Removes a free block from its bin */
+static void shm_bin_remove(ts_shm_heap * heap, shm_block * block){
+  unsigned index = bin_index(SHM_SIZE(block));
+  if (block->prev){
+    shm_at(heap, block->prev)->next = block->next;
+  }
+  else{
+    heap->bins[index] = block->next;
+    if (block->next == 0){
+      heap->bin_map &= ~(1UL << index);
+    }
+  }
+  if (block->next){
+    shm_at(heap, block->next)->prev = block->prev;
+  }
+}
+
+
+/* Rebuilds the bins by walking every block from the first one, merging
+ * runs of adjacent free blocks and setting footers and SHM_PREV_FREE. Used
+ * after a process died holding the heap's mutex. Returns -1 if the chain
+ * of sizes is broken. */
+static int shm_rebuild(ts_shm_heap * heap){
+  uint64_t offset = SHM_FIRST_BLOCK;
+  shm_block * last_free = NULL;
+  memset(heap->bins, 0, sizeof(heap->bins));
+  heap->bin_map = 0;
+  heap->free_bytes = 0;
+  while (offset < heap->size){
+    shm_block * block = shm_at(heap, offset);
+    uint64_t size = SHM_SIZE(block);
+    if ((size < SHM_MIN_BLOCK) || (size > heap->size - offset)){
+      fprintf(stderr, "Error: shared heap block at offset %lu has a bad size\n", (unsigned long) offset);
+      return -1;
+    }
+    if (block->size & SHM_FREE){
+      if (last_free){
+	last_free->size += size; // merge into the free block before it
+      }
+      else{
+	block->size = size | SHM_FREE;
+	last_free = block;
+      }
+      heap->free_bytes += size;
+    }
+    else{
+      if (last_free){
+	shm_bin_insert(heap, last_free);
+	last_free = NULL;
+	block->size = size | SHM_PREV_FREE;
+      }
+      else{
+	block->size = size;
+      }
+    }
+    offset += size;
+  }
+  if (last_free){
+    shm_bin_insert(heap, last_free);
+  }
+  return 0;
+}
+
+
+/* Takes the heap's mutex, repairing the free lists if its last owner died.
+ * Returns -1 if the heap cannot be used. */
+static int shm_lock(ts_shm_heap * heap){
+  int ret = pthread_mutex_lock(&heap->lock);
+  if (ret == EOWNERDEAD){
+    heap->recoveries++;
+    if (shm_rebuild(heap) != 0){
+      pthread_mutex_unlock(&heap->lock); // leaves the mutex unrecoverable
+      return -1;
+    }
+    pthread_mutex_consistent(&heap->lock);
+    return 0;
+  }
+  if (ret != 0){
+    fprintf(stderr, "Error: could not lock shared heap (error %d)\n", ret);
+    return -1;
+  }
+  return 0;
+}
+
+
+/* Initializes a heap's process-shared robust mutex */
+static void shm_init_lock(ts_shm_heap * heap){
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&heap->lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+}
+
+
+/* Starts a heap that no process has mapped over: the mutex may still name
+ * an owner from before a crash or reboot, so it is initialized again and
+ * the free list rebuilt. Returns -1 if the heap is corrupt. */
+int shm_heap_reset(ts_shm_heap * heap){
+  shm_init_lock(heap);
+  return shm_rebuild(heap);
+}
+
+
+/* Maps a shared heap from fd. The header is initialized (the heap made one
+ * free block) when create is set, otherwise it is checked. */
+ts_shm_heap * shm_heap_map(int fd, size_t size, int create){
+  if (create){
+    if (ftruncate(fd, size) != 0){
+      fprintf(stderr, "Error: could not size shared heap to %lu bytes\n", size);
+      return NULL;
+    }
+  }
+  else{
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || ((size_t) st.st_size < SHM_FIRST_BLOCK + SHM_MIN_BLOCK)){
+      fprintf(stderr, "Error: file descriptor %d does not hold a shared heap\n", fd);
+      return NULL;
+    }
+    size = st.st_size;
+  }
+  ts_shm_heap * heap = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (heap == MAP_FAILED){
+    fprintf(stderr, "Error: mmap of shared heap with size %lu failed\n", size);
+    return NULL;
+  }
+  if (!create){
+    if ((heap->magic != SHM_MAGIC) || (heap->size != size)){
+      fprintf(stderr, "Error: file descriptor %d does not hold a shared heap\n", fd);
+      munmap(heap, size);
+      return NULL;
+    }
+    return heap;
+  }
+
+  shm_init_lock(heap);
+  heap->size = size;
+  heap->recoveries = 0;
+  heap->root = 0;
+  memset(heap->bins, 0, sizeof(heap->bins));
+  heap->bin_map = 0;
+  shm_block * first = shm_at(heap, SHM_FIRST_BLOCK);
+  first->size = (size - SHM_FIRST_BLOCK) | SHM_FREE;
+  shm_bin_insert(heap, first);
+  heap->free_bytes = size - SHM_FIRST_BLOCK;
+  __atomic_store_n(&heap->magic, SHM_MAGIC, __ATOMIC_RELEASE); // ready to attach
+  return heap;
+}
+
+
+/* Creates a shared heap of size bytes (rounded up to whole pages) in the
+ * POSIX shared memory object name, which must not exist yet. With a NULL
+ * name the heap is an anonymous memfd, shared with children by fork. */
+ts_shm_heap * ts_shm_create(const char * name, size_t size){
+  size_t page = sysconf(_SC_PAGESIZE);
+  if ((size < SHM_FIRST_BLOCK + SHM_MIN_BLOCK) || (size > SIZE_MAX - page)){
+    fprintf(stderr, "Error: bad shared heap size %lu\n", size);
+    return NULL;
+  }
+  size = (size + page - 1) & ~(page - 1);
+  int fd = name ? shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600) : memfd_create("ts_shm_heap", 0);
+  if (fd < 0){
+    fprintf(stderr, "Error: could not create shared memory object %s\n", name ? name : "(memfd)");
+    return NULL;
+  }
+  ts_shm_heap * heap = shm_heap_map(fd, size, 1);
+  close(fd); // the mapping keeps the object alive
+  if ((heap == NULL) && name){
+    shm_unlink(name);
+  }
+  return heap;
+}
+
+
+/* Maps an existing shared heap from the POSIX shared memory object name */
+ts_shm_heap * ts_shm_attach(const char * name){
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0){
+    fprintf(stderr, "Error: could not open shared memory object %s\n", name);
+    return NULL;
+  }
+  ts_shm_heap * heap = shm_heap_map(fd, 0, 0);
+  close(fd);
+  return heap;
+}
+
+
+/* Maps an existing shared heap from a file descriptor (e.g. a memfd passed
+ * over a unix socket). The descriptor may be closed afterwards. */
+ts_shm_heap * ts_shm_attach_fd(int fd){
+  return shm_heap_map(fd, 0, 0);
+}
+
+
+/* Unmaps a shared heap from this process. Blocks it allocated stay valid
+ * for the other processes. */
+void ts_shm_detach(ts_shm_heap * heap){
+  if (heap && (munmap(heap, heap->size) != 0)){
+    fprintf(stderr, "Error: munmap of shared heap %p failed\n", (void *) heap);
+  }
+}
+
+
+/* Allocates size bytes from a shared heap: the best fit in the request's
+ * bin, else any block of the next non-empty bin. Returns NULL when the heap
+ * is full; a shared heap never grows. */
+void * ts_shm_malloc(ts_shm_heap * heap, size_t size){
+  if (size > heap->size){
+    return NULL;
+  }
+  uint64_t block_size = ALIGN(size) + sizeof(shm_block);
+  if (block_size < SHM_MIN_BLOCK){
+    block_size = SHM_MIN_BLOCK;
+  }
+  if (shm_lock(heap) != 0){
+    return NULL;
+  }
+  unsigned index = bin_index(block_size);
+  shm_block * best = NULL;
+  shm_block * current = shm_at(heap, heap->bins[index]);
+  while (current){
+    uint64_t current_size = SHM_SIZE(current);
+    if ((current_size >= block_size) && ((best == NULL) || (current_size < SHM_SIZE(best)))){
+      best = current;
+      if (current_size == block_size){
+	break; // exact fit
+      }
+    }
+    current = shm_at(heap, current->next);
+  }
+  if (best == NULL){
+    unsigned long above = (index + 1 < NUM_BINS) ? heap->bin_map & (~0UL << (index + 1)) : 0;
+    if (above == 0){
+      pthread_mutex_unlock(&heap->lock);
+      return NULL;
+    }
+    best = shm_at(heap, heap->bins[__builtin_ctzl(above)]);
+  }
+
+  shm_bin_remove(heap, best);
+  uint64_t best_size = SHM_SIZE(best);
+  uint64_t prev_free = best->size & SHM_PREV_FREE;
+  if (best_size - block_size >= SHM_MIN_BLOCK){
+    // the remainder is written before the block shrinks, so the chain of
+    // sizes stays valid; the block after it is still after a free block
+    shm_block * rest = (shm_block *)((char *) best + block_size);
+    rest->size = (best_size - block_size) | SHM_FREE;
+    shm_bin_insert(heap, rest);
+    best->size = block_size | prev_free;
+  }
+  else{
+    best->size = best_size | prev_free;
+    shm_block * next = shm_next_block(heap, best);
+    if (next){
+      next->size &= ~SHM_PREV_FREE;
+    }
+  }
+  heap->free_bytes -= SHM_SIZE(best);
+  pthread_mutex_unlock(&heap->lock);
+  return (char *) best + sizeof(shm_block);
+}
+
+
+/* Returns a block to a shared heap, merging it with free neighbours.
+ * Any process that maps the heap may free it. Pointers that cannot be a
+ * block (out of the heap, misaligned, or with a size that does not fit in
+ * the rest of the heap) are rejected, since merging them would corrupt the
+ * heap for every process. */
+void ts_shm_free(ts_shm_heap * heap, void * ptr){
+  if (ptr == NULL){
+    return;
+  }
+  shm_block * block = (shm_block *)((char *) ptr - sizeof(shm_block));
+  uint64_t offset = shm_off(heap, block);
+  if (((char *) block < (char *) heap) || (offset < SHM_FIRST_BLOCK) || (offset >= heap->size)){
+    fprintf(stderr, "Error: %p is not in shared heap %p\n", ptr, (void *) heap);
+    return;
+  }
+  if (offset % ALIGNMENT){ // blocks start at multiples of ALIGNMENT
+    fprintf(stderr, "Error: %p is not a block of shared heap %p\n", ptr, (void *) heap);
+    return;
+  }
+  if (shm_lock(heap) != 0){
+    return;
+  }
+  uint64_t size = SHM_SIZE(block);
+  if ((size < SHM_MIN_BLOCK) || (size > heap->size - offset)){
+    pthread_mutex_unlock(&heap->lock);
+    fprintf(stderr, "Error: %p is not a block of shared heap %p\n", ptr, (void *) heap);
+    return;
+  }
+  if (block->size & SHM_FREE){
+    pthread_mutex_unlock(&heap->lock);
+    fprintf(stderr, "Error: double free of shared block at offset %lu\n", (unsigned long) offset);
+    return;
+  }
+  heap->free_bytes += size;
+
+  shm_block * next = shm_next_block(heap, block);
+  if (next && (next->size & SHM_FREE)){
+    shm_bin_remove(heap, next);
+    size += SHM_SIZE(next);
+  }
+  if (block->size & SHM_PREV_FREE){
+    shm_block * prev = (shm_block *)((char *) block - *(uint64_t *)((char *) block - sizeof(uint64_t)));
+    shm_bin_remove(heap, prev);
+    size += SHM_SIZE(prev);
+    block = prev;
+  }
+  block->size = size | SHM_FREE; // one store merges the neighbours
+  shm_bin_insert(heap, block);
+  next = shm_next_block(heap, block);
+  if (next){
+    next->size |= SHM_PREV_FREE;
+  }
+  pthread_mutex_unlock(&heap->lock);
+}
+
+
+/* Offset of an object in a shared heap, the same in every process */
+uint64_t ts_shm_offset(ts_shm_heap * heap, void * ptr){
+  return ptr ? (uint64_t)((char *) ptr - (char *) heap) : 0;
+}
+
+
+/* This process's address of an object at an offset in a shared heap */
+void * ts_shm_ptr(ts_shm_heap * heap, uint64_t offset){
+  return offset ? (char *) heap + offset : NULL;
+}
+
+
+/* Bytes on a shared heap's free list (block headers included) */
+size_t ts_shm_free_space(ts_shm_heap * heap){
+  if (shm_lock(heap) != 0){
+    return 0;
+  }
+  size_t free_bytes = heap->free_bytes;
+  pthread_mutex_unlock(&heap->lock);
+  return free_bytes;
+}
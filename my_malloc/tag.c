@@ -0,0 +1,254 @@
+#include "my_malloc.h"
+#include <stdio.h>
+
+/* Per-tag memory accounting.
+ *
+ * ts_malloc_tagged stores a small tag id in the top byte of the block's
+ * size (BLOCK_TAG_MASK, never part of a real size), and the free paths
+ * credit the block back through TAG_FREE, so attribution costs no memory
+ * and untagged blocks pay one branch on a header that is read anyway.
+ *
+ * Each thread counts the usable bytes and blocks of every tag in its own
+ * thread local counters: the owner is the only writer, so these are plain
+ * (relaxed) loads and stores with no atomic read-modify-write. A block
+ * free'd by another thread is subtracted from that thread's counters, so
+ * a single thread's counts can go negative; only their sum is meaningful.
+ * Threads register their counters on first use, and ts_get_tag_stats adds
+ * up the registered threads and the totals left by threads that exited.
+ *
+ * Soft limits are checked by summing the threads too, so a thread only
+ * checks after it has allocated a tag's check interval (a fraction of the
+ * limit) since its last check. The limit can therefore be overshot by up
+ * to one interval per allocating thread before the callback runs. */
+
+/* A thread checks a tag's soft limit after allocating 1/TAG_CHECK_FRACTION
+ * of the limit, and at least every TAG_CHECK_MAX bytes */
+#define TAG_CHECK_FRACTION 64
+#define TAG_CHECK_MAX (1024 * 1024)
+
+typedef struct tag_counters_t{
+
+  long long bytes[TS_NUM_TAGS];
+  long long blocks[TS_NUM_TAGS];
+  long long unchecked[TS_NUM_TAGS]; // bytes allocated since the last limit check
+  int state;                        // TAG_UNREGISTERED, TAG_REGISTERED or TAG_EXITED
+  struct tag_counters_t * next;
+  struct tag_counters_t * prev;
+
+} tag_counters;
+
+enum { TAG_UNREGISTERED, TAG_REGISTERED, TAG_EXITED };
+
+typedef struct tag_limit_t{
+
+  size_t bytes;
+  size_t check_bytes;
+  ts_tag_limit_callback callback;
+  void * arg;
+  int over;                         // reported, not yet back under the limit
+  unsigned long hits;
+
+} tag_limit;
+
+/* Set once the first tagged block is handed out: from then on the sized
+ * frees read block headers, which may hold a tag */
+unsigned long tags_used = 0;
+
+static __thread tag_counters tag_local;
+
+/* Counters of the registered threads, and the totals of exited threads */
+static tag_counters * tag_threads = NULL;
+static tag_counters tag_retired;
+static tag_limit tag_limits[TS_NUM_TAGS];
+static pthread_mutex_t tag_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_key_t tag_key;
+static pthread_once_t tag_once = PTHREAD_ONCE_INIT;
+
+
+/* Folds the exiting thread's counters into the retired totals. Blocks it
+ * frees in later destructors are counted there directly. */
+static void tag_exit(void * arg){
+  (void) arg;
+  unsigned tag;
+  pthread_mutex_lock(&tag_mutex);
+  for (tag = 1; tag < TS_NUM_TAGS; tag++){
+    __atomic_add_fetch(&tag_retired.bytes[tag], tag_local.bytes[tag], __ATOMIC_RELAXED);
+    __atomic_add_fetch(&tag_retired.blocks[tag], tag_local.blocks[tag], __ATOMIC_RELAXED);
+  }
+  if (tag_local.prev){
+    tag_local.prev->next = tag_local.next;
+  }
+  else{
+    tag_threads = tag_local.next;
+  }
+  if (tag_local.next){
+    tag_local.next->prev = tag_local.prev;
+  }
+  tag_local.state = TAG_EXITED;
+  pthread_mutex_unlock(&tag_mutex);
+}
+
+
+static void tag_setup(){
+  if (pthread_key_create(&tag_key, tag_exit) != 0){
+    fprintf(stderr, "Error: could not create the tag accounting key\n");
+  }
+}
+
+
+/* Makes the calling thread's counters visible to ts_get_tag_stats */
+static void tag_register(){
+  pthread_once(&tag_once, tag_setup);
+  pthread_mutex_lock(&tag_mutex);
+  tag_local.prev = NULL;
+  tag_local.next = tag_threads;
+  if (tag_threads){
+    tag_threads->prev = &tag_local;
+  }
+  tag_threads = &tag_local;
+  tag_local.state = TAG_REGISTERED;
+  pthread_mutex_unlock(&tag_mutex);
+  pthread_setspecific(tag_key, &tag_local); // non-NULL, so tag_exit runs
+}
+
+
+/* Adds bytes and blocks to the calling thread's counts of tag */
+static inline void tag_count(unsigned tag, long long bytes, long long blocks){
+  if (__builtin_expect(tag_local.state != TAG_REGISTERED, 0)){
+    if (tag_local.state == TAG_EXITED){
+      __atomic_add_fetch(&tag_retired.bytes[tag], bytes, __ATOMIC_RELAXED);
+      __atomic_add_fetch(&tag_retired.blocks[tag], blocks, __ATOMIC_RELAXED);
+      return;
+    }
+    tag_register();
+  }
+  // only this thread writes its counters, readers just need whole values
+  __atomic_store_n(&tag_local.bytes[tag], tag_local.bytes[tag] + bytes, __ATOMIC_RELAXED);
+  __atomic_store_n(&tag_local.blocks[tag], tag_local.blocks[tag] + blocks, __ATOMIC_RELAXED);
+}
+
+
+/* Sums tag's counters over every thread */
+static void tag_sum(unsigned tag, long long * bytes, long long * blocks){
+  pthread_mutex_lock(&tag_mutex);
+  long long total_bytes = __atomic_load_n(&tag_retired.bytes[tag], __ATOMIC_RELAXED);
+  long long total_blocks = __atomic_load_n(&tag_retired.blocks[tag], __ATOMIC_RELAXED);
+  tag_counters * current;
+  for (current = tag_threads; current; current = current->next){
+    total_bytes += __atomic_load_n(&current->bytes[tag], __ATOMIC_RELAXED);
+    total_blocks += __atomic_load_n(&current->blocks[tag], __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&tag_mutex);
+  *bytes = total_bytes;
+  *blocks = total_blocks;
+}
+
+
+/* Checks tag's soft limit, calling back when its bytes first reach it and
+ * re-arming once they are below it again */
+static void tag_check(unsigned tag){
+  tag_limit * limit = &tag_limits[tag];
+  long long bytes, blocks;
+  tag_sum(tag, &bytes, &blocks);
+  size_t max = __atomic_load_n(&limit->bytes, __ATOMIC_RELAXED);
+  if ((max == 0) || (bytes < (long long) max)){
+    __atomic_store_n(&limit->over, 0, __ATOMIC_RELAXED);
+    return;
+  }
+  if (__atomic_exchange_n(&limit->over, 1, __ATOMIC_RELAXED)){
+    return; // already reported
+  }
+  pthread_mutex_lock(&tag_mutex);
+  ts_tag_limit_callback callback = limit->callback;
+  void * arg = limit->arg;
+  limit->hits++;
+  pthread_mutex_unlock(&tag_mutex);
+  if (callback){
+    callback(tag, (size_t) bytes, max, arg);
+  }
+}
+
+
+/* Tags a block just allocated and counts it for the calling thread,
+ * checking the tag's soft limit when this thread's interval is used up. */
+void tag_block(block_node * block, unsigned tag){
+  long long bytes = BLOCK_SIZE(block) - META_DATA_SIZE;
+  block->size |= (size_t) tag << BLOCK_TAG_SHIFT;
+  tag_count(tag, bytes, 1);
+  size_t check_bytes = __atomic_load_n(&tag_limits[tag].check_bytes, __ATOMIC_RELAXED);
+  if (__builtin_expect(check_bytes != 0, 0)){
+    tag_local.unchecked[tag] += bytes;
+    if (tag_local.unchecked[tag] >= (long long) check_bytes){
+      tag_local.unchecked[tag] = 0;
+      tag_check(tag);
+    }
+  }
+}
+
+
+/* Credits a tagged block being free'd back to its tag (see TAG_FREE) */
+void tag_free(block_node * block){
+  unsigned tag = BLOCK_TAG(block);
+  block->size &= ~BLOCK_TAG_MASK;
+  tag_count(tag, -(long long)(BLOCK_SIZE(block) - META_DATA_SIZE), -1);
+}
+
+
+/* Tagged malloc: a block of the locking heap, counted against tag until it
+ * is free'd. */
+void * ts_malloc_tagged(size_t size, unsigned tag){
+  if (tag >= TS_NUM_TAGS){
+    fprintf(stderr, "Error: tag %u out of range\n", tag);
+    return NULL;
+  }
+  void * ptr = ts_malloc_lock(size);
+  if ((ptr == NULL) || (tag == 0)){
+    return ptr;
+  }
+  if (__builtin_expect(tags_used == 0, 0)){
+    __atomic_store_n(&tags_used, 1, __ATOMIC_RELAXED);
+  }
+  tag_block((block_node *)((char *)ptr - META_DATA_SIZE), tag);
+  return ptr;
+}
+
+
+/* Fills in the usage of tag, summed over every thread. */
+int ts_get_tag_stats(unsigned tag, ts_tag_stats * stats){
+  if ((tag == 0) || (tag >= TS_NUM_TAGS)){
+    fprintf(stderr, "Error: tag %u out of range\n", tag);
+    return -1;
+  }
+  tag_sum(tag, &stats->bytes, &stats->blocks);
+  pthread_mutex_lock(&tag_mutex);
+  stats->limit = tag_limits[tag].bytes;
+  stats->limit_hits = tag_limits[tag].hits;
+  pthread_mutex_unlock(&tag_mutex);
+  return 0;
+}
+
+
+/* Sets tag's soft limit and callback, 0 bytes removes the limit. */
+int ts_tag_set_limit(unsigned tag, size_t bytes, ts_tag_limit_callback callback, void * arg){
+  if ((tag == 0) || (tag >= TS_NUM_TAGS)){
+    fprintf(stderr, "Error: tag %u out of range\n", tag);
+    return -1;
+  }
+  size_t check_bytes = bytes / TAG_CHECK_FRACTION;
+  if (check_bytes > TAG_CHECK_MAX){
+    check_bytes = TAG_CHECK_MAX;
+  }
+  if ((bytes != 0) && (check_bytes == 0)){
+    check_bytes = 1; // tiny limits are checked on every allocation
+  }
+  tag_limit * limit = &tag_limits[tag];
+  pthread_mutex_lock(&tag_mutex);
+  limit->callback = callback;
+  limit->arg = arg;
+  __atomic_store_n(&limit->bytes, bytes, __ATOMIC_RELAXED);
+  __atomic_store_n(&limit->over, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&limit->check_bytes, check_bytes, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&tag_mutex);
+  return 0;
+}
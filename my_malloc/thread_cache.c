@@ -0,0 +1,147 @@
+#include "my_malloc.h"
+#include <stdio.h>
+
+/* Thread caches of small blocks, the slow paths of ts_fast.h.
+ *
+ * Each thread keeps a stack of blocks per size class in ts_tcache. The
+ * inline fast path in ts_fast.h pops and pushes these stacks directly when
+ * the size is a compile-time constant; everything else comes through here.
+ * Like the per-CPU caches, cached blocks are ordinary allocated blocks of
+ * the locking heap (whole class sized), so a block can be free'd by any
+ * thread, and they are handed back with ts_free_lock.
+ *
+ * A thread's limit stays 0 until its first miss, which registers the
+ * destructor that empties the cache when the thread exits. The inline push
+ * compares against the limit, so it never fills a cache that would leak. */
+
+/* Maximum number of blocks kept per size class in one thread cache */
+#define TCACHE_CLASS_LIMIT 64
+
+__thread ts_thread_cache ts_tcache;
+
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+
+
+/* Empties the exiting thread's cache, and keeps it from filling again in
+ * later destructors. */
+static void tcache_exit(void * arg){
+  (void) arg;
+  ts_thread_cache_flush();
+  ts_tcache.limit = 0;
+}
+
+
+static void tcache_setup(){
+  if (pthread_key_create(&tcache_key, tcache_exit) != 0){
+    fprintf(stderr, "Error: could not create the thread cache key\n");
+  }
+}
+
+
+/* Turns the calling thread's cache on, on its first miss. */
+static void tcache_init(){
+  pthread_once(&tcache_once, tcache_setup);
+  ts_tcache.limit = TCACHE_CLASS_LIMIT;
+  pthread_setspecific(tcache_key, &ts_tcache); // non-NULL, so tcache_exit runs
+}
+
+
+/* Pops a block of size class cls from the cache, otherwise allocates a
+ * whole class sized block from the locking heap. */
+void * ts_malloc_class(unsigned cls){
+  void * result = ts_tcache.bins[cls];
+  if (result){
+    ts_tcache.bins[cls] = *(void **) result;
+    ts_tcache.counts[cls]--;
+    PROFILE_MALLOC((block_node *)((char *) result - META_DATA_SIZE), CLASS_SIZE(cls));
+    return result;
+  }
+  if (__builtin_expect(ts_tcache.limit == 0, 0)){
+    tcache_init();
+  }
+  return ts_malloc_lock(CLASS_SIZE(cls));
+}
+
+
+/* Thread cached malloc with the size class worked out at runtime. */
+void * ts_malloc_cached(size_t size){
+  if (size > SMALL_SIZE_MAX){
+    return ts_malloc_lock(size);
+  }
+  return ts_malloc_class(SIZE_CLASS(size));
+}
+
+
+/* Pushes a block on the cache for size class cls, handing it back to the
+ * locking heap when the cache is full (or not turned on). */
+static void tcache_push(void * ptr, unsigned cls){
+  if (ts_tcache.counts[cls] < ts_tcache.limit){
+    *(void **) ptr = ts_tcache.bins[cls];
+    ts_tcache.bins[cls] = ptr;
+    ts_tcache.counts[cls]++;
+    return;
+  }
+  ts_free_lock(ptr);
+}
+
+
+/* Thread cached free. The size class is found from the block_node header. */
+void ts_free_cached(void * ptr){
+  if (ptr == NULL){
+    return;
+  }
+  if (page_map_lookup(ptr) == 0){
+    page_map_reject(ptr, "ts_free_cached");
+    return;
+  }
+  block_node * to_free = (block_node *)((char *)ptr - META_DATA_SIZE);
+  PROFILE_FREE(to_free);
+  TAG_FREE(to_free);
+  size_t payload = BLOCK_SIZE(to_free) - META_DATA_SIZE;
+  if ((to_free->size & BLOCK_MMAPPED) || (payload < SIZE_CLASS_GRANULE) || (payload > SMALL_SIZE_MAX)){
+    ts_free_lock(ptr);
+    return;
+  }
+  tcache_push(ptr, payload / SIZE_CLASS_GRANULE - 1); // largest class the block can serve
+}
+
+
+/* Thread cached sized free. The caller's size picks the size class, so the
+ * block_node header is only loaded while profiling samples are live or
+ * once tagged blocks are in use. */
+void ts_free_sized_cached(void * ptr, size_t size){
+  if (ptr == NULL){
+    return;
+  }
+  if (size > SMALL_SIZE_MAX){
+    ts_free_lock(ptr);
+    return;
+  }
+  if (page_map_lookup(ptr) == 0){
+    page_map_reject(ptr, "ts_free_sized_cached");
+    return;
+  }
+  if (__builtin_expect((profile_live | tags_used) != 0, 0)){
+    block_node * to_free = (block_node *)((char *)ptr - META_DATA_SIZE);
+    PROFILE_FREE(to_free);
+    TAG_FREE(to_free);
+  }
+  tcache_push(ptr, SIZE_CLASS(size));
+}
+
+
+/* Empties the calling thread's cache into the free list. */
+void ts_thread_cache_flush(){
+  unsigned cls;
+  for (cls = 0; cls < NUM_SIZE_CLASSES; cls++){
+    void * current = ts_tcache.bins[cls];
+    ts_tcache.bins[cls] = NULL;
+    ts_tcache.counts[cls] = 0;
+    while (current){
+      void * next = *(void **) current;
+      ts_free_lock(current);
+      current = next;
+    }
+  }
+}
@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "my_malloc.h"
+
+/* Checks that the adaptive ts_malloc/ts_free follow contention on list_lock.
+ *
+ *   quiet      a worker churns small objects alone: it must stay locked
+ *   contended  a hog thread holds list_lock almost all the time: the worker
+ *              must move to its private cache, and then keep going there
+ *   released   the hog stops: the worker must move back to the locking heap
+ *
+ * The hog holds the lock through ts_heap_walk, which keeps list_lock while
+ * its visitor sleeps. Reports the worker's throughput in each phase, and
+ * checks that every block is back on the free list at the end. */
+
+#define SLOTS       64
+#define QUIET_OPS   500000
+#define PHASE_LIMIT 20.0  // seconds to wait for a switch
+#define HOLD_US     1000
+
+double calc_time(struct timespec start, struct timespec end) {
+  double start_sec = (double)start.tv_sec*1000000000.0 + (double)start.tv_nsec;
+  double end_sec = (double)end.tv_sec*1000000000.0 + (double)end.tv_nsec;
+
+  if (end_sec < start_sec) {
+    return 0;
+  } else {
+    return end_sec - start_sec;
+  }
+};
+
+static volatile int hog_running = 1;
+
+
+/* Heap walk visitor that sleeps on the first block and stops the walk */
+int hold_lock(const heap_chunk *chunk, block_node *block, size_t size, block_state state, void *arg) {
+  usleep(HOLD_US);
+  return 1;
+}
+
+
+void *hog(void *arg) {
+  while (hog_running) {
+    ts_heap_walk(hold_lock, NULL);
+    usleep(1); // a short gap in which the worker gets the lock
+  }
+  return NULL;
+}
+
+
+/* Churns the worker's slots until mode is reached (or for ops calls if
+ * ops is non-zero). Returns calls per second, or 0 if the time ran out. */
+double churn(void **slots, ts_malloc_mode mode, unsigned long ops, unsigned long *done) {
+  struct timespec start_time, now;
+  unsigned long i = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  for (;;) {
+    unsigned s = (i * 2654435761UL) % SLOTS;
+    ts_free(slots[s]);
+    slots[s] = ts_malloc(16 + (i % 16) * 16);
+    i++;
+    if (ops ? (i >= ops) : (ts_get_malloc_mode() == mode)) {
+      break;
+    }
+    if ((i % 1024) == 0) {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      if (calc_time(start_time, now) / 1e9 > PHASE_LIMIT) {
+	*done = i;
+	return 0;
+      }
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  *done = i;
+  return 2.0 * i / (calc_time(start_time, now) / 1e9);
+}
+
+
+void *worker(void *arg) {
+  int *fail = arg;
+  void *slots[SLOTS] = {NULL};
+  unsigned long done;
+  pthread_t hog_thread;
+  ts_stats stats;
+  int i;
+
+  double quiet = churn(slots, TS_MODE_LOCKED, QUIET_OPS, &done);
+  ts_get_stats(&stats);
+  printf("quiet:     %12.0f calls/s, mode = %s\n", quiet,
+	 ts_get_malloc_mode() == TS_MODE_PRIVATE ? "private" : "locked");
+  *fail |= (ts_get_malloc_mode() != TS_MODE_LOCKED) || stats.adaptive_to_private;
+
+  pthread_create(&hog_thread, NULL, hog, NULL);
+  double locked = churn(slots, TS_MODE_PRIVATE, 0, &done);
+  printf("contended: %12.0f calls/s until private (%lu calls)\n", locked, done);
+  *fail |= (locked == 0);
+  double private = churn(slots, TS_MODE_PRIVATE, QUIET_OPS, &done);
+  printf("contended: %12.0f calls/s in private mode, mode = %s\n", private,
+	 ts_get_malloc_mode() == TS_MODE_PRIVATE ? "private" : "locked");
+  *fail |= (ts_get_malloc_mode() != TS_MODE_PRIVATE);
+  hog_running = 0;
+  pthread_join(hog_thread, NULL);
+
+  double released = churn(slots, TS_MODE_LOCKED, 0, &done);
+  printf("released:  %12.0f calls/s until locked (%lu calls)\n", released, done);
+  *fail |= (released == 0);
+  for (i=0; i < SLOTS; i++) {
+    ts_free(slots[i]);
+  }
+  return NULL;
+}
+
+
+int main(int argc, char *argv[])
+{
+  pthread_t thread;
+  int fail = 0;
+  ts_stats stats;
+
+  pthread_create(&thread, NULL, worker, &fail);
+  pthread_join(thread, NULL);
+  ts_get_stats(&stats);
+  printf("Mode switches: %lu to private, %lu to locked, %lu threads private\n",
+	 stats.adaptive_to_private, stats.adaptive_to_locked, stats.adaptive_private_threads);
+  printf("Free = %lu of heap = %lu\n", stats.free_bytes, stats.heap_bytes);
+  fail |= (stats.adaptive_to_private == 0) || (stats.adaptive_to_locked == 0) ||
+    stats.adaptive_private_threads || (stats.free_bytes != stats.heap_bytes);
+  printf(fail ? "Test failed\n" : "Test passed\n");
+  return fail;
+}
@@ -0,0 +1,15 @@
+#!/bin/bash
+# Builds the allocator stress benchmarks (Larson, producer-consumer, 
+# threadtest and cache-scratch) for the locking and non-locking versions
+# and runs each once.
+for version in LOCK_VERSION NOLOCK_VERSION
+do
+    rm -f larson prodcons threadtest cache_scratch
+    make -s MALLOC_VERSION=$version larson prodcons threadtest cache_scratch > /dev/null
+    for bench in larson prodcons threadtest cache_scratch
+    do
+	echo ==================================================
+	./$bench
+    done
+done
+echo ==================================================
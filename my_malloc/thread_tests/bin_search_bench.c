@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <stdint.h>
+#include "my_malloc.h"
+
+/* Compares the old best fit walk, which chases next pointers through the
+ * heap, with the vectorized search over a dense array of packed sizes that 
+ * the free list bins now use. Free blocks are spread over a large region and
+ * linked in random order, as they are in a fragmented heap. */
+
+#define BLOCK_STRIDE 128
+#define NUM_SEARCHES 200
+
+double calc_time(struct timespec start, struct timespec end) {
+  double start_sec = (double)start.tv_sec*1000000000.0 + (double)start.tv_nsec;
+  double end_sec = (double)end.tv_sec*1000000000.0 + (double)end.tv_nsec;
+
+  if (end_sec < start_sec) {
+    return 0;
+  } else {
+    return end_sec - start_sec;
+  }
+};
+
+
+/* The pointer chasing best fit search that try_block_reuse_bf used to do */
+block_node *walk_best_fit(block_node *head, size_t size) {
+  size_t smallest_diff = SIZE_MAX;
+  block_node *result = NULL;
+  block_node *current = head;
+  while (current) {
+    if ((current->size >= size) && (current->size - size < smallest_diff)) {
+      smallest_diff = current->size - size;
+      result = current;
+    }
+    current = current->next;
+  }
+  return result;
+}
+
+
+int main(int argc, char *argv[])
+{
+  const size_t counts[] = {10000, 100000, 1000000};
+  int c, i;
+  struct timespec start_time, end_time;
+  size_t requests[NUM_SEARCHES];
+  volatile size_t sink = 0;
+
+  srand(0);
+  for (i=0; i < NUM_SEARCHES; i++) {
+    requests[i] = (rand() % 4096) + 32;
+  }
+
+  printf("%10s %14s %14s %14s %14s\n", "blocks", "walk ns", "scalar ns", "sse2 ns", "avx2 ns");
+  for (c=0; c < 3; c++) {
+    size_t n = counts[c];
+    char *region = malloc(n * BLOCK_STRIDE);
+    size_t *order = malloc(n * sizeof(size_t));
+    uint32_t *sizes = malloc(n * sizeof(uint32_t));
+    size_t k;
+    if (!region || !order || !sizes) {
+      fprintf(stderr, "Out of memory for %zu blocks\n", n);
+      return EXIT_FAILURE;
+    }
+
+    //Shuffle the link order so every step of the walk lands somewhere new
+    for (k=0; k < n; k++) order[k] = k;
+    for (k=n-1; k > 0; k--) {
+      size_t j = (size_t)rand() % (k + 1);
+      size_t tmp = order[k]; order[k] = order[j]; order[j] = tmp;
+    }
+    block_node *head = NULL;
+    for (k=0; k < n; k++) {
+      block_node *node = (block_node *)(region + order[k] * BLOCK_STRIDE);
+      node->size = (rand() % 8192) + 32;
+      node->next = head;
+      head = node;
+    }
+    k = 0;
+    for (block_node *node = head; node; node = node->next) {
+      sizes[k++] = (uint32_t)node->size;
+    }
+
+    double results[4];
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    for (i=0; i < NUM_SEARCHES; i++) sink += (size_t)walk_best_fit(head, requests[i]);
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    results[0] = calc_time(start_time, end_time) / NUM_SEARCHES;
+
+    size_t (*kernels[3])(const uint32_t *, size_t, uint32_t) = 
+      {bin_min_fit_scalar, bin_min_fit_sse2, bin_min_fit_avx2};
+    for (int kern=0; kern < 3; kern++) {
+      if ((kern == 2) && !__builtin_cpu_supports("avx2")) {
+	results[3] = 0;
+	continue;
+      }
+      clock_gettime(CLOCK_MONOTONIC, &start_time);
+      for (i=0; i < NUM_SEARCHES; i++) sink += kernels[kern](sizes, n, (uint32_t)requests[i]);
+      clock_gettime(CLOCK_MONOTONIC, &end_time);
+      results[kern + 1] = calc_time(start_time, end_time) / NUM_SEARCHES;
+    }
+
+    printf("%10zu %14.0f %14.0f %14.0f %14.0f\n", n, results[0], results[1], results[2], results[3]);
+    free(region);
+    free(order);
+    free(sizes);
+  }
+  return 0;
+}
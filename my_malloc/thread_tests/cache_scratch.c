@@ -0,0 +1,107 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "my_malloc.h"
+
+#ifdef LOCK_VERSION
+#define MALLOC(sz) ts_malloc_lock(sz)
+#define FREE(p)    ts_free_lock(p)
+#define VERSION_NAME "lock"
+#endif
+#ifdef NOLOCK_VERSION
+#define MALLOC(sz) ts_malloc_nolock(sz)
+#define FREE(p)    ts_free_nolock(p)
+#define VERSION_NAME "nolock"
+#endif
+#ifdef PERCPU_VERSION
+#define MALLOC(sz) ts_malloc_percpu(sz)
+#define FREE(p)    ts_free_percpu(p)
+#define VERSION_NAME "percpu"
+#endif
+#ifdef ADAPTIVE_VERSION
+#define MALLOC(sz) ts_malloc(sz)
+#define FREE(p)    ts_free(p)
+#define VERSION_NAME "adaptive"
+#endif
+
+/* Hoard's cache-scratch: the main thread allocates one small object per 
+ * thread, back to back, and hands them out. Each thread frees its object,
+ * then repeatedly allocates an object of the same size and writes to it.
+ * An allocator that gives the free'd objects back to other threads makes
+ * them write to the same cache lines (passively induced false sharing), 
+ * which shows up as a much longer run time. */
+
+#define NUM_THREADS  4
+#define ITERATIONS   1000
+#define REPETITIONS  10000
+#define OBJECT_SIZE  8
+
+double calc_time(struct timespec start, struct timespec end) {
+  double start_sec = (double)start.tv_sec*1000000000.0 + (double)start.tv_nsec;
+  double end_sec = (double)end.tv_sec*1000000000.0 + (double)end.tv_nsec;
+
+  if (end_sec < start_sec) {
+    return 0;
+  } else {
+    return end_sec - start_sec;
+  }
+};
+
+pthread_t threads[NUM_THREADS];
+char     *initial[NUM_THREADS];
+int       shared_lines = 0;
+
+
+void *scratch(void *arg) {
+  int id = (int)(long) arg;
+  int i, j, k;
+  FREE(initial[id]);
+  for (i=0; i < ITERATIONS; i++) {
+    volatile char *object = MALLOC(OBJECT_SIZE);
+    for (j=0; j < REPETITIONS; j++) {
+      for (k=0; k < OBJECT_SIZE; k++) {
+	object[k] = (char)(object[k] + 1);
+      }
+    }
+    FREE((void *) object);
+  }
+  return NULL;
+}
+
+
+int main(int argc, char *argv[])
+{
+  struct timespec start_time, end_time;
+  int i, j;
+
+  for (i=0; i < NUM_THREADS; i++) {
+    initial[i] = MALLOC(OBJECT_SIZE);
+  }
+  for (i=0; i < NUM_THREADS; i++) { // how many of them share a 64 byte line
+    for (j=0; j < i; j++) {
+      if (((unsigned long) initial[i] >> 6) == ((unsigned long) initial[j] >> 6)) {
+	shared_lines++;
+	break;
+      }
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  for (i=0; i < NUM_THREADS; i++) {
+    pthread_create(&threads[i], NULL, scratch, (void *)(long) i);
+  }
+  for (i=0; i < NUM_THREADS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end_time);
+
+  double elapsed_ns = calc_time(start_time, end_time);
+  printf("Benchmark = cache-scratch, Version = %s\n", VERSION_NAME);
+  printf("Initial Objects Sharing A Cache Line = %d of %d\n", shared_lines, NUM_THREADS);
+  printf("Execution Time = %f seconds\n", elapsed_ns / 1e9);
+  printf("Throughput = %f ops/second\n", 2.0 * NUM_THREADS * ITERATIONS / (elapsed_ns / 1e9));
+  printf("Test passed\n");
+  return 0;
+}
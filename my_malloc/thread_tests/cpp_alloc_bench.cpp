@@ -0,0 +1,165 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <memory_resource>
+#include "ts_allocator.hpp"
+
+/* Compares container churn with the default allocator against ts::allocator
+ * and against pmr containers on a ts::region_resource. Built a second time
+ * with TS_MALLOC_REPLACE_NEW (cpp_alloc_bench_new), where the default 
+ * allocator's operator new is libmymalloc too. Deferred coalescing is on,
+ * since node containers would otherwise spend most of their time on the
+ * sorted free list insert of every free; pass "eager" to turn it off. */
+
+#define ROUNDS     20
+#define NUM_KEYS   20000
+
+double calc_time(struct timespec start, struct timespec end) {
+  double start_sec = (double)start.tv_sec*1000000000.0 + (double)start.tv_nsec;
+  double end_sec = (double)end.tv_sec*1000000000.0 + (double)end.tv_nsec;
+
+  if (end_sec < start_sec) {
+    return 0;
+  } else {
+    return end_sec - start_sec;
+  }
+};
+
+/* Keeps the optimizer from dropping the work */
+volatile unsigned long sink;
+
+
+/* Grows vectors of assorted lengths and drops them */
+template <class Vector>
+void vector_churn() {
+  for (int r = 0; r < ROUNDS; r++) {
+    for (int i = 1; i <= 200; i++) {
+      Vector v;
+      for (int j = 0; j < i * 10; j++) {
+	v.push_back(j);
+      }
+      sink += v.size();
+    }
+  }
+}
+
+
+/* Inserts keys, erases every other one, re-inserts them */
+template <class Map>
+void map_churn() {
+  for (int r = 0; r < ROUNDS; r++) {
+    Map m;
+    for (int i = 0; i < NUM_KEYS; i++) {
+      m[(i * 7919) % NUM_KEYS] = i;
+    }
+    for (int i = 0; i < NUM_KEYS; i += 2) {
+      m.erase(i);
+    }
+    for (int i = 0; i < NUM_KEYS; i += 2) {
+      m[i] = i;
+    }
+    sink += m.size();
+  }
+}
+
+
+template <class F>
+void run(const char *name, F f) {
+  struct timespec start_time, end_time;
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  f();
+  clock_gettime(CLOCK_MONOTONIC, &end_time);
+  printf("%-40s %10.3f ms\n", name, calc_time(start_time, end_time) / 1e6);
+}
+
+
+int main(int argc, char *argv[]) {
+  typedef std::pair<const int, int> kv;
+#ifdef TS_MALLOC_REPLACE_NEW
+  const char *std_name = "(operator new = libmymalloc)";
+#else
+  const char *std_name = "(operator new = default)";
+#endif
+  int deferred = (argc < 2) || (strcmp(argv[1], "eager") != 0);
+  if (deferred) {
+    ts_set_deferred_coalescing(1); // small frees skip the sorted free list insert
+  }
+  printf("std::allocator %s, %s coalescing\n", std_name, deferred ? "deferred" : "eager");
+
+  run("vector        std::allocator", [] { vector_churn<std::vector<int>>(); });
+  run("vector        ts::allocator", [] { vector_churn<std::vector<int, ts::allocator<int>>>(); });
+  run("vector        pmr region", [] {
+      for (int r = 0; r < ROUNDS; r++) {
+	ts::region_resource region;
+	std::pmr::polymorphic_allocator<int> alloc(&region);
+	for (int i = 1; i <= 200; i++) {
+	  std::pmr::vector<int> v(alloc);
+	  for (int j = 0; j < i * 10; j++) v.push_back(j);
+	  sink += v.size();
+	}
+      }
+    });
+
+  run("map           std::allocator", [] { map_churn<std::map<int, int>>(); });
+  run("map           ts::allocator", [] { map_churn<std::map<int, int, std::less<int>, ts::allocator<kv>>>(); });
+  run("map           pmr region", [] {
+      for (int r = 0; r < ROUNDS; r++) {
+	ts::region_resource region;
+	std::pmr::polymorphic_allocator<kv> alloc(&region);
+	std::pmr::map<int, int> m(alloc);
+	for (int i = 0; i < NUM_KEYS; i++) m[(i * 7919) % NUM_KEYS] = i;
+	for (int i = 0; i < NUM_KEYS; i += 2) m.erase(i);
+	for (int i = 0; i < NUM_KEYS; i += 2) m[i] = i;
+	sink += m.size();
+      }
+    });
+
+  run("unordered_map std::allocator", [] { map_churn<std::unordered_map<int, int>>(); });
+  run("unordered_map ts::allocator", [] {
+      map_churn<std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, ts::allocator<kv>>>();
+    });
+  run("unordered_map pmr region", [] {
+      for (int r = 0; r < ROUNDS; r++) {
+	ts::region_resource region;
+	std::pmr::polymorphic_allocator<kv> alloc(&region);
+	std::pmr::unordered_map<int, int> m(alloc);
+	for (int i = 0; i < NUM_KEYS; i++) m[(i * 7919) % NUM_KEYS] = i;
+	for (int i = 0; i < NUM_KEYS; i += 2) m.erase(i);
+	for (int i = 0; i < NUM_KEYS; i += 2) m[i] = i;
+	sink += m.size();
+      }
+    });
+
+  // aligned and sized forms
+  struct alignas(64) line { char bytes[64]; };
+  std::vector<line, ts::allocator<line>> lines(100);
+  line *one = new line;
+  int fail = ((reinterpret_cast<std::uintptr_t>(lines.data()) % 64) != 0) ||
+    ((reinterpret_cast<std::uintptr_t>(one) % 64) != 0);
+  delete one;
+  // plain new and ts::allocator keep __STDCPP_DEFAULT_NEW_ALIGNMENT__
+  std::vector<long double, ts::allocator<long double>> wide(3);
+  fail |= (reinterpret_cast<std::uintptr_t>(wide.data()) % __STDCPP_DEFAULT_NEW_ALIGNMENT__) != 0;
+  for (int i = 0; i < 200; i++) {
+    char *bytes = new char[1 + i * 8];
+    std::string *str = new std::string("x");
+    fail |= ((reinterpret_cast<std::uintptr_t>(bytes) | reinterpret_cast<std::uintptr_t>(str)) %
+	     __STDCPP_DEFAULT_NEW_ALIGNMENT__) != 0;
+    delete[] bytes;
+    delete str;
+  }
+  // the aligning pad cannot overflow a region request
+  ts::region_resource region;
+  try {
+    sink += reinterpret_cast<std::uintptr_t>(region.allocate(SIZE_MAX - 8, 64));
+    fail = 1;
+  } catch (const std::bad_alloc &) {
+  }
+  printf(fail ? "Test failed\n" : "Test passed\n");
+  return fail;
+}
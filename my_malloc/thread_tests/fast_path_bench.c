@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "ts_fast.h"
+
+/* Compares the inline constant-size fast path (ts_fast.h) with the library
+ * calls behind it, for 64 byte objects:
+ *
+ *   inline    ts_malloc_fast(64) / ts_free_sized_fast(p, 64)
+ *   cached    ts_malloc_cached / ts_free_sized_cached with a runtime size
+ *   percpu    ts_malloc_percpu / ts_free_sized_percpu
+ *   lock      ts_malloc_lock / ts_free_sized_lock
+ *
+ * each as malloc/free pairs and as batches of BATCH mallocs then BATCH
+ * frees. Then NUM_THREADS threads churn their caches and exit, and every
+ * block must be back on the free list once the main thread's cache and the
+ * per-CPU caches are flushed, which checks the thread exit destructor. */
+
+#define OBJECT_BYTES 64
+#define BATCH        32
+#define PAIR_OPS     10000000
+#define BATCH_ROUNDS 300000
+#define NUM_THREADS  4
+
+/* Keeps the compiler from eliding an allocation or merging it with its free */
+#define ESCAPE(p) __asm__ volatile("" : : "r"(p) : "memory")
+
+double calc_time(struct timespec start, struct timespec end) {
+  double start_sec = (double)start.tv_sec*1000000000.0 + (double)start.tv_nsec;
+  double end_sec = (double)end.tv_sec*1000000000.0 + (double)end.tv_nsec;
+
+  if (end_sec < start_sec) {
+    return 0;
+  } else {
+    return end_sec - start_sec;
+  }
+};
+
+static volatile size_t runtime_size = OBJECT_BYTES;
+
+enum {INLINE, CACHED, PERCPU, LOCK, NUM_VARIANTS};
+static const char *variant_names[] = {"inline", "cached", "percpu", "lock"};
+
+
+/* One malloc/free pair per round, returns ns per pair */
+double bench_pairs(int variant) {
+  struct timespec start_time, end_time;
+  size_t size = runtime_size;
+  long i;
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  for (i=0; i < PAIR_OPS; i++) {
+    void *p;
+    switch (variant) {
+    case INLINE:
+      p = ts_malloc_fast(OBJECT_BYTES);
+      ESCAPE(p);
+      ts_free_sized_fast(p, OBJECT_BYTES);
+      break;
+    case CACHED:
+      p = ts_malloc_cached(size);
+      ESCAPE(p);
+      ts_free_sized_cached(p, size);
+      break;
+    case PERCPU:
+      p = ts_malloc_percpu(size);
+      ESCAPE(p);
+      ts_free_sized_percpu(p, size);
+      break;
+    default:
+      p = ts_malloc_lock(size);
+      ESCAPE(p);
+      ts_free_sized_lock(p, size);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end_time);
+  return calc_time(start_time, end_time) / PAIR_OPS;
+}
+
+
+/* BATCH mallocs then BATCH frees per round, returns ns per malloc/free */
+double bench_batches(int variant, long rounds) {
+  struct timespec start_time, end_time;
+  void *objs[BATCH];
+  size_t size = runtime_size;
+  long r;
+  int i;
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  for (r=0; r < rounds; r++) {
+    for (i=0; i < BATCH; i++) {
+      switch (variant) {
+      case INLINE: objs[i] = ts_malloc_fast(OBJECT_BYTES); break;
+      case CACHED: objs[i] = ts_malloc_cached(size); break;
+      case PERCPU: objs[i] = ts_malloc_percpu(size); break;
+      default: objs[i] = ts_malloc_lock(size);
+      }
+      *(long *) objs[i] = r;
+    }
+    ESCAPE(objs);
+    for (i=0; i < BATCH; i++) {
+      switch (variant) {
+      case INLINE: ts_free_sized_fast(objs[i], OBJECT_BYTES); break;
+      case CACHED: ts_free_sized_cached(objs[i], size); break;
+      case PERCPU: ts_free_sized_percpu(objs[i], size); break;
+      default: ts_free_sized_lock(objs[i], size);
+      }
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end_time);
+  return calc_time(start_time, end_time) / (rounds * BATCH);
+}
+
+
+void *churn(void *arg) {
+  bench_batches(INLINE, BATCH_ROUNDS / 10);
+  bench_batches(CACHED, BATCH_ROUNDS / 10);
+  // leave blocks of a few classes in the cache for the destructor
+  void *p = ts_malloc_fast(24);
+  void *q = ts_malloc_cached(300);
+  ts_free_sized_fast(p, 24);
+  ts_free_fast(q);
+  return NULL;
+}
+
+
+int main(int argc, char *argv[])
+{
+  pthread_t threads[NUM_THREADS];
+  int variant, i;
+
+  printf("%-8s %14s %14s\n", "path", "pair (ns)", "batch (ns/op)");
+  for (variant=0; variant < NUM_VARIANTS; variant++) {
+    double pair_ns = bench_pairs(variant);
+    double batch_ns = bench_batches(variant, BATCH_ROUNDS);
+    printf("%-8s %14.2f %14.2f\n", variant_names[variant], pair_ns, batch_ns);
+  }
+
+  for (i=0; i < NUM_THREADS; i++) {
+    pthread_create(&threads[i], NULL, churn, NULL);
+  }
+  for (i=0; i < NUM_THREADS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  ts_thread_cache_flush();
+  ts_percpu_flush();
+  ts_stats stats;
+  ts_get_stats(&stats);
+  unsigned long free_space = get_data_segment_free_space_size();
+  printf("After the threads exit: free = %lu of heap = %lu\n", free_space, stats.heap_bytes);
+  int fail = free_space != stats.heap_bytes;
+  printf(fail ? "Test failed\n" : "Test passed\n");
+  return fail;
+}
@@ -0,0 +1,180 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include "my_malloc.h"
+
+/* Checks the heap walker and exports one heap map per placement policy.
+ *
+ * Each policy runs in its own process on the same fragmenting workload:
+ * small and medium objects are allocated, a random half is freed, and
+ * objects of other sizes are allocated into the holes. The walk must agree
+ * with the allocator's own accounting (heap bytes, free bytes and the number
+ * of live objects) before the map is written to
+ * <dir>/heap_map_<policy>.csv (dir defaults to /tmp). Compare the maps with
+ *
+ *   ./heap_map_view /tmp/heap_map_*.csv
+ *
+ * A last process walks the heap over and over while other threads grow it,
+ * and every walk must succeed. */
+
+#define NUM_OBJECTS 20000
+#define NUM_ROUNDS  4
+#define NUM_GROWERS 4
+#define GROW_OBJECTS 5000
+#define NUM_WALKS   200
+
+static const char *policy_names[] = {"best_fit", "first_fit", "next_fit", "good_fit"};
+
+typedef struct walk_count_t{
+  unsigned long long bytes, allocated, free;
+  unsigned long allocated_blocks;
+} walk_count;
+
+
+/* Heap walk visitor counting blocks by state */
+int count_block(const heap_chunk *chunk, block_node *block, size_t size, block_state state, void *arg) {
+  walk_count *count = arg;
+  count->bytes += size;
+  if (state == BLOCK_ALLOCATED) {
+    count->allocated += size;
+    count->allocated_blocks++;
+  } else {
+    count->free += size;
+  }
+  return 0;
+}
+
+
+/* Size of the i-th object of a round */
+size_t object_size(unsigned round, size_t i) {
+  return round % 2 ? 16 + (i * 7919) % 2048 : 32 + (i * 104729) % 256;
+}
+
+
+int run_policy(placement_policy policy, const char *dir) {
+  void **objs = calloc(NUM_OBJECTS, sizeof(void *));
+  unsigned long live = 0;
+  unsigned round;
+  size_t i;
+  char path[512];
+
+  ts_set_placement_policy(policy, 4, 10);
+  srand(42);
+  for (round=0; round < NUM_ROUNDS; round++) {
+    for (i=0; i < NUM_OBJECTS; i++) {
+      if (objs[i] == NULL) {
+	objs[i] = ts_malloc_lock(object_size(round, i));
+	live++;
+      }
+    }
+    for (i=0; i < NUM_OBJECTS; i++) {
+      if (rand() % 2) {
+	ts_free_lock(objs[i]);
+	objs[i] = NULL;
+	live--;
+      }
+    }
+  }
+
+  walk_count count;
+  ts_stats stats;
+  memset(&count, 0, sizeof(count));
+  int fail = ts_heap_walk(count_block, &count) != 0;
+  ts_get_stats(&stats);
+  unsigned long free_space = get_data_segment_free_space_size();
+  printf("%-10s heap = %llu (stats %lu), free = %llu (list %lu), live objects = %lu (walk %lu)\n",
+	 policy_names[policy], count.bytes, stats.heap_bytes, count.free, free_space,
+	 live, count.allocated_blocks);
+  if ((count.bytes != stats.heap_bytes) || (count.free != free_space) || (count.allocated_blocks != live)) {
+    fail = 1;
+  }
+
+  snprintf(path, sizeof(path), "%s/heap_map_%s.csv", dir, policy_names[policy]);
+  if (ts_heap_map_export(path) != 0) {
+    fail = 1;
+  }
+  FILE *in = fopen(path, "r");
+  char line[512];
+  unsigned long long total_bytes = 0;
+  while (in && fgets(line, sizeof(line), in)) {
+    sscanf(line, "total,%llu", &total_bytes);
+  }
+  if (in) {
+    fclose(in);
+  }
+  if (total_bytes != count.bytes) {
+    fail = 1;
+  }
+  free(objs);
+  fflush(stdout); // the process ends with _exit
+  return fail;
+}
+
+
+/* Grows the heap with objects that are never free'd */
+void *grower(void *arg) {
+  int i;
+  for (i=0; i < GROW_OBJECTS; i++) {
+    ts_malloc_lock(4000 + i * 8);
+  }
+  return NULL;
+}
+
+
+/* Walks the heap while NUM_GROWERS threads grow it */
+int run_concurrent_walk() {
+  pthread_t threads[NUM_GROWERS];
+  walk_count count;
+  int fail = 0;
+  int i, walks = 0;
+
+  ts_free_lock(ts_malloc_lock(16)); // the first allocation sets up the heap
+  for (i=0; i < NUM_GROWERS; i++) {
+    pthread_create(&threads[i], NULL, grower, NULL);
+  }
+  for (walks=0; walks < NUM_WALKS; walks++) {
+    memset(&count, 0, sizeof(count));
+    if (ts_heap_walk(count_block, &count) != 0) {
+      fail = 1;
+      break;
+    }
+  }
+  for (i=0; i < NUM_GROWERS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  printf("concurrent %d walks while %d threads grew the heap%s\n", walks, NUM_GROWERS,
+	 fail ? ", a walk failed" : "");
+  fflush(stdout);
+  return fail;
+}
+
+
+int main(int argc, char *argv[])
+{
+  const char *dir = argc > 1 ? argv[1] : "/tmp";
+  int fail = 0;
+  int policy;
+
+  for (policy=POLICY_BEST_FIT; policy <= POLICY_GOOD_FIT; policy++) {
+    int status;
+    pid_t pid = fork();
+    if (pid == 0) {
+      _exit(run_policy(policy, dir));
+    }
+    waitpid(pid, &status, 0);
+    fail |= !WIFEXITED(status) || WEXITSTATUS(status);
+  }
+  int status;
+  pid_t pid = fork();
+  if (pid == 0) {
+    _exit(run_concurrent_walk());
+  }
+  waitpid(pid, &status, 0);
+  fail |= !WIFEXITED(status) || WEXITSTATUS(status);
+  printf("Heap maps written to %s/heap_map_*.csv\n", dir);
+  printf(fail ? "Test failed\n" : "Test passed\n");
+  return fail;
+}
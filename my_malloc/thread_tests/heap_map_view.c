@@ -0,0 +1,223 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Renders heap maps written by ts_heap_map_export as occupancy summaries.
+ *
+ *   heap_map_view map.csv [more.csv ...]
+ *
+ * For each map it prints the totals, a histogram of free run sizes and one
+ * occupancy row per chunk, each column showing how much of its share of the
+ * chunk is allocated:
+ *
+ *   '#' >= 7/8   '+' >= 1/2   '-' >= 1/8   '.' > 0   ' ' none
+ *
+ * Given several maps (e.g. one per placement policy) it ends with a table
+ * comparing them. */
+
+#define COLUMNS     64
+#define MAX_CHUNKS  4096
+#define SHOW_CHUNKS 16
+#define MAX_HIST    48
+
+typedef struct chunk_row_t{
+  unsigned long long bytes, allocated, free, cached, largest_free;
+  unsigned long blocks, free_blocks;
+  unsigned long long column_allocated[COLUMNS];
+  unsigned long long column_bytes[COLUMNS];
+} chunk_row;
+
+typedef struct map_summary_t{
+  const char *name;
+  unsigned long long bytes, allocated, free, cached, largest_free;
+  unsigned long blocks, free_blocks, free_runs;
+} map_summary;
+
+typedef struct slice_line_t{
+  long chunk;
+  unsigned long long index, allocated, free, cached;
+} slice_line;
+
+
+/* Prints a byte count with a binary unit */
+void print_bytes(unsigned long long bytes) {
+  const char *units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+  double value = bytes;
+  int u = 0;
+  while ((value >= 1024) && (u < 4)) {
+    value /= 1024;
+    u++;
+  }
+  printf(u ? "%.1f %s" : "%.0f %s", value, units[u]);
+}
+
+
+/* Occupancy character of an allocated fraction */
+char occupancy(unsigned long long allocated, unsigned long long bytes) {
+  if ((bytes == 0) || (allocated == 0)) {
+    return ' ';
+  }
+  double f = (double) allocated / bytes;
+  return f >= 0.875 ? '#' : f >= 0.5 ? '+' : f >= 0.125 ? '-' : '.';
+}
+
+
+/* Reads and renders one map, filling in its summary. Returns -1 if the file
+ * cannot be read. */
+int view_map(const char *path, map_summary *summary, size_t slice_bytes_default) {
+  FILE *in = fopen(path, "r");
+  char line[512];
+  static chunk_row rows[MAX_CHUNKS];
+  unsigned long long run_count[MAX_HIST] = {0}, run_bytes[MAX_HIST] = {0};
+  slice_line *slices = NULL;
+  size_t num_slices = 0, slice_capacity = 0;
+  size_t slice_bytes = slice_bytes_default;
+  long num_chunks = 0;
+  long c;
+  size_t i;
+
+  if (in == NULL) {
+    fprintf(stderr, "Cannot read %s\n", path);
+    return -1;
+  }
+  memset(rows, 0, sizeof(rows));
+  memset(summary, 0, sizeof(*summary));
+  summary->name = path;
+  while (fgets(line, sizeof(line), in)) {
+    if (sscanf(line, "# ts_malloc heap map, slices of %zu bytes", &slice_bytes) == 1) {
+      continue;
+    }
+    if (strncmp(line, "slice,", 6) == 0) {
+      if (num_slices == slice_capacity) {
+	slice_capacity = slice_capacity ? slice_capacity * 2 : 1024;
+	slices = realloc(slices, slice_capacity * sizeof(slice_line));
+      }
+      slice_line *s = &slices[num_slices];
+      if (sscanf(line, "slice,%ld,%llu,%llu,%llu,%llu", &s->chunk, &s->index, &s->allocated, &s->free, &s->cached) == 5) {
+	num_slices++;
+      }
+    } else if (strncmp(line, "chunk,", 6) == 0) {
+      chunk_row r;
+      void *base;
+      memset(&r, 0, sizeof(r));
+      if ((sscanf(line, "chunk,%ld,%p,%llu,%llu,%llu,%llu,%lu,%lu,%llu", &c, &base, &r.bytes, &r.allocated,
+		  &r.free, &r.cached, &r.blocks, &r.free_blocks, &r.largest_free) == 9) && (c >= 0) && (c < MAX_CHUNKS)) {
+	rows[c] = r;
+	if (c >= num_chunks) {
+	  num_chunks = c + 1;
+	}
+      }
+    } else if (strncmp(line, "hist,free_run,", 14) == 0) {
+      unsigned long long lower, count, bytes;
+      if (sscanf(line, "hist,free_run,%llu,%llu,%llu", &lower, &count, &bytes) == 3) {
+	int k = lower ? 63 - __builtin_clzll(lower) : 0;
+	if (k < MAX_HIST) {
+	  run_count[k] = count;
+	  run_bytes[k] = bytes;
+	}
+      }
+    } else if (strncmp(line, "total,", 6) == 0) {
+      sscanf(line, "total,%llu,%llu,%llu,%llu,%lu,%lu,%llu,%lu", &summary->bytes, &summary->allocated,
+	     &summary->free, &summary->cached, &summary->blocks, &summary->free_blocks,
+	     &summary->largest_free, &summary->free_runs);
+    }
+  }
+  fclose(in);
+
+  // spread the slices over the columns of their chunk's row
+  for (i=0; i < num_slices; i++) {
+    slice_line *s = &slices[i];
+    if ((s->chunk < 0) || (s->chunk >= num_chunks) || (rows[s->chunk].bytes == 0)) {
+      continue;
+    }
+    chunk_row *r = &rows[s->chunk];
+    unsigned long long col = s->index * slice_bytes * COLUMNS / r->bytes;
+    if (col >= COLUMNS) {
+      col = COLUMNS - 1;
+    }
+    r->column_allocated[col] += s->allocated;
+    r->column_bytes[col] += s->allocated + s->free + s->cached;
+  }
+  free(slices);
+
+  unsigned long long free_total = summary->free + summary->cached;
+  printf("== %s\n", path);
+  printf("heap "); print_bytes(summary->bytes);
+  printf(" in %lu blocks: allocated %.1f%%, free %.1f%% (cached %.1f%%)\n", summary->blocks,
+	 summary->bytes ? 100.0 * summary->allocated / summary->bytes : 0,
+	 summary->bytes ? 100.0 * free_total / summary->bytes : 0,
+	 summary->bytes ? 100.0 * summary->cached / summary->bytes : 0);
+  printf("%lu free blocks in %lu runs, largest run ", summary->free_blocks, summary->free_runs);
+  print_bytes(summary->largest_free);
+  printf(", external fragmentation %.1f%%\n",
+	 free_total ? 100.0 * (1.0 - (double) summary->largest_free / free_total) : 0);
+
+  unsigned long long max_bytes = 0;
+  int k;
+  for (k=0; k < MAX_HIST; k++) {
+    if (run_bytes[k] > max_bytes) {
+      max_bytes = run_bytes[k];
+    }
+  }
+  if (max_bytes) {
+    printf("free runs by size (bar = bytes):\n");
+  }
+  for (k=0; k < MAX_HIST; k++) {
+    if (run_count[k] == 0) {
+      continue;
+    }
+    char bar[41];
+    int len = (int)(40.0 * run_bytes[k] / max_bytes);
+    memset(bar, '*', len);
+    bar[len] = '\0';
+    printf("  >= %12llu: %8llu runs %-40s ", 1ULL << k, run_count[k], bar);
+    print_bytes(run_bytes[k]);
+    printf("\n");
+  }
+  for (c=0; (c < num_chunks) && (c < SHOW_CHUNKS); c++) {
+    chunk_row *r = &rows[c];
+    char cols[COLUMNS + 1];
+    for (i=0; i < COLUMNS; i++) {
+      cols[i] = occupancy(r->column_allocated[i], r->column_bytes[i]);
+    }
+    cols[COLUMNS] = '\0';
+    printf("  chunk %3ld |%s| ", c, cols);
+    print_bytes(r->bytes);
+    printf("\n");
+  }
+  if (num_chunks > SHOW_CHUNKS) {
+    printf("  ... %ld more chunks\n", num_chunks - SHOW_CHUNKS);
+  }
+  printf("\n");
+  return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+  map_summary *summaries;
+  int i, n = 0;
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s map.csv [more.csv ...]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  summaries = calloc(argc, sizeof(map_summary));
+  for (i=1; i < argc; i++) {
+    if (view_map(argv[i], &summaries[n], 64 * 1024) == 0) {
+      n++;
+    }
+  }
+  if (n > 1) {
+    printf("%-32s %12s %10s %10s %12s %10s\n", "map", "heap bytes", "alloc %", "free runs", "largest run", "ext frag %");
+    for (i=0; i < n; i++) {
+      map_summary *s = &summaries[i];
+      unsigned long long free_total = s->free + s->cached;
+      printf("%-32s %12llu %10.1f %10lu %12llu %10.1f\n", s->name, s->bytes,
+	     s->bytes ? 100.0 * s->allocated / s->bytes : 0, s->free_runs, s->largest_free,
+	     free_total ? 100.0 * (1.0 - (double) s->largest_free / free_total) : 0);
+    }
+  }
+  free(summaries);
+  return n ? EXIT_SUCCESS : EXIT_FAILURE;
+}
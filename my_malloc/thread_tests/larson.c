@@ -0,0 +1,137 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "my_malloc.h"
+
+#ifdef LOCK_VERSION
+#define MALLOC(sz) ts_malloc_lock(sz)
+#define FREE(p)    ts_free_lock(p)
+#define VERSION_NAME "lock"
+#endif
+#ifdef NOLOCK_VERSION
+#define MALLOC(sz) ts_malloc_nolock(sz)
+#define FREE(p)    ts_free_nolock(p)
+#define VERSION_NAME "nolock"
+#endif
+#ifdef PERCPU_VERSION
+#define MALLOC(sz) ts_malloc_percpu(sz)
+#define FREE(p)    ts_free_percpu(p)
+#define VERSION_NAME "percpu"
+#endif
+#ifdef ADAPTIVE_VERSION
+#define MALLOC(sz) ts_malloc(sz)
+#define FREE(p)    ts_free(p)
+#define VERSION_NAME "adaptive"
+#endif
+
+/* Larson server benchmark: each worker owns a set of live objects and 
+ * replaces random ones (free then malloc of a random size), like a server
+ * handling requests. After ROUNDS replacements each worker's objects are
+ * handed to a new thread and the old one exits, so most objects are free'd
+ * by a different thread than the one that allocated them. */
+
+#define NUM_THREADS  4
+#define NUM_SLOTS    1000
+#define ROUNDS       20000
+#define GENERATIONS  10
+#define MIN_SIZE     16
+#define MAX_SIZE     512
+
+double calc_time(struct timespec start, struct timespec end) {
+  double start_sec = (double)start.tv_sec*1000000000.0 + (double)start.tv_nsec;
+  double end_sec = (double)end.tv_sec*1000000000.0 + (double)end.tv_nsec;
+
+  if (end_sec < start_sec) {
+    return 0;
+  } else {
+    return end_sec - start_sec;
+  }
+};
+
+struct worker {
+  unsigned char *slots[NUM_SLOTS];
+  size_t sizes[NUM_SLOTS];
+  unsigned seed;
+  int fail;
+  pthread_t thread;
+};
+typedef struct worker worker_t;
+
+worker_t workers[NUM_THREADS];
+
+
+/* Fills an object with a pattern derived from its slot */
+void fill(unsigned char *object, size_t size, int slot) {
+  memset(object, slot & 0xff, size);
+}
+
+int check(unsigned char *object, size_t size, int slot) {
+  size_t i;
+  for (i=0; i < size; i++) {
+    if (object[i] != (unsigned char)(slot & 0xff)) return 0;
+  }
+  return 1;
+}
+
+
+void *run_worker(void *arg) {
+  worker_t *w = arg;
+  int i;
+  for (i=0; i < ROUNDS; i++) {
+    int slot = rand_r(&w->seed) % NUM_SLOTS;
+    if (!check(w->slots[slot], w->sizes[slot], slot)) {
+      w->fail = 1;
+    }
+    FREE(w->slots[slot]);
+    w->sizes[slot] = MIN_SIZE + rand_r(&w->seed) % (MAX_SIZE - MIN_SIZE + 1);
+    w->slots[slot] = MALLOC(w->sizes[slot]);
+    fill(w->slots[slot], w->sizes[slot], slot);
+  }
+  return NULL;
+}
+
+
+int main(int argc, char *argv[])
+{
+  struct timespec start_time, end_time;
+  int i, j, g;
+  int fail = 0;
+
+  for (i=0; i < NUM_THREADS; i++) {
+    workers[i].seed = i + 1;
+    for (j=0; j < NUM_SLOTS; j++) {
+      workers[i].sizes[j] = MIN_SIZE + rand_r(&workers[i].seed) % (MAX_SIZE - MIN_SIZE + 1);
+      workers[i].slots[j] = MALLOC(workers[i].sizes[j]);
+      fill(workers[i].slots[j], workers[i].sizes[j], j);
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  for (g=0; g < GENERATIONS; g++) { // each generation takes over the last one's objects
+    for (i=0; i < NUM_THREADS; i++) {
+      pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]);
+    }
+    for (i=0; i < NUM_THREADS; i++) {
+      pthread_join(workers[i].thread, NULL);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end_time);
+
+  for (i=0; i < NUM_THREADS; i++) {
+    fail |= workers[i].fail;
+    for (j=0; j < NUM_SLOTS; j++) {
+      fail |= !check(workers[i].slots[j], workers[i].sizes[j], j);
+      FREE(workers[i].slots[j]);
+    }
+  }
+
+  double elapsed_ns = calc_time(start_time, end_time);
+  printf("Benchmark = larson, Version = %s\n", VERSION_NAME);
+  printf("Execution Time = %f seconds\n", elapsed_ns / 1e9);
+  printf("Throughput = %f ops/second\n", 2.0 * NUM_THREADS * ROUNDS * GENERATIONS / (elapsed_ns / 1e9));
+  printf("Heap Size (grow_heap) = %lu bytes\n", get_data_segment_size());
+  printf(fail ? "Test failed\n" : "Test passed\n");
+  return fail;
+}
@@ -0,0 +1,74 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include "my_malloc.h"
+
+/* Malloc/free throughput of the locking version for a given number of 
+ * threads. Each thread keeps a small window of live blocks of random sizes
+ * and replaces one per iteration, so nearly every call takes list_lock for
+ * a short critical section. lock_sweep.sh runs it for every lock type. */
+
+#define MAX_THREADS 64
+#define WINDOW      64
+#define ITERATIONS  200000
+
+double calc_time(struct timespec start, struct timespec end) {
+  double start_sec = (double)start.tv_sec*1000000000.0 + (double)start.tv_nsec;
+  double end_sec = (double)end.tv_sec*1000000000.0 + (double)end.tv_nsec;
+
+  if (end_sec < start_sec) {
+    return 0;
+  } else {
+    return end_sec - start_sec;
+  }
+};
+
+pthread_barrier_t barrier;
+
+
+void *churn(void *arg) {
+  unsigned seed = (unsigned)(unsigned long) arg;
+  void *window[WINDOW] = {NULL};
+  int i;
+
+  pthread_barrier_wait(&barrier);
+  for (i=0; i < ITERATIONS; i++) {
+    int slot = rand_r(&seed) % WINDOW;
+    ts_free_lock(window[slot]);
+    window[slot] = ts_malloc_lock(16 + rand_r(&seed) % 497);
+  }
+  for (i=0; i < WINDOW; i++) {
+    ts_free_lock(window[i]);
+  }
+  return NULL;
+}
+
+
+int main(int argc, char *argv[])
+{
+  pthread_t threads[MAX_THREADS];
+  struct timespec start_time, end_time;
+  int num_threads = (argc > 1) ? atoi(argv[1]) : 4;
+  int i;
+
+  if ((num_threads < 1) || (num_threads > MAX_THREADS)) {
+    fprintf(stderr, "Usage: %s [threads (1 to %d)]\n", argv[0], MAX_THREADS);
+    return EXIT_FAILURE;
+  }
+  pthread_barrier_init(&barrier, NULL, num_threads + 1);
+  for (i=0; i < num_threads; i++) {
+    pthread_create(&threads[i], NULL, churn, (void *)(unsigned long)(i + 1));
+  }
+  pthread_barrier_wait(&barrier);
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  for (i=0; i < num_threads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end_time);
+
+  double elapsed_ns = calc_time(start_time, end_time);
+  printf("Threads = %d, Execution Time = %f seconds, Throughput = %f ops/second\n", num_threads,
+	 elapsed_ns / 1e9, 2.0 * num_threads * ITERATIONS / (elapsed_ns / 1e9));
+  return 0;
+}
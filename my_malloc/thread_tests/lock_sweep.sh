@@ -0,0 +1,22 @@
+#!/bin/bash
+# Rebuilds the library with each lock type for list_lock and sbrk_mutex and
+# runs lock_bench over a range of thread counts. The tests are rebuilt with
+# the same lock, and both with the Makefiles' default lock afterwards.
+for lock in TS_LOCK_PTHREAD TS_LOCK_TTAS TS_LOCK_TICKET TS_LOCK_MCS TS_LOCK_FUTEX
+do
+    make -s -C .. clean
+    make -s -C .. LOCK=$lock > /dev/null
+    make -s clean
+    make -s LOCK=$lock lock_bench > /dev/null
+    echo ==================================================
+    echo $lock
+    for threads in 1 2 4 8 16
+    do
+	./lock_bench $threads
+    done
+done
+echo ==================================================
+make -s -C .. clean
+make -s -C .. > /dev/null
+make -s clean
+make -s lock_bench > /dev/null
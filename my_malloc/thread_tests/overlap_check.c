@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "overlap_check.h"
+
+/* Regions are sorted by start address, after which a region overlaps an 
+ * earlier one exactly when it starts before the furthest end seen so far,
+ * so one sweep finds an overlapping pair if there is one.
+ *
+ * For large inputs the array is split into one slice per thread: the 
+ * slices are sorted in parallel and merged pairwise (also in parallel),
+ * then each thread sweeps its slice starting from the furthest end of the
+ * slices before it, which is a prefix over the slices' own furthest ends. */
+
+/* Inputs smaller than this are checked on the calling thread */
+#define PARALLEL_MIN 65536
+
+#define MAX_THREADS 64
+
+
+typedef struct slice_t{
+
+  overlap_region * regions;
+  overlap_region * buffer;   // merge scratch space, same layout as regions
+  size_t begin;
+  size_t mid;                // end of the left run when merging
+  size_t end;
+  const overlap_region * carry;  // region with the furthest end before begin
+  const overlap_region * furthest;  // region with the furthest end in the slice
+  long found;                // first overlapping position in the slice, -1 if none
+  const overlap_region * other;  // the region it overlaps
+
+} slice;
+
+
+static int compare_start(const void * a, const void * b){
+  const char * x = ((const overlap_region *) a)->start;
+  const char * y = ((const overlap_region *) b)->start;
+  return (x > y) - (x < y);
+}
+
+
+/* End (one past the last byte) of a region */
+static const char * region_end(const overlap_region * region){
+  return region->start + region->bytes;
+}
+
+
+static void * sort_slice(void * arg){
+  slice * s = arg;
+  qsort(s->regions + s->begin, s->end - s->begin, sizeof(overlap_region), compare_start);
+  return NULL;
+}
+
+
+/* Merges the sorted runs [begin, mid) and [mid, end) into the buffer */
+static void * merge_slice(void * arg){
+  slice * s = arg;
+  size_t i = s->begin, j = s->mid, k = s->begin;
+  while ((i < s->mid) && (j < s->end)){
+    s->buffer[k++] = (s->regions[j].start < s->regions[i].start) ? s->regions[j++] : s->regions[i++];
+  }
+  memcpy(s->buffer + k, s->regions + i, (s->mid - i) * sizeof(overlap_region));
+  k += s->mid - i;
+  memcpy(s->buffer + k, s->regions + j, (s->end - j) * sizeof(overlap_region));
+  return NULL;
+}
+
+
+static void * furthest_in_slice(void * arg){
+  slice * s = arg;
+  size_t i;
+  s->furthest = NULL;
+  for (i = s->begin; i < s->end; i++){
+    if ((s->furthest == NULL) || (region_end(&s->regions[i]) > region_end(s->furthest))){
+      s->furthest = &s->regions[i];
+    }
+  }
+  return NULL;
+}
+
+
+/* Sweeps a sorted slice, starting from the furthest end before it */
+static void * sweep_slice(void * arg){
+  slice * s = arg;
+  const overlap_region * furthest = s->carry;
+  size_t i;
+  s->found = -1;
+  for (i = s->begin; i < s->end; i++){
+    if (furthest && (s->regions[i].start < region_end(furthest))){
+      s->found = i;
+      s->other = furthest;
+      return NULL;
+    }
+    if ((furthest == NULL) || (region_end(&s->regions[i]) > region_end(furthest))){
+      furthest = &s->regions[i];
+    }
+  }
+  return NULL;
+}
+
+
+/* Runs fn on every slice, one thread each (the caller runs the first) */
+static void run_slices(void * (*fn)(void *), slice * slices, int count){
+  pthread_t threads[MAX_THREADS];
+  int started[MAX_THREADS];
+  int t;
+  for (t = 1; t < count; t++){
+    started[t] = (pthread_create(&threads[t], NULL, fn, &slices[t]) == 0);
+    if (!started[t]){
+      fn(&slices[t]); // out of threads, do it here
+    }
+  }
+  fn(&slices[0]);
+  for (t = 1; t < count; t++){
+    if (started[t]){
+      pthread_join(threads[t], NULL);
+    }
+  }
+}
+
+
+/* Sorts regions by start address with one slice per thread */
+static int parallel_sort(overlap_region * regions, size_t n, int num_threads){
+  slice slices[MAX_THREADS];
+  size_t bounds[MAX_THREADS + 1];
+  overlap_region * buffer = malloc(n * sizeof(overlap_region));
+  int runs = num_threads;
+  int t;
+  if (buffer == NULL){
+    return 0;
+  }
+  for (t = 0; t <= runs; t++){
+    bounds[t] = n * t / runs;
+  }
+  for (t = 0; t < runs; t++){
+    slices[t].regions = regions;
+    slices[t].begin = bounds[t];
+    slices[t].end = bounds[t + 1];
+  }
+  run_slices(sort_slice, slices, runs);
+
+  // merge neighbouring runs pairwise until one is left
+  while (runs > 1){
+    int pairs = runs / 2;
+    for (t = 0; t < pairs; t++){
+      slices[t].regions = regions;
+      slices[t].buffer = buffer;
+      slices[t].begin = bounds[2 * t];
+      slices[t].mid = bounds[2 * t + 1];
+      slices[t].end = bounds[2 * t + 2];
+    }
+    run_slices(merge_slice, slices, pairs);
+    if (runs & 1){ // odd run out is carried over unmerged
+      memcpy(buffer + bounds[runs - 1], regions + bounds[runs - 1],
+	     (n - bounds[runs - 1]) * sizeof(overlap_region));
+    }
+    for (t = 0; t < pairs; t++){
+      bounds[t] = bounds[2 * t];
+    }
+    if (runs & 1){
+      bounds[pairs] = bounds[runs - 1];
+    }
+    runs = pairs + (runs & 1);
+    bounds[runs] = n;
+    memcpy(regions, buffer, n * sizeof(overlap_region));
+  }
+  free(buffer);
+  return 1;
+}
+
+
+int find_overlap(overlap_region * regions, size_t n, int num_threads,
+		 overlap_region * first, overlap_region * second){
+  slice slices[MAX_THREADS];
+  int t;
+
+  if (num_threads <= 0){
+    num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (num_threads > MAX_THREADS){
+    num_threads = MAX_THREADS;
+  }
+  if ((n < PARALLEL_MIN) || (num_threads < 2) || !parallel_sort(regions, n, num_threads)){
+    num_threads = 1;
+    qsort(regions, n, sizeof(overlap_region), compare_start);
+  }
+
+  for (t = 0; t < num_threads; t++){
+    slices[t].regions = regions;
+    slices[t].begin = n * t / num_threads;
+    slices[t].end = n * (t + 1) / num_threads;
+  }
+  run_slices(furthest_in_slice, slices, num_threads);
+  slices[0].carry = NULL;
+  for (t = 1; t < num_threads; t++){
+    const overlap_region * before = slices[t - 1].carry;
+    const overlap_region * last = slices[t - 1].furthest;
+    if ((before == NULL) || (last && (region_end(last) > region_end(before)))){
+      before = last;
+    }
+    slices[t].carry = before;
+  }
+  run_slices(sweep_slice, slices, num_threads);
+
+  for (t = 0; t < num_threads; t++){
+    if (slices[t].found >= 0){
+      *first = *slices[t].other;
+      *second = regions[slices[t].found];
+      return 1;
+    }
+  }
+  return 0;
+}
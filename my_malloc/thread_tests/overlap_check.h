@@ -0,0 +1,22 @@
+#include <stddef.h>
+
+// Verification library for the thread tests: finds overlapping allocated
+// regions with a sort by address and a sweep, O(n log n) instead of
+// comparing every pair, and split across threads for large inputs.
+
+typedef struct overlap_region_t{
+
+  const char * start;
+  size_t bytes;
+  long index;   // caller's index, for reporting
+
+} overlap_region;
+
+
+// Looks for two regions in regions[0..n) that share a byte. The array is
+// sorted by address in place. Returns 1 and copies the pair into first and
+// second if one is found, 0 otherwise. num_threads = 0 uses one thread per
+// online CPU; small inputs are always checked on the calling thread.
+
+int find_overlap(overlap_region * regions, size_t n, int num_threads,
+		 overlap_region * first, overlap_region * second);
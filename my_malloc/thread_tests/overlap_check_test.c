@@ -0,0 +1,89 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include "overlap_check.h"
+
+/* Checks find_overlap on disjoint regions in random order, then with one
+ * planted overlap, for a small input (single threaded sweep) and a large
+ * one (parallel sort and sweep). */
+
+double calc_time(struct timespec start, struct timespec end) {
+  double start_sec = (double)start.tv_sec*1000000000.0 + (double)start.tv_nsec;
+  double end_sec = (double)end.tv_sec*1000000000.0 + (double)end.tv_nsec;
+
+  if (end_sec < start_sec) {
+    return 0;
+  } else {
+    return end_sec - start_sec;
+  }
+};
+
+
+/* Fills regions with n disjoint regions in shuffled order */
+void make_regions(overlap_region *regions, size_t n) {
+  const char *next = (const char *) 4096;
+  size_t i;
+  for (i=0; i < n; i++) {
+    regions[i].start = next;
+    regions[i].bytes = 16 + rand() % 512;
+    regions[i].index = i;
+    next += regions[i].bytes + 24 * (rand() % 2); // sometimes adjacent
+  }
+  for (i=n-1; i > 0; i--) {
+    size_t j = rand() % (i + 1);
+    overlap_region tmp = regions[i];
+    regions[i] = regions[j];
+    regions[j] = tmp;
+  }
+}
+
+
+int overlaps(const overlap_region *a, const overlap_region *b) {
+  return (a->start < b->start + b->bytes) && (b->start < a->start + a->bytes);
+}
+
+
+int run(size_t n, int num_threads) {
+  overlap_region *regions = malloc(n * sizeof(overlap_region));
+  overlap_region first, second;
+  struct timespec start_time, end_time;
+  int fail = 0;
+
+  make_regions(regions, n);
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  if (find_overlap(regions, n, num_threads, &first, &second)) {
+    printf("n=%zu: false overlap between %ld and %ld\n", n, first.index, second.index);
+    fail = 1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end_time);
+  printf("n=%zu, threads=%d: %f seconds\n", n, num_threads, calc_time(start_time, end_time) / 1e9);
+
+  // make one region reach one byte into its address order neighbour
+  size_t victim = rand() % (n - 1);
+  regions[victim].bytes = regions[victim + 1].start - regions[victim].start + 1;
+  size_t i;
+  for (i=0; i < n; i++) { // reshuffle so the pair is not adjacent in the array
+    size_t j = rand() % n;
+    overlap_region tmp = regions[i];
+    regions[i] = regions[j];
+    regions[j] = tmp;
+  }
+  if (!find_overlap(regions, n, num_threads, &first, &second) || !overlaps(&first, &second)) {
+    printf("n=%zu: planted overlap not found\n", n);
+    fail = 1;
+  }
+  free(regions);
+  return fail;
+}
+
+
+int main(int argc, char *argv[])
+{
+  int fail = 0;
+  srand(1);
+  fail |= run(1000, 0);
+  fail |= run(2000000, 1);
+  fail |= run(2000000, 4);
+  printf(fail ? "Test failed\n" : "Test passed\n");
+  return fail;
+}
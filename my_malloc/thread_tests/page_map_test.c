@@ -0,0 +1,102 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "my_malloc.h"
+
+/* Checks the page map: ownership and usable size of heap blocks and large
+ * (mmapped) blocks, rejection of foreign pointers (stack, static, libc
+ * malloc, shared heap, interior and misaligned pointers, freed large
+ * blocks) by ts_owns and by the free functions, which must leave the heap
+ * as it was. Also times a lookup. The rejected frees print errors. */
+
+#define NUM_OBJECTS 100000
+#define LARGE_BYTES (1024 * 1024)
+#define LOOKUPS     10000000
+
+static int static_object;
+static int fail = 0;
+
+double calc_time(struct timespec start, struct timespec end) {
+  double start_sec = (double)start.tv_sec*1000000000.0 + (double)start.tv_nsec;
+  double end_sec = (double)end.tv_sec*1000000000.0 + (double)end.tv_nsec;
+
+  if (end_sec < start_sec) {
+    return 0;
+  } else {
+    return end_sec - start_sec;
+  }
+};
+
+
+void expect(int ok, const char *what) {
+  if (!ok) {
+    printf("FAILED: %s\n", what);
+    fail = 1;
+  }
+}
+
+
+int main(int argc, char *argv[])
+{
+  void **objs = malloc(NUM_OBJECTS * sizeof(void *));
+  int stack_object;
+  size_t i;
+
+  for (i=0; i < NUM_OBJECTS; i++) {
+    size_t size = 1 + (i * 7919) % 4000;
+    objs[i] = ts_malloc_lock(size);
+    if (!ts_owns(objs[i]) || (ts_malloc_usable_size(objs[i]) < size)) {
+      expect(0, "heap block owned with its size");
+      break;
+    }
+  }
+  char *large = ts_malloc_lock(LARGE_BYTES);
+  expect(ts_owns(large), "large block owned");
+  expect(ts_malloc_usable_size(large) >= LARGE_BYTES, "large block usable size");
+  expect(!ts_owns(large + 4096), "interior pointer of a large block foreign");
+  expect(!ts_owns((char *) objs[0] + 1), "misaligned pointer foreign");
+  expect(!ts_owns(&stack_object), "stack pointer foreign");
+  expect(!ts_owns(&static_object), "static pointer foreign");
+  void *libc_object = malloc(64);
+  expect(!ts_owns(libc_object), "libc malloc pointer foreign");
+  ts_shm_heap *shm = ts_shm_create(NULL, 1024 * 1024);
+  void *shm_object = shm ? ts_shm_malloc(shm, 64) : NULL;
+  expect(shm_object && !ts_owns(shm_object), "shared heap pointer foreign");
+
+  // the free functions must reject foreign pointers without touching the heap
+  unsigned long free_before = get_data_segment_free_space_size();
+  printf("Rejecting foreign frees (errors expected):\n");
+  fflush(stdout);
+  ts_free_lock(libc_object);
+  ts_free_nolock(&stack_object);
+  ts_free_percpu(shm_object);
+  ts_free_sized_lock(large + 4096, 64);
+  expect(ts_realloc_lock(&static_object, 100) == NULL, "realloc of a foreign pointer fails");
+  expect(get_data_segment_free_space_size() == free_before, "free list untouched by foreign frees");
+
+  large = ts_realloc_lock(large, 4 * LARGE_BYTES);
+  expect(ts_owns(large) && (ts_malloc_usable_size(large) >= 4 * LARGE_BYTES), "remapped large block owned");
+  ts_free_lock(large);
+  expect(!ts_owns(large), "freed large block foreign");
+
+  struct timespec start_time, end_time;
+  unsigned long owned = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  for (i=0; i < LOOKUPS; i++) {
+    owned += ts_owns(objs[(i * 2654435761UL) % NUM_OBJECTS]);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end_time);
+  expect(owned == LOOKUPS, "every lookup owned");
+  printf("ts_owns lookup = %.2f ns\n", calc_time(start_time, end_time) / LOOKUPS);
+
+  for (i=0; i < NUM_OBJECTS; i++) {
+    ts_free_lock(objs[i]);
+  }
+  ts_shm_free(shm, shm_object);
+  ts_shm_detach(shm);
+  free(libc_object);
+  free(objs);
+  printf(fail ? "Test failed\n" : "Test passed\n");
+  return fail;
+}
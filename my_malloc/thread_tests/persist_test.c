@@ -0,0 +1,218 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "my_malloc.h"
+
+/* Checks the persistent heap across restarts. Each phase runs in a new
+ * process, as a restarted service would:
+ *
+ *   build    creates the heap file and a hash index of NUM_KEYS entries
+ *            in it, linked by offsets, reachable from the root slot
+ *   reopen   maps the file again and looks every key up
+ *   update   removes the odd keys, then churns the heap until it is killed
+ *            with SIGKILL (possibly holding the heap's mutex)
+ *   recover  opens the file after the crash and checks the even keys
+ *
+ * The times of build and reopen compare rebuilding the index with paging
+ * it back in. */
+
+#define NUM_KEYS     200000
+#define NUM_BUCKETS  65536
+#define VALUE_BYTES  64
+#define HEAP_BYTES   (64UL * 1024 * 1024)
+
+typedef struct entry_t{
+  uint64_t next;      // offset of the next entry in the bucket
+  uint64_t key;
+  char value[VALUE_BYTES];
+} entry;
+
+typedef struct index_t{
+  uint64_t count;
+  uint64_t buckets[NUM_BUCKETS];  // offsets of the first entries
+} index_root;
+
+double calc_time(struct timespec start, struct timespec end) {
+  double start_sec = (double)start.tv_sec*1000000000.0 + (double)start.tv_nsec;
+  double end_sec = (double)end.tv_sec*1000000000.0 + (double)end.tv_nsec;
+
+  if (end_sec < start_sec) {
+    return 0;
+  } else {
+    return end_sec - start_sec;
+  }
+};
+
+
+/* Value stored for a key */
+void fill_value(char *value, uint64_t key) {
+  snprintf(value, VALUE_BYTES, "value-%lu-%lu", (unsigned long) key, (unsigned long) (key * 2654435761UL));
+}
+
+
+int build(const char *path) {
+  ts_shm_heap *heap = ts_heap_open(path, HEAP_BYTES);
+  uint64_t key;
+  if (heap == NULL) {
+    return EXIT_FAILURE;
+  }
+  index_root *index = ts_shm_malloc(heap, sizeof(index_root));
+  memset(index, 0, sizeof(index_root));
+  for (key=0; key < NUM_KEYS; key++) {
+    entry *e = ts_shm_malloc(heap, sizeof(entry));
+    if (e == NULL) {
+      return EXIT_FAILURE;
+    }
+    e->key = key;
+    fill_value(e->value, key);
+    e->next = index->buckets[key % NUM_BUCKETS];
+    index->buckets[key % NUM_BUCKETS] = ts_shm_offset(heap, e);
+    index->count++;
+  }
+  ts_heap_set_root(heap, index);
+  ts_heap_close(heap);
+  return EXIT_SUCCESS;
+}
+
+
+/* Looks every key up, returns the number that are missing or wrong.
+ * Keys with (key % step) != 0 must be absent. */
+uint64_t check(ts_shm_heap *heap, uint64_t step) {
+  index_root *index = ts_heap_get_root(heap);
+  char expected[VALUE_BYTES];
+  uint64_t key, bad = 0;
+  if (index == NULL) {
+    return NUM_KEYS;
+  }
+  for (key=0; key < NUM_KEYS; key++) {
+    entry *e = ts_shm_ptr(heap, index->buckets[key % NUM_BUCKETS]);
+    while (e && (e->key != key)) {
+      e = ts_shm_ptr(heap, e->next);
+    }
+    fill_value(expected, key);
+    if ((key % step == 0) != (e && (strcmp(e->value, expected) == 0))) {
+      bad++;
+    }
+  }
+  if (index->count != (NUM_KEYS + step - 1) / step) {
+    bad++;
+  }
+  return bad;
+}
+
+
+int reopen(const char *path) {
+  ts_shm_heap *heap = ts_heap_open(path, HEAP_BYTES);
+  if (heap == NULL) {
+    return EXIT_FAILURE;
+  }
+  uint64_t bad = check(heap, 1);
+  ts_heap_close(heap);
+  return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+int update(const char *path, int ready) {
+  ts_shm_heap *heap = ts_heap_open(path, HEAP_BYTES);
+  uint64_t b;
+  if (heap == NULL) {
+    return EXIT_FAILURE;
+  }
+  index_root *index = ts_heap_get_root(heap);
+  for (b=0; b < NUM_BUCKETS; b++) {
+    uint64_t *link = &index->buckets[b];
+    while (*link) {
+      entry *e = ts_shm_ptr(heap, *link);
+      if (e->key % 2) {
+	*link = e->next;
+	ts_shm_free(heap, e);
+	index->count--;
+      } else {
+	link = &e->next;
+      }
+    }
+  }
+  ts_heap_sync(heap);
+  if (write(ready, "", 1) != 1) {
+    return EXIT_FAILURE;
+  }
+  // scratch allocations, never linked into the index
+  void *scratch[64] = {NULL};
+  unsigned i = 0;
+  for (;;) {
+    ts_shm_free(heap, scratch[i % 64]);
+    scratch[i % 64] = ts_shm_malloc(heap, (i * 37) % 4096 + 1);
+    i++;
+  }
+}
+
+
+/* Runs a phase in a new process, returns its exit status and time */
+int run_phase(int (*phase)(const char *), const char *path, double *ns) {
+  struct timespec start_time, end_time;
+  int status;
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  pid_t pid = fork();
+  if (pid == 0) {
+    _exit(phase(path));
+  }
+  waitpid(pid, &status, 0);
+  clock_gettime(CLOCK_MONOTONIC, &end_time);
+  *ns = calc_time(start_time, end_time);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+}
+
+
+int main(int argc, char *argv[])
+{
+  char path[64];
+  double build_ns, reopen_ns;
+  int fail = 0;
+
+  snprintf(path, sizeof(path), "/tmp/ts_persist_test_%d.heap", (int) getpid());
+  unlink(path);
+  fail |= run_phase(build, path, &build_ns);
+  fail |= run_phase(reopen, path, &reopen_ns);
+  printf("Build index of %d keys = %.2f ms, reopen and look up every key = %.2f ms\n",
+	 NUM_KEYS, build_ns / 1e6, reopen_ns / 1e6);
+
+  int fds[2];
+  char c;
+  if (pipe(fds) != 0) {
+    return EXIT_FAILURE;
+  }
+  pid_t pid = fork();
+  if (pid == 0) {
+    _exit(update(path, fds[1]));
+  }
+  close(fds[1]);
+  if (read(fds[0], &c, 1) != 1) { // the odd keys are gone
+    fail = 1;
+  }
+  close(fds[0]);
+  usleep(20000);
+  kill(pid, SIGKILL);
+  waitpid(pid, NULL, 0);
+
+  ts_shm_heap *heap = ts_heap_open(path, HEAP_BYTES);
+  uint64_t bad = heap ? check(heap, 2) : NUM_KEYS;
+  printf("After a crash: wrong keys = %lu\n", (unsigned long) bad);
+  if (heap) {
+    void *obj = ts_shm_malloc(heap, 1024);
+    if (obj == NULL) {
+      bad++;
+    }
+    ts_shm_free(heap, obj);
+    ts_heap_close(heap);
+  }
+  unlink(path);
+  fail |= (bad != 0);
+
+  printf(fail ? "Test failed\n" : "Test passed\n");
+  return fail;
+}
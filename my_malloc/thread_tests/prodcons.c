@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include "my_malloc.h"
+
+#ifdef LOCK_VERSION
+#define MALLOC(sz) ts_malloc_lock(sz)
+#define FREE(p)    ts_free_lock(p)
+#define VERSION_NAME "lock"
+#endif
+#ifdef NOLOCK_VERSION
+#define MALLOC(sz) ts_malloc_nolock(sz)
+#define FREE(p)    ts_free_nolock(p)
+#define VERSION_NAME "nolock"
+#endif
+#ifdef PERCPU_VERSION
+#define MALLOC(sz) ts_malloc_percpu(sz)
+#define FREE(p)    ts_free_percpu(p)
+#define VERSION_NAME "percpu"
+#endif
+#ifdef ADAPTIVE_VERSION
+#define MALLOC(sz) ts_malloc(sz)
+#define FREE(p)    ts_free(p)
+#define VERSION_NAME "adaptive"
+#endif
+
+/* Producer-consumer pipelines: in each pair one thread only allocates and
+ * the other only frees, with the objects passed through a bounded single
+ * producer, single consumer ring. Memory free'd by a consumer can only be
+ * re-used by its producer if frees reach a shared heap, so the heap size
+ * shows how well an allocator returns cross-thread frees. */
+
+#define NUM_PAIRS    2
+#define NUM_OBJECTS  200000
+#define RING_SIZE    1024
+#define MIN_SIZE     16
+#define MAX_SIZE     1024
+
+double calc_time(struct timespec start, struct timespec end) {
+  double start_sec = (double)start.tv_sec*1000000000.0 + (double)start.tv_nsec;
+  double end_sec = (double)end.tv_sec*1000000000.0 + (double)end.tv_nsec;
+
+  if (end_sec < start_sec) {
+    return 0;
+  } else {
+    return end_sec - start_sec;
+  }
+};
+
+struct message {
+  size_t size;
+  unsigned sequence;
+};
+typedef struct message message_t;
+
+struct pipeline {
+  message_t *ring[RING_SIZE];
+  unsigned head;   // next slot to consume
+  unsigned tail;   // next slot to produce
+  int fail;
+  pthread_t producer, consumer;
+};
+typedef struct pipeline pipeline_t;
+
+pipeline_t pipelines[NUM_PAIRS];
+
+
+void *produce(void *arg) {
+  pipeline_t *p = arg;
+  unsigned seed = (unsigned)(p - pipelines) + 1;
+  unsigned i;
+  for (i=0; i < NUM_OBJECTS; i++) {
+    size_t size = MIN_SIZE + rand_r(&seed) % (MAX_SIZE - MIN_SIZE + 1);
+    message_t *m = MALLOC(size);
+    m->size = size;
+    m->sequence = i;
+    memset(m + 1, i & 0xff, size - sizeof(message_t));
+    while (__atomic_load_n(&p->tail, __ATOMIC_RELAXED) - __atomic_load_n(&p->head, __ATOMIC_ACQUIRE) == RING_SIZE) {
+      sched_yield(); // ring full
+    }
+    p->ring[p->tail % RING_SIZE] = m;
+    __atomic_store_n(&p->tail, p->tail + 1, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+
+void *consume(void *arg) {
+  pipeline_t *p = arg;
+  unsigned i;
+  for (i=0; i < NUM_OBJECTS; i++) {
+    while (__atomic_load_n(&p->tail, __ATOMIC_ACQUIRE) == __atomic_load_n(&p->head, __ATOMIC_RELAXED)) {
+      sched_yield(); // ring empty
+    }
+    message_t *m = p->ring[p->head % RING_SIZE];
+    __atomic_store_n(&p->head, p->head + 1, __ATOMIC_RELEASE);
+    unsigned char *payload = (unsigned char *)(m + 1);
+    size_t j;
+    if (m->sequence != i) {
+      p->fail = 1;
+    }
+    for (j=0; j < m->size - sizeof(message_t); j++) {
+      if (payload[j] != (unsigned char)(i & 0xff)) {
+	p->fail = 1;
+	break;
+      }
+    }
+    FREE(m);
+  }
+  return NULL;
+}
+
+
+int main(int argc, char *argv[])
+{
+  struct timespec start_time, end_time;
+  int i;
+  int fail = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  for (i=0; i < NUM_PAIRS; i++) {
+    pthread_create(&pipelines[i].consumer, NULL, consume, &pipelines[i]);
+    pthread_create(&pipelines[i].producer, NULL, produce, &pipelines[i]);
+  }
+  for (i=0; i < NUM_PAIRS; i++) {
+    pthread_join(pipelines[i].producer, NULL);
+    pthread_join(pipelines[i].consumer, NULL);
+    fail |= pipelines[i].fail;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end_time);
+
+  double elapsed_ns = calc_time(start_time, end_time);
+  printf("Benchmark = prodcons, Version = %s\n", VERSION_NAME);
+  printf("Execution Time = %f seconds\n", elapsed_ns / 1e9);
+  printf("Throughput = %f ops/second\n", 2.0 * NUM_PAIRS * NUM_OBJECTS / (elapsed_ns / 1e9));
+  printf("Heap Size (grow_heap) = %lu bytes\n", get_data_segment_size());
+  printf(fail ? "Test failed\n" : "Test passed\n");
+  return fail;
+}
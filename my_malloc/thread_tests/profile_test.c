@@ -0,0 +1,157 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include "my_malloc.h"
+
+/* Checks the sampling heap profiler. Two call sites allocate the same
+ * number of bytes; site_kept keeps its blocks and site_freed frees them, so
+ * the live profile must attribute about KEPT_BYTES to site_kept and nothing
+ * to site_freed, and the growth profile must show site_kept growing the
+ * heap. A second dump is triggered with TS_MALLOC_PROFILE_SIGNAL. Also
+ * reports the cost of malloc/free with profiling off and on.
+ *
+ * Built with -rdynamic so the profiler can name the test's functions. */
+
+#define SAMPLE_RATE  (64 * 1024)
+#define OBJECT_BYTES 1000
+#define KEPT_BYTES   (32UL * 1024 * 1024)
+#define NUM_OBJECTS  (KEPT_BYTES / OBJECT_BYTES)
+#define TIMED_OPS    2000000
+
+double calc_time(struct timespec start, struct timespec end) {
+  double start_sec = (double)start.tv_sec*1000000000.0 + (double)start.tv_nsec;
+  double end_sec = (double)end.tv_sec*1000000000.0 + (double)end.tv_nsec;
+
+  if (end_sec < start_sec) {
+    return 0;
+  } else {
+    return end_sec - start_sec;
+  }
+};
+
+
+__attribute__((noinline)) void site_kept(void **objs) {
+  size_t i;
+  for (i=0; i < NUM_OBJECTS; i++) {
+    objs[i] = ts_malloc_lock(OBJECT_BYTES);
+  }
+}
+
+
+__attribute__((noinline)) void site_freed(void **objs) {
+  size_t i;
+  for (i=0; i < NUM_OBJECTS; i++) {
+    objs[i] = ts_malloc_lock(OBJECT_BYTES);
+  }
+  for (i=0; i < NUM_OBJECTS; i++) {
+    ts_free_lock(objs[i]);
+  }
+}
+
+
+/* Sums the bytes of the folded stacks in path that contain name */
+unsigned long long folded_bytes(const char *path, const char *name) {
+  char line[8192];
+  unsigned long long total = 0;
+  FILE *in = fopen(path, "r");
+  if (in == NULL) {
+    return 0;
+  }
+  while (fgets(line, sizeof(line), in)) {
+    char *bytes = strrchr(line, ' ');
+    if (bytes && strstr(line, name)) {
+      total += strtoull(bytes + 1, NULL, 10);
+    }
+  }
+  fclose(in);
+  return total;
+}
+
+
+/* Nanoseconds per malloc/free pair of a small block */
+double time_pairs() {
+  struct timespec start_time, end_time;
+  int i;
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  for (i=0; i < TIMED_OPS; i++) {
+    void *volatile p = ts_malloc_lock(64);
+    ts_free_lock(p);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end_time);
+  return calc_time(start_time, end_time) / TIMED_OPS;
+}
+
+
+int main(int argc, char *argv[])
+{
+  char prefix[256], path[300];
+  void **kept = malloc(NUM_OBJECTS * sizeof(void *));
+  void **freed = malloc(NUM_OBJECTS * sizeof(void *));
+  int fail = 0;
+
+  snprintf(prefix, sizeof(prefix), "/tmp/ts_profile_test_%d", (int) getpid());
+  setenv("TS_MALLOC_PROFILE_SIGNAL", "12", 1); // SIGUSR2, read when the heap first grows
+  setenv("TS_MALLOC_PROFILE_OUT", prefix, 1);
+
+  double off_ns = time_pairs();
+  ts_profile_set_rate(SAMPLE_RATE);
+  double on_ns = time_pairs();
+  printf("malloc/free pair: profiling off = %.1f ns, on = %.1f ns\n", off_ns, on_ns);
+
+  site_kept(kept);
+  site_freed(freed);
+
+  snprintf(path, sizeof(path), "%s.folded", prefix);
+  ts_profile_dump(prefix);
+  unsigned long long kept_bytes = folded_bytes(path, "site_kept");
+  unsigned long long freed_bytes = folded_bytes(path, "site_freed");
+  snprintf(path, sizeof(path), "%s.growth.folded", prefix);
+  unsigned long long growth_bytes = folded_bytes(path, "site_kept");
+  printf("Live bytes: site_kept = %llu (allocated %lu), site_freed = %llu\n",
+	 kept_bytes, NUM_OBJECTS * OBJECT_BYTES, freed_bytes);
+  printf("Heap growth from site_kept = %llu\n", growth_bytes);
+  if ((kept_bytes < NUM_OBJECTS * OBJECT_BYTES * 0.8) || (kept_bytes > NUM_OBJECTS * OBJECT_BYTES * 1.2) ||
+      freed_bytes || (growth_bytes == 0)) {
+    fail = 1;
+  }
+  unlink(path);
+  snprintf(path, sizeof(path), "%s.folded", prefix);
+  unlink(path);
+  snprintf(path, sizeof(path), "%s.heap", prefix);
+  unlink(path);
+
+  // dump on signal
+  raise(SIGUSR2);
+  snprintf(path, sizeof(path), "%s.%d.0.heap", prefix, (int) getpid());
+  int tries;
+  for (tries=0; (tries < 200) && (access(path, F_OK) != 0); tries++) {
+    usleep(10000);
+  }
+  usleep(50000); // let the dump finish
+  FILE *in = fopen(path, "r");
+  char header[256] = "";
+  if ((in == NULL) || !fgets(header, sizeof(header), in) || strncmp(header, "heap profile:", 13)) {
+    fail = 1;
+  }
+  printf("Signal dump: %s", in ? header : "missing\n");
+  if (in) {
+    fclose(in);
+  }
+  unlink(path);
+  snprintf(path, sizeof(path), "%s.%d.0.folded", prefix, (int) getpid());
+  unlink(path);
+  snprintf(path, sizeof(path), "%s.%d.0.growth.folded", prefix, (int) getpid());
+  unlink(path);
+
+  size_t i;
+  for (i=0; i < NUM_OBJECTS; i++) {
+    ts_free_lock(kept[i]);
+  }
+  free(kept);
+  free(freed);
+  printf(fail ? "Test failed\n" : "Test passed\n");
+  return fail;
+}
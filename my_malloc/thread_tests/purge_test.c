@@ -0,0 +1,80 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "my_malloc.h"
+
+/* Checks the background purge thread: half of a heap of large blocks is
+ * free'd, then the resident set size is sampled while the free blocks decay.
+ * The blocks that stay allocated must keep their contents. */
+
+#define NUM_BLOCKS  512
+#define BLOCK_BYTES (64 * 1024)
+#define DECAY_MS    200
+
+/* Resident set size of the process in bytes */
+unsigned long resident_bytes() {
+  unsigned long size, resident;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f == NULL) {
+    return 0;
+  }
+  if (fscanf(f, "%lu %lu", &size, &resident) != 2) {
+    resident = 0;
+  }
+  fclose(f);
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+
+int main(int argc, char *argv[])
+{
+  char *blocks[NUM_BLOCKS];
+  int use_madv_free = (argc > 1) && (strcmp(argv[1], "free") == 0);
+  int i, j;
+  int fail = 0;
+
+  for (i=0; i < NUM_BLOCKS; i++) {
+    blocks[i] = ts_malloc_lock(BLOCK_BYTES);
+    memset(blocks[i], i & 0xff, BLOCK_BYTES);
+  }
+  for (i=0; i < NUM_BLOCKS; i+=2) {
+    ts_free_lock(blocks[i]);
+  }
+  unsigned long before = resident_bytes();
+
+  if (ts_set_purge_decay(DECAY_MS, use_madv_free) != 0) {
+    printf("Test failed\n");
+    return EXIT_FAILURE;
+  }
+  for (i=1; i <= 4; i++) {
+    usleep(DECAY_MS * 1000 / 2);
+    printf("After %d ms: resident = %lu KiB\n", i * DECAY_MS / 2, resident_bytes() / 1024);
+  }
+  ts_set_purge_decay(0, 0);
+
+  ts_stats stats;
+  ts_get_stats(&stats);
+  printf("Before purging: resident = %lu KiB\n", before / 1024);
+  printf("Purged = %llu KiB (%s)\n", stats.purged_bytes / 1024, use_madv_free ? "MADV_FREE" : "MADV_DONTNEED");
+
+  for (i=1; i < NUM_BLOCKS; i+=2) {
+    for (j=0; j < BLOCK_BYTES; j++) {
+      if (blocks[i][j] != (char)(i & 0xff)) {
+	fail = 1;
+	break;
+      }
+    }
+  }
+  // purged blocks must still be usable
+  for (i=0; i < NUM_BLOCKS; i+=2) {
+    blocks[i] = ts_malloc_lock(BLOCK_BYTES);
+    memset(blocks[i], 0x5a, BLOCK_BYTES);
+  }
+  if (stats.purged_bytes < (unsigned long long) (NUM_BLOCKS / 4) * BLOCK_BYTES) {
+    fail = 1; // most of the free'd half should have been returned
+  }
+
+  printf(fail ? "Test failed\n" : "Test passed\n");
+  return fail;
+}
@@ -0,0 +1,88 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "my_malloc.h"
+
+/* Grows an append-only log one step at a time, the way our large logs are
+ * built, and times each resize: ts_realloc_lock (mremap for large blocks)
+ * against a copying realloc (malloc, memcpy, free). With mremap the cost
+ * per resize stays flat as the log grows; with copying it grows with the
+ * log. Each step's new bytes are written, as an append would. */
+
+#define STEP       (1024 * 1024)
+#define MAX_BYTES  (256UL * 1024 * 1024)
+#define NUM_STEPS  (MAX_BYTES / STEP)
+#define BUCKETS    4
+
+double calc_time(struct timespec start, struct timespec end) {
+  double start_sec = (double)start.tv_sec*1000000000.0 + (double)start.tv_nsec;
+  double end_sec = (double)end.tv_sec*1000000000.0 + (double)end.tv_nsec;
+
+  if (end_sec < start_sec) {
+    return 0;
+  } else {
+    return end_sec - start_sec;
+  }
+};
+
+
+/* realloc without mremap: move to a new block every time */
+void *copy_realloc(void *ptr, size_t old_size, size_t size) {
+  void *new_ptr = ts_malloc_lock(size);
+  if (new_ptr && ptr) {
+    memcpy(new_ptr, ptr, old_size);
+    ts_free_lock(ptr);
+  }
+  return new_ptr;
+}
+
+
+/* Grows a log to MAX_BYTES, adding the time of each resize to the bucket 
+ * for the log's size at the time. Returns 0 if the contents were lost. */
+int grow_log(int use_mremap, double *bucket_ns) {
+  struct timespec start_time, end_time;
+  unsigned char *log = NULL;
+  size_t size = 0;
+  size_t step;
+  int ok = 1;
+
+  memset(bucket_ns, 0, BUCKETS * sizeof(double));
+  for (step=0; step < NUM_STEPS; step++) {
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    if (use_mremap) {
+      log = ts_realloc_lock(log, size + STEP);
+    } else {
+      log = copy_realloc(log, size, size + STEP);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    if (log == NULL) {
+      return 0;
+    }
+    bucket_ns[step * BUCKETS / NUM_STEPS] += calc_time(start_time, end_time);
+    ok &= (size == 0) || ((log[0] == 0) && (log[size - 1] == (unsigned char)(step - 1)));
+    memset(log + size, step & 0xff, STEP);
+    size += STEP;
+  }
+  ts_free_lock(log);
+  return ok;
+}
+
+
+int main(int argc, char *argv[])
+{
+  double mremap_ns[BUCKETS], copy_ns[BUCKETS];
+  int i;
+  int ok = grow_log(1, mremap_ns);
+  ok &= grow_log(0, copy_ns);
+
+  printf("Average resize time growing a log by %d KiB steps to %lu MiB\n", STEP / 1024, MAX_BYTES >> 20);
+  printf("%-20s %16s %16s\n", "log size (MiB)", "mremap (us)", "copy (us)");
+  for (i=0; i < BUCKETS; i++) {
+    char range[32];
+    snprintf(range, sizeof(range), "%lu-%lu", (MAX_BYTES >> 20) * i / BUCKETS, (MAX_BYTES >> 20) * (i + 1) / BUCKETS);
+    printf("%-20s %16.2f %16.2f\n", range, mremap_ns[i] / (NUM_STEPS / BUCKETS) / 1e3, copy_ns[i] / (NUM_STEPS / BUCKETS) / 1e3);
+  }
+  printf(ok ? "Test passed\n" : "Test failed\n");
+  return !ok;
+}
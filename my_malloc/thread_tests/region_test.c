@@ -0,0 +1,107 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "my_malloc.h"
+
+/* Checks the region allocator:
+ *
+ *   small     many small objects are aligned, do not overlap and keep
+ *             their contents until the region is destroyed
+ *   oversized a request larger than a region chunk gets a chunk of its own,
+ *             a mapping of its own from 128 KiB on, which destroy unmaps;
+ *             sizes near SIZE_MAX are refused
+ *   destroy   every chunk goes back to the free list
+ *   reuse     a second region of the same shape is served from the blocks
+ *             the first one gave back, without growing the heap
+ *   after     malloc and free keep working after a destroy */
+
+#define SMALL_OBJECTS  20000
+#define OVERSIZED      (100 * 1024)
+#define MAPPED         (200 * 1024)
+
+static int fail = 0;
+
+void expect(int ok, const char *what) {
+  if (!ok) {
+    printf("FAILED: %s\n", what);
+    fail = 1;
+  }
+}
+
+
+/* Fills a region with small objects and one oversized one, checking them */
+void fill_region(ts_region *region) {
+  static unsigned char *objects[SMALL_OBJECTS];
+  int i, ok = 1;
+  for (i=0; i < SMALL_OBJECTS; i++) {
+    size_t size = 1 + (i * 7) % 120;
+    objects[i] = ts_region_alloc(region, size);
+    if ((objects[i] == NULL) || ((uintptr_t) objects[i] % 8)) {
+      ok = 0;
+      break;
+    }
+    memset(objects[i], i & 0xff, size);
+  }
+  expect(ok, "small objects allocated and aligned");
+  for (i=0; ok && (i < SMALL_OBJECTS); i++) {
+    size_t size = 1 + (i * 7) % 120;
+    if ((objects[i][0] != (i & 0xff)) || (objects[i][size - 1] != (i & 0xff))) {
+      expect(0, "small objects keep their contents");
+      break;
+    }
+  }
+  char *big = ts_region_alloc(region, OVERSIZED);
+  expect(big != NULL, "oversized object allocated");
+  if (big) {
+    memset(big, 'x', OVERSIZED);
+  }
+  char *mapped = ts_region_alloc(region, MAPPED);
+  expect(mapped != NULL, "mapped object allocated");
+  if (mapped) {
+    memset(mapped, 'y', MAPPED);
+  }
+  expect(ts_region_alloc(region, 16) != NULL, "allocation after an oversized chunk");
+  expect(ts_region_alloc(region, SIZE_MAX) == NULL, "size that aligns to 0 refused");
+  expect(ts_region_alloc(region, SIZE_MAX - 64) == NULL, "size that overflows a chunk refused");
+}
+
+
+int main(int argc, char *argv[])
+{
+  ts_stats stats;
+  expect(ts_region_alloc(NULL, 16) == NULL, "allocation from a NULL region");
+
+  ts_region *region = ts_region_create();
+  expect(region != NULL, "region created");
+  fill_region(region);
+  ts_region_destroy(region);
+  ts_get_stats(&stats);
+  printf("After destroy: free = %lu of heap = %lu, mapped = %lu\n", stats.free_bytes,
+	 stats.heap_bytes, stats.mmapped_bytes);
+  expect(stats.free_bytes == stats.heap_bytes, "every chunk back on the free list");
+  expect(stats.mmapped_bytes == 0, "mapped chunks unmapped");
+  unsigned long heap_before = stats.heap_bytes;
+
+  region = ts_region_create();
+  fill_region(region);
+  ts_get_stats(&stats);
+  expect(stats.heap_bytes == heap_before, "second region re-uses the free'd chunks");
+  ts_region_destroy(region);
+
+  void *objects[100];
+  int i;
+  for (i=0; i < 100; i++) {
+    objects[i] = ts_malloc_lock(16 + i * 40);
+    memset(objects[i], 0, 16 + i * 40);
+  }
+  for (i=0; i < 100; i++) {
+    ts_free_lock(objects[i]);
+  }
+  ts_get_stats(&stats);
+  printf("After malloc/free: free = %lu of heap = %lu\n", stats.free_bytes, stats.heap_bytes);
+  expect(stats.free_bytes == stats.heap_bytes, "malloc and free after destroy");
+  ts_region_destroy(NULL);
+  printf(fail ? "Test failed\n" : "Test passed\n");
+  return fail;
+}
@@ -0,0 +1,198 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "my_malloc.h"
+#include "overlap_check.h"
+
+/* Checks the shared-memory heap across processes. Worker processes attach
+ * to a named heap (each at its own address), allocate and free objects in
+ * it, and send the offsets of the objects they keep to the parent through a
+ * pipe. The parent checks their contents and that no two overlap, then
+ * frees them all, which must leave the heap as one free block. Then workers
+ * are killed with SIGKILL while allocating, so some die holding the heap's
+ * mutex, and the heap must stay usable. Last, misaligned and interior
+ * pointers must be refused by ts_shm_free without changing the heap. */
+
+#define NUM_PROCS    4
+#define NUM_OBJECTS  4000
+#define HEAP_BYTES   (64UL * 1024 * 1024)
+#define NUM_KILLS    20
+
+typedef struct object_record_t{
+  uint64_t offset;
+  uint64_t size;
+  uint32_t proc;
+  uint32_t index;
+} object_record;
+
+
+/* Byte j of object index of process proc */
+static unsigned char pattern(uint32_t proc, uint32_t index, size_t j) {
+  return (unsigned char)(proc * 131 + index * 7 + j);
+}
+
+
+/* Worker: allocates NUM_OBJECTS objects, freeing every third straight away,
+ * and reports the rest */
+void worker(const char *name, uint32_t proc, int out) {
+  ts_shm_heap *heap = ts_shm_attach(name);
+  uint32_t i;
+  size_t j;
+  if (heap == NULL) {
+    _exit(EXIT_FAILURE);
+  }
+  srand(proc + 1);
+  for (i=0; i < NUM_OBJECTS; i++) {
+    size_t size = (rand() % 4096) + 1;
+    unsigned char *obj = ts_shm_malloc(heap, size);
+    if (obj == NULL) {
+      fprintf(stderr, "Process %u: shared heap full\n", proc);
+      _exit(EXIT_FAILURE);
+    }
+    if (i % 3 == 0) {
+      ts_shm_free(heap, obj);
+      continue;
+    }
+    for (j=0; j < size; j++) {
+      obj[j] = pattern(proc, i, j);
+    }
+    object_record rec = {ts_shm_offset(heap, obj), size, proc, i};
+    if (write(out, &rec, sizeof(rec)) != sizeof(rec)) {
+      _exit(EXIT_FAILURE);
+    }
+  }
+  ts_shm_detach(heap);
+  _exit(EXIT_SUCCESS);
+}
+
+
+/* Worker that churns the heap until it is killed */
+void churn(ts_shm_heap *heap) {
+  void *objs[64] = {NULL};
+  unsigned i = 0;
+  for (;;) {
+    ts_shm_free(heap, objs[i % 64]);
+    objs[i % 64] = ts_shm_malloc(heap, (i * 37) % 2048 + 1);
+    i++;
+  }
+}
+
+
+int main(int argc, char *argv[])
+{
+  char name[64];
+  int fds[2];
+  int p;
+  int fail = 0;
+
+  // Part 1: objects passed between processes
+  snprintf(name, sizeof(name), "/ts_shm_test_%d", (int) getpid());
+  ts_shm_heap *heap = ts_shm_create(name, HEAP_BYTES);
+  if ((heap == NULL) || (pipe(fds) != 0)) {
+    fprintf(stderr, "Could not set up the shared heap\n");
+    shm_unlink(name);
+    return EXIT_FAILURE;
+  }
+  size_t initial_free = ts_shm_free_space(heap);
+  for (p=0; p < NUM_PROCS; p++) {
+    if (fork() == 0) {
+      close(fds[0]);
+      worker(name, p, fds[1]);
+    }
+  }
+  close(fds[1]);
+
+  object_record *recs = malloc(NUM_PROCS * NUM_OBJECTS * sizeof(object_record));
+  overlap_region *regions = malloc(NUM_PROCS * NUM_OBJECTS * sizeof(overlap_region));
+  size_t n = 0;
+  while (read(fds[0], &recs[n], sizeof(object_record)) == sizeof(object_record)) {
+    n++;
+  }
+  close(fds[0]);
+  for (p=0; p < NUM_PROCS; p++) {
+    int status;
+    wait(&status);
+    if (!WIFEXITED(status) || (WEXITSTATUS(status) != EXIT_SUCCESS)) {
+      fail = 1;
+    }
+  }
+  shm_unlink(name); // the mapping keeps the heap alive
+
+  size_t i, j;
+  size_t bad = 0;
+  for (i=0; i < n; i++) {
+    unsigned char *obj = ts_shm_ptr(heap, recs[i].offset);
+    for (j=0; j < recs[i].size; j++) {
+      if (obj[j] != pattern(recs[i].proc, recs[i].index, j)) {
+	bad++;
+	break;
+      }
+    }
+    regions[i].start = (const char *) obj;
+    regions[i].bytes = recs[i].size;
+    regions[i].index = i;
+  }
+  overlap_region first, second;
+  int overlap = find_overlap(regions, n, 0, &first, &second);
+  for (i=0; i < n; i++) {
+    ts_shm_free(heap, ts_shm_ptr(heap, recs[i].offset));
+  }
+  size_t final_free = ts_shm_free_space(heap);
+  printf("Objects passed = %lu, corrupted = %lu, overlapping = %s\n", n, bad, overlap ? "yes" : "no");
+  printf("Free space after freeing everything = %lu of %lu\n", final_free, initial_free);
+  if ((n != NUM_PROCS * (NUM_OBJECTS - (NUM_OBJECTS + 2) / 3)) || bad || overlap || (final_free != initial_free)) {
+    fail = 1;
+  }
+  ts_shm_detach(heap);
+  free(recs);
+  free(regions);
+
+  // Part 2: processes dying while they use the heap
+  heap = ts_shm_create(NULL, HEAP_BYTES);
+  if (heap == NULL) {
+    return EXIT_FAILURE;
+  }
+  for (p=0; p < NUM_KILLS; p++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      churn(heap);
+    }
+    usleep(2000 + 500 * p);
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+  }
+  void *obj = ts_shm_malloc(heap, 1024);
+  ts_shm_free(heap, obj);
+  printf("Killed workers = %d, free list rebuilds = %lu, heap usable = %s\n", NUM_KILLS,
+	 (unsigned long) heap->recoveries, obj ? "yes" : "no");
+  if (obj == NULL) {
+    fail = 1;
+  }
+
+  // Part 3: pointers that are not blocks
+  size_t before = ts_shm_free_space(heap);
+  unsigned char *block = ts_shm_malloc(heap, 1024);
+  unsigned char *after = ts_shm_malloc(heap, 1024);
+  size_t held = ts_shm_free_space(heap);
+  memset(block, 0, 1024);
+  *(uint64_t *)(block + 512 - 24) = 1UL << 40; // looks like a header, too large
+  ts_shm_free(heap, block + 4);   // misaligned
+  ts_shm_free(heap, block + 256); // interior, size 0
+  ts_shm_free(heap, block + 512); // interior, size past the end of the heap
+  int refused = (ts_shm_free_space(heap) == held);
+  ts_shm_free(heap, block);
+  ts_shm_free(heap, after);
+  printf("Bad pointers refused = %s\n", refused ? "yes" : "no");
+  if (!refused || (ts_shm_free_space(heap) != before)) {
+    fail = 1;
+  }
+  ts_shm_detach(heap);
+
+  printf(fail ? "Test failed\n" : "Test passed\n");
+  return fail;
+}
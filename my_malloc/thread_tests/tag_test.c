@@ -0,0 +1,217 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "my_malloc.h"
+#include "ts_fast.h"
+
+/* Checks per-tag accounting:
+ *
+ *   threads   worker threads allocate blocks of their own tag and of a
+ *             shared tag, and exit; main frees half of them, so counters
+ *             of exited threads and cross-thread frees must sum up
+ *   frees     tagged blocks free'd through every free function (sized,
+ *             per-CPU, thread cached, inline) are credited back
+ *   realloc   the tag follows a block through realloc, heap and large
+ *   limit     a soft limit calls back once when it is reached and again
+ *             after the tag has dropped below it and reached it again
+ *
+ * Also times tagged against untagged malloc/free. Every tag must be back
+ * to 0 at the end, and every block back on the free list. */
+
+#define NUM_THREADS    4
+#define THREAD_OBJECTS 10000
+#define SHARED_TAG     1
+#define LIMIT_TAG      200
+#define LIMIT_BYTES    (1024 * 1024)
+#define TIMED_OPS      1000000
+
+static int fail = 0;
+static void *objects[NUM_THREADS][THREAD_OBJECTS];
+static size_t limit_reported = 0;
+static int limit_calls = 0;
+
+double calc_time(struct timespec start, struct timespec end) {
+  double start_sec = (double)start.tv_sec*1000000000.0 + (double)start.tv_nsec;
+  double end_sec = (double)end.tv_sec*1000000000.0 + (double)end.tv_nsec;
+
+  if (end_sec < start_sec) {
+    return 0;
+  } else {
+    return end_sec - start_sec;
+  }
+};
+
+
+void expect(int ok, const char *what) {
+  if (!ok) {
+    printf("FAILED: %s\n", what);
+    fail = 1;
+  }
+}
+
+
+/* Expected bytes and blocks of tag, checked against ts_get_tag_stats */
+void expect_tag(unsigned tag, long long bytes, long long blocks, const char *what) {
+  ts_tag_stats stats;
+  ts_get_tag_stats(tag, &stats);
+  if ((stats.bytes != bytes) || (stats.blocks != blocks)) {
+    printf("FAILED: %s: tag %u has %lld bytes in %lld blocks, expected %lld in %lld\n",
+	   what, tag, stats.bytes, stats.blocks, bytes, blocks);
+    fail = 1;
+  }
+}
+
+
+void *worker(void *arg) {
+  long id = (long) arg;
+  int i;
+  for (i=0; i < THREAD_OBJECTS; i++) {
+    size_t size = 16 + (i * 37) % 2000;
+    objects[id][i] = ts_malloc_tagged(size, (i % 2) ? SHARED_TAG : 2 + id);
+  }
+  return NULL;
+}
+
+
+void on_limit(unsigned tag, size_t bytes, size_t limit, void *arg) {
+  limit_reported = bytes;
+  limit_calls++;
+}
+
+
+int main(int argc, char *argv[])
+{
+  pthread_t threads[NUM_THREADS];
+  long long bytes[2 + NUM_THREADS] = {0}, blocks[2 + NUM_THREADS] = {0};
+  long i, t;
+
+  for (t=0; t < NUM_THREADS; t++) {
+    pthread_create(&threads[t], NULL, worker, (void *) t);
+  }
+  for (t=0; t < NUM_THREADS; t++) {
+    pthread_join(threads[t], NULL);
+  }
+  for (t=0; t < NUM_THREADS; t++) {
+    for (i=0; i < THREAD_OBJECTS; i++) {
+      unsigned tag = (i % 2) ? SHARED_TAG : 2 + t;
+      if ((i % 4) < 2) {
+	ts_free_lock(objects[t][i]);
+	objects[t][i] = NULL;
+	continue;
+      }
+      bytes[tag] += ts_malloc_usable_size(objects[t][i]);
+      blocks[tag]++;
+    }
+  }
+  for (t=1; t < 2 + NUM_THREADS; t++) {
+    expect_tag(t, bytes[t], blocks[t], "threads");
+  }
+  for (t=0; t < NUM_THREADS; t++) {
+    for (i=0; i < THREAD_OBJECTS; i++) {
+      ts_free_lock(objects[t][i]);
+    }
+  }
+  for (t=1; t < 2 + NUM_THREADS; t++) {
+    expect_tag(t, 0, 0, "threads freed");
+  }
+
+  // every free function credits the block back
+  ts_free_sized_fast(ts_malloc_fast(48), 48); // turns the thread cache on
+  void *p[6];
+  p[0] = ts_malloc_tagged(100, 7);
+  p[1] = ts_malloc_tagged(100, 7);
+  p[2] = ts_malloc_tagged(100, 7);
+  p[3] = ts_malloc_tagged(48, 7);
+  p[4] = ts_malloc_tagged(48, 7);
+  p[5] = ts_malloc_tagged(1 << 20, 7);
+  long long tagged_bytes = 0;
+  for (i=0; i < 6; i++) {
+    tagged_bytes += ts_malloc_usable_size(p[i]);
+  }
+  expect_tag(7, tagged_bytes, 6, "frees");
+  ts_free_percpu(p[0]);
+  ts_free_sized_percpu(p[1], 100);
+  ts_free_cached(p[2]);
+  ts_free_sized_cached(p[3], 48);
+  ts_free_sized_fast(p[4], 48);
+  ts_free_nolock(p[5]); // a large block, unmapped by any free
+  expect_tag(7, 0, 0, "frees");
+  char *c = ts_malloc_fast(48); // an untagged block out of the cache
+  expect(c != NULL, "cached block untagged");
+  ts_free_sized_fast(c, 48);
+  expect_tag(7, 0, 0, "cached block untagged");
+
+  // the tag follows realloc
+  char *r = ts_malloc_tagged(64, 8);
+  memset(r, 'x', 64);
+  r = ts_realloc_lock(r, 4000);
+  expect_tag(8, ts_malloc_usable_size(r), 1, "realloc heap");
+  r = ts_realloc_lock(r, 1 << 20);
+  expect_tag(8, ts_malloc_usable_size(r), 1, "realloc to large");
+  r = ts_realloc_lock(r, 4 << 20);
+  expect_tag(8, ts_malloc_usable_size(r), 1, "realloc large");
+  expect(r[63] == 'x', "realloc keeps the contents");
+  ts_free_lock(r);
+  expect_tag(8, 0, 0, "realloc freed");
+
+  // the soft limit calls back once on the way up
+  static void *limited[2 * LIMIT_BYTES / 1024];
+  long n = 0;
+  ts_tag_set_limit(LIMIT_TAG, LIMIT_BYTES, on_limit, NULL);
+  while ((limit_calls == 0) && (n < 2 * LIMIT_BYTES / 1024)) {
+    limited[n++] = ts_malloc_tagged(1000, LIMIT_TAG);
+  }
+  printf("limit %d bytes reported at %lu bytes (%ld blocks)\n", LIMIT_BYTES,
+	 (unsigned long) limit_reported, n);
+  expect((limit_calls == 1) && (limit_reported >= LIMIT_BYTES) &&
+	 (limit_reported <= LIMIT_BYTES + LIMIT_BYTES / 64 + 1024), "limit reached");
+  for (i=0; i < 100; i++) {
+    limited[n++] = ts_malloc_tagged(1000, LIMIT_TAG);
+  }
+  expect(limit_calls == 1, "limit reported once");
+  for (i=0; i < n / 2; i++) { // back below, the next crossing is reported again
+    ts_free_lock(limited[i]);
+    limited[i] = NULL;
+  }
+  while ((limit_calls == 1) && (n < 2 * LIMIT_BYTES / 1024)) {
+    limited[n++] = ts_malloc_tagged(1000, LIMIT_TAG);
+  }
+  expect(limit_calls == 2, "limit reported again after dropping below it");
+  ts_tag_stats stats;
+  ts_get_tag_stats(LIMIT_TAG, &stats);
+  expect((stats.limit == LIMIT_BYTES) && (stats.limit_hits == 2), "limit stats");
+  for (i=0; i < n; i++) {
+    ts_free_lock(limited[i]);
+  }
+  expect_tag(LIMIT_TAG, 0, 0, "limit freed");
+  ts_tag_set_limit(LIMIT_TAG, 0, NULL, NULL);
+
+  // cost of tagging
+  struct timespec start_time, end_time;
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  for (i=0; i < TIMED_OPS; i++) {
+    ts_free_lock(ts_malloc_lock(64));
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end_time);
+  double untagged = calc_time(start_time, end_time) / TIMED_OPS;
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  for (i=0; i < TIMED_OPS; i++) {
+    ts_free_lock(ts_malloc_tagged(64, 9));
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end_time);
+  double tagged = calc_time(start_time, end_time) / TIMED_OPS;
+  printf("malloc+free: untagged %.1f ns, tagged %.1f ns\n", untagged, tagged);
+  expect_tag(9, 0, 0, "timed");
+
+  ts_percpu_flush();
+  ts_thread_cache_flush();
+  ts_stats heap;
+  ts_get_stats(&heap);
+  printf("Free = %lu of heap = %lu\n", heap.free_bytes, heap.heap_bytes);
+  expect(heap.free_bytes == heap.heap_bytes, "every block free'd");
+  expect(ts_malloc_tagged(10, TS_NUM_TAGS) == NULL, "tag out of range");
+  printf(fail ? "Test failed\n" : "Test passed\n");
+  return fail;
+}
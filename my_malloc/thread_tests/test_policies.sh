@@ -0,0 +1,9 @@
+#!/bin/bash
+# Runs the measurement test once per placement policy. Each run is a separate
+# process so every policy starts from an empty heap.
+for policy in best first next good
+do
+    echo ==================================================
+    ./thread_test_measurement $policy | grep -E "Policy|Time|Throughput|Size"
+    echo ==================================================
+done
@@ -3,6 +3,7 @@
 #include <pthread.h>
 #include <unistd.h>
 #include "my_malloc.h"
+#include "overlap_check.h"
 
 #ifdef LOCK_VERSION
 #define MALLOC(sz) ts_malloc_lock(sz)
@@ -12,9 +13,19 @@
 #define MALLOC(sz) ts_malloc_nolock(sz)
 #define FREE(p)    ts_free_nolock(p)
 #endif
+#ifdef PERCPU_VERSION
+#define MALLOC(sz) ts_malloc_percpu(sz)
+#define FREE(p)    ts_free_percpu(p)
+#endif
+#ifdef ADAPTIVE_VERSION
+#define MALLOC(sz) ts_malloc(sz)
+#define FREE(p)    ts_free(p)
+#endif
 
 #define NUM_THREADS  4
+#ifndef NUM_ITEMS
 #define NUM_ITEMS    10000
+#endif
 
 pthread_t threads[NUM_THREADS];
 int       thread_id[NUM_THREADS];
@@ -64,7 +75,7 @@ void *allocate(void *arg) {
 
 int main(int argc, char *argv[])
 {
-  int i, j;
+  int i;
 
   srand(0);
 
@@ -88,35 +99,26 @@ int main(int argc, char *argv[])
 
   //Check for correctness!
 
-  int *start, *end, *tgt_start, *tgt_end;
-  int fail = 0;
+  overlap_region *regions = malloc(NUM_THREADS * NUM_ITEMS * sizeof(overlap_region));
+  overlap_region region1, region2;
+  int num_regions = 0;
   for (i=0; i < NUM_THREADS * NUM_ITEMS; i++) {
     if (malloc_items[i].free == 1) continue;
-    start = malloc_items[i].address;
-    end   = start + (malloc_items[i].bytes / sizeof(int));
-
-    for (j=0; j < NUM_THREADS * NUM_ITEMS; j++) {
-      if (malloc_items[j].free == 1) continue;
-      if (i == j) continue;
-      tgt_start = malloc_items[j].address;
-      tgt_end   = tgt_start + (malloc_items[j].bytes / sizeof(int));
-      if (((start >= tgt_start) && (start <= tgt_end)) ||
-	  ((end >= tgt_start) && (end <= tgt_end))) {
-	fail = 1;
-	break;
-      } //if
-    }
-
-    if (fail == 1) break;
+    regions[num_regions].start = (const char *) malloc_items[i].address;
+    regions[num_regions].bytes = malloc_items[i].bytes;
+    regions[num_regions].index = i;
+    num_regions++;
   } //for i
+  int fail = find_overlap(regions, num_regions, 0, &region1, &region2);
+  free(regions);
 
   if (fail == 0) {
     printf("No overlapping allocated regions found!\n");
     printf("Test passed\n");
   } else {
     printf("Found 2 overlapping allocated regions.\n");
-    printf("Region 1 bounds: start=%p, end=%p, size=%zdB, idx=%d\n", start, end, malloc_items[i].bytes, i);
-    printf("Region 2 bounds: start=%p, end=%p, size=%zdB, idx=%d\n", tgt_start, tgt_end, malloc_items[j].bytes, j);
+    printf("Region 1 bounds: start=%p, end=%p, size=%zdB, idx=%ld\n", region1.start, region1.start + region1.bytes, region1.bytes, region1.index);
+    printf("Region 2 bounds: start=%p, end=%p, size=%zdB, idx=%ld\n", region2.start, region2.start + region2.bytes, region2.bytes, region2.index);
     printf("Test failed\n");
   } //else
 
@@ -3,19 +3,38 @@
 #include <time.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 #include "my_malloc.h"
+#include "overlap_check.h"
 
 #ifdef LOCK_VERSION
 #define MALLOC(sz) ts_malloc_lock(sz)
 #define FREE(p)    ts_free_lock(p)
+#define VERSION_NAME "lock"
 #endif
 #ifdef NOLOCK_VERSION
 #define MALLOC(sz) ts_malloc_nolock(sz)
 #define FREE(p)    ts_free_nolock(p)
+#define VERSION_NAME "nolock"
+#endif
+#ifdef PERCPU_VERSION
+#define MALLOC(sz) ts_malloc_percpu(sz)
+#define FREE(p)    ts_free_percpu(p)
+#define VERSION_NAME "percpu"
+#endif
+#ifdef ADAPTIVE_VERSION
+#define MALLOC(sz) ts_malloc(sz)
+#define FREE(p)    ts_free(p)
+#define VERSION_NAME "adaptive"
 #endif
 
 #define NUM_THREADS  4
+#ifndef NUM_ITEMS
 #define NUM_ITEMS    20000
+#endif
 
 double calc_time(struct timespec start, struct timespec end) {
   double start_sec = (double)start.tv_sec*1000000000.0 + (double)start.tv_nsec;
@@ -29,11 +48,122 @@ double calc_time(struct timespec start, struct timespec end) {
 };
 
 
+/* Hardware and software counters read around each benchmark phase */
+struct counter_spec {
+  const char *name;
+  unsigned type;
+  unsigned long long config;
+};
+
+const struct counter_spec counter_specs[] = {
+  {"Cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+  {"Instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+  {"L1D Load Misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+   (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+  {"LLC Misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+  {"dTLB Load Misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+   (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+  {"Context Switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+};
+#define NUM_COUNTERS 6
+
+/* Benchmark phases: the threaded malloc/free run, then freeing what is left */
+const char *phase_names[] = {"threaded malloc/free", "final free"};
+#define NUM_PHASES 2
+
+int counter_fds[NUM_COUNTERS];
+unsigned long long counter_values[NUM_PHASES][NUM_COUNTERS];
+
+
+/* Opens a counter for this process and the threads it creates afterwards.
+ * Returns -1 if perf events are not permitted or the event is unsupported. */
+int open_counter(const struct counter_spec *spec) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = spec->type;
+  attr.config = spec->config;
+  attr.disabled = 1;
+  attr.inherit = 1;
+  attr.exclude_kernel = (spec->type != PERF_TYPE_SOFTWARE); // switches happen in the kernel
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+
+/* Opens every counter, returns how many could be opened */
+int open_counters() {
+  int i, opened = 0;
+  for (i=0; i < NUM_COUNTERS; i++) {
+    counter_fds[i] = open_counter(&counter_specs[i]);
+    opened += (counter_fds[i] >= 0);
+  }
+  return opened;
+}
+
+
+void start_counters() {
+  int i;
+  for (i=0; i < NUM_COUNTERS; i++) {
+    if (counter_fds[i] >= 0) {
+      ioctl(counter_fds[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(counter_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+}
+
+
+void stop_counters(int phase) {
+  int i;
+  for (i=0; i < NUM_COUNTERS; i++) {
+    counter_values[phase][i] = 0;
+    if (counter_fds[i] >= 0) {
+      ioctl(counter_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+      if (read(counter_fds[i], &counter_values[phase][i], sizeof(unsigned long long)) != sizeof(unsigned long long)) {
+	counter_values[phase][i] = 0;
+      }
+    }
+  }
+}
+
+
+void close_counters() {
+  int i;
+  for (i=0; i < NUM_COUNTERS; i++) {
+    if (counter_fds[i] >= 0) {
+      close(counter_fds[i]);
+    }
+  }
+}
+
+
+/* Prints each counter per malloc/free op of a phase */
+void print_counters(int phase, double ops) {
+  int i;
+  printf("Counters per op, %s (%.0f ops):\n", phase_names[phase], ops);
+  for (i=0; i < NUM_COUNTERS; i++) {
+    if (counter_fds[i] >= 0) {
+      printf("  %s = %f\n", counter_specs[i].name, counter_values[phase][i] / ops);
+    } else {
+      printf("  %s = unavailable\n", counter_specs[i].name);
+    }
+  }
+  if ((counter_fds[0] >= 0) && (counter_fds[1] >= 0) && counter_values[phase][0]) {
+    printf("  IPC = %f\n", (double) counter_values[phase][1] / counter_values[phase][0]);
+  }
+}
+
+
 pthread_t threads[NUM_THREADS];
 int       thread_id[NUM_THREADS];
 
 pthread_barrier_t barrier;
 pthread_mutex_t   my_mutex = PTHREAD_MUTEX_INITIALIZER;
+int               num_frees = 0;
+
+/* Placement policies that can be named on the command line */
+const char *policy_names[] = {"best", "first", "next", "good"};
+const placement_policy policies[] = {POLICY_BEST_FIT, POLICY_FIRST_FIT, POLICY_NEXT_FIT, POLICY_GOOD_FIT};
+#define NUM_POLICIES 4
 
 struct malloc_list {
   size_t bytes;
@@ -68,6 +198,7 @@ void do_allocate(int thread_id) {
 	if (malloc_items[counter].free == 0) {
 	  malloc_items[counter].free = 1;
 	  do_free = 1;
+	  num_frees++;
 	} else {
 	  do_free = 0;
 	} //else
@@ -93,13 +224,29 @@ void *allocate(void *arg) {
 
 int main(int argc, char *argv[])
 {
-  int i, j;
+  int i;
   struct timespec start_time, end_time;
   void *start_segment_addr, *end_segment_addr;
 
   unsigned long data_segment_size;
   unsigned long data_segment_free_space;
 
+  const char *policy_name = "default";
+  if (argc > 1) {
+    for (i=0; i < NUM_POLICIES; i++) {
+      if (strcmp(argv[1], policy_names[i]) == 0) break;
+    }
+    if (i == NUM_POLICIES) {
+      fprintf(stderr, "Usage: %s [best|first|next|good] [split threshold bytes, 0 = adaptive]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+    policy_name = policy_names[i];
+    ts_set_placement_policy(policies[i], 8, 10);
+  }
+  if (argc > 2) {
+    ts_set_split_threshold(strtoul(argv[2], NULL, 10));
+  }
+
   srand(0);
 
   const unsigned chunk_size = 32;
@@ -114,7 +261,10 @@ int main(int argc, char *argv[])
 
   pthread_barrier_init(&barrier, NULL, NUM_THREADS);
 
+  int num_counters = open_counters();
+
   start_segment_addr = sbrk(0);
+  start_counters();
   clock_gettime(CLOCK_MONOTONIC, &start_time);
   for (i=0; i < NUM_THREADS; i++) {
     thread_id[i] = i;
@@ -124,39 +274,31 @@ int main(int argc, char *argv[])
     pthread_join(threads[i], NULL);
   } //for i
   clock_gettime(CLOCK_MONOTONIC, &end_time);
+  stop_counters(0);
   end_segment_addr = sbrk(0);
 
   //Check for correctness!
 
-  int *start, *end, *tgt_start, *tgt_end;
-  int fail = 0;
+  overlap_region *regions = malloc(NUM_THREADS * NUM_ITEMS * sizeof(overlap_region));
+  overlap_region region1, region2;
+  int num_regions = 0;
   for (i=0; i < NUM_THREADS * NUM_ITEMS; i++) {
     if (malloc_items[i].free == 1) continue;
-    start = malloc_items[i].address;
-    end   = start + (malloc_items[i].bytes / sizeof(int));
-
-    for (j=0; j < NUM_THREADS * NUM_ITEMS; j++) {
-      if (malloc_items[j].free == 1) continue;
-      if (i == j) continue;
-      tgt_start = malloc_items[j].address;
-      tgt_end   = tgt_start + (malloc_items[j].bytes / sizeof(int));
-      if (((start >= tgt_start) && (start <= tgt_end)) ||
-	  ((end >= tgt_start) && (end <= tgt_end))) {
-	fail = 1;
-	break;
-      } //if
-    }
-
-    if (fail == 1) break;
+    regions[num_regions].start = (const char *) malloc_items[i].address;
+    regions[num_regions].bytes = malloc_items[i].bytes;
+    regions[num_regions].index = i;
+    num_regions++;
   } //for i
+  int fail = find_overlap(regions, num_regions, 0, &region1, &region2);
+  free(regions);
 
   if (fail == 0) {
     printf("No overlapping allocated regions found!\n");
     printf("Test passed\n");
   } else {
     printf("Found 2 overlapping allocated regions.\n");
-    printf("Region 1 bounds: start=%p, end=%p, size=%zdB, idx=%d\n", start, end, malloc_items[i].bytes, i);
-    printf("Region 2 bounds: start=%p, end=%p, size=%zdB, idx=%d\n", tgt_start, tgt_end, malloc_items[j].bytes, j);
+    printf("Region 1 bounds: start=%p, end=%p, size=%zdB, idx=%ld\n", region1.start, region1.start + region1.bytes, region1.bytes, region1.index);
+    printf("Region 2 bounds: start=%p, end=%p, size=%zdB, idx=%ld\n", region2.start, region2.start + region2.bytes, region2.bytes, region2.index);
     printf("Test failed\n");
   } //else
 
@@ -167,11 +309,19 @@ int main(int argc, char *argv[])
   //data_segment_free_space = thread_get_data_segment_free_space_size();
 
 
+  struct timespec free_start_time, free_end_time;
+  int final_frees = 0;
+  start_counters();
+  clock_gettime(CLOCK_MONOTONIC, &free_start_time);
   for (i=0; i < NUM_THREADS * NUM_ITEMS; i++) {
     if (malloc_items[i].free == 0) {
       FREE(malloc_items[i].address);
+      final_frees++;
     } //if
   } //for i
+  clock_gettime(CLOCK_MONOTONIC, &free_end_time);
+  stop_counters(1);
+  close_counters();
   
   //data_segment_size = get_data_segment_size();
   //data_segment_free_space = thread_get_data_segment_free_space_size();
@@ -179,8 +329,30 @@ int main(int argc, char *argv[])
   
   double elapsed_ns = calc_time(start_time, end_time);
 
+  ts_stats stats;
+  ts_get_stats(&stats);
+
+  printf("Allocator Version = %s\n", VERSION_NAME);
+  printf("Placement Policy = %s\n", policy_name);
+  printf("Split Threshold = %lu bytes (%s)\n", stats.split_threshold,
+	 stats.split_adaptive ? "adaptive" : "fixed");
+  printf("Internal Fragmentation = %f\n", stats.internal_fragmentation);
   printf("Execution Time = %f seconds\n", elapsed_ns / 1e9);
+  printf("Throughput = %f ops/second\n", (NUM_THREADS * NUM_ITEMS + num_frees) / (elapsed_ns / 1e9));
   printf("Data Segment Size = %lu bytes\n", (unsigned long)(end_segment_addr - start_segment_addr));
+  printf("Heap Size (grow_heap) = %lu bytes\n", get_data_segment_size());
+#ifdef ADAPTIVE_VERSION
+  printf("Mode Switches = %lu to private, %lu to locked\n", stats.adaptive_to_private, stats.adaptive_to_locked);
+#endif
+  if (num_counters > 0) {
+    print_counters(0, NUM_THREADS * NUM_ITEMS + num_frees);
+    if (final_frees > 0) {
+      print_counters(1, final_frees);
+    }
+  } else {
+    printf("Hardware Counters = unavailable (perf events not permitted), time only\n");
+  }
+  printf("Final Free Time = %f seconds\n", calc_time(free_start_time, free_end_time) / 1e9);
 
 
   //double elapsed_ns = calc_time(start_time, end_time);
@@ -0,0 +1,97 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "my_malloc.h"
+
+#ifdef LOCK_VERSION
+#define MALLOC(sz) ts_malloc_lock(sz)
+#define FREE(p)    ts_free_lock(p)
+#define VERSION_NAME "lock"
+#endif
+#ifdef NOLOCK_VERSION
+#define MALLOC(sz) ts_malloc_nolock(sz)
+#define FREE(p)    ts_free_nolock(p)
+#define VERSION_NAME "nolock"
+#endif
+#ifdef PERCPU_VERSION
+#define MALLOC(sz) ts_malloc_percpu(sz)
+#define FREE(p)    ts_free_percpu(p)
+#define VERSION_NAME "percpu"
+#endif
+#ifdef ADAPTIVE_VERSION
+#define MALLOC(sz) ts_malloc(sz)
+#define FREE(p)    ts_free(p)
+#define VERSION_NAME "adaptive"
+#endif
+
+/* Hoard's threadtest: every thread repeatedly allocates a batch of fixed
+ * size objects and frees them all again, with no sharing between threads. */
+
+#define NUM_THREADS  4
+#define ITERATIONS   50
+#define BATCH        10000
+#define OBJECT_SIZE  64
+
+double calc_time(struct timespec start, struct timespec end) {
+  double start_sec = (double)start.tv_sec*1000000000.0 + (double)start.tv_nsec;
+  double end_sec = (double)end.tv_sec*1000000000.0 + (double)end.tv_nsec;
+
+  if (end_sec < start_sec) {
+    return 0;
+  } else {
+    return end_sec - start_sec;
+  }
+};
+
+pthread_t threads[NUM_THREADS];
+int       thread_fail[NUM_THREADS];
+
+
+void *churn(void *arg) {
+  int id = (int)(long) arg;
+  char **objects = malloc(BATCH * sizeof(char *));
+  int i, j;
+  for (i=0; i < ITERATIONS; i++) {
+    for (j=0; j < BATCH; j++) {
+      objects[j] = MALLOC(OBJECT_SIZE);
+      objects[j][0] = (char) j;
+      objects[j][OBJECT_SIZE - 1] = (char) id;
+    }
+    for (j=0; j < BATCH; j++) {
+      if ((objects[j][0] != (char) j) || (objects[j][OBJECT_SIZE - 1] != (char) id)) {
+	thread_fail[id] = 1;
+      }
+      FREE(objects[j]);
+    }
+  }
+  free(objects);
+  return NULL;
+}
+
+
+int main(int argc, char *argv[])
+{
+  struct timespec start_time, end_time;
+  int i;
+  int fail = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  for (i=0; i < NUM_THREADS; i++) {
+    pthread_create(&threads[i], NULL, churn, (void *)(long) i);
+  }
+  for (i=0; i < NUM_THREADS; i++) {
+    pthread_join(threads[i], NULL);
+    fail |= thread_fail[i];
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end_time);
+
+  double elapsed_ns = calc_time(start_time, end_time);
+  printf("Benchmark = threadtest, Version = %s\n", VERSION_NAME);
+  printf("Execution Time = %f seconds\n", elapsed_ns / 1e9);
+  printf("Throughput = %f ops/second\n", 2.0 * NUM_THREADS * ITERATIONS * BATCH / (elapsed_ns / 1e9));
+  printf("Heap Size (grow_heap) = %lu bytes\n", get_data_segment_size());
+  printf(fail ? "Test failed\n" : "Test passed\n");
+  return fail;
+}
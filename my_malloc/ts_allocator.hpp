@@ -0,0 +1,221 @@
+#ifndef TS_ALLOCATOR_HPP
+#define TS_ALLOCATOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <memory_resource>
+#include "my_malloc.h"
+
+// C++ interface to libmymalloc (C++17):
+//
+//   ts::allocator<T>        STL allocator backed by ts_malloc_lock, aligned like new
+//   ts::region_resource     std::pmr::memory_resource over a ts_region, memory
+//                           is only given back by release() or destruction
+//
+// Defining TS_MALLOC_REPLACE_NEW in exactly one translation unit before 
+// including this header replaces the global operator new/delete (all the
+// throwing, nothrow, sized and aligned forms) with libmymalloc.
+
+namespace ts {
+
+  // Blocks are aligned to ALIGNMENT; larger alignments over-allocate and keep
+  // the block's address in the word just below the aligned pointer.
+
+  inline void * aligned_malloc(std::size_t size, std::size_t alignment){
+    if (alignment <= ALIGNMENT){
+      return ts_malloc_lock(size);
+    }
+    std::size_t padding = alignment - ALIGNMENT + sizeof(void *); // the block is ALIGNMENT aligned
+    if (size > SIZE_MAX - padding){
+      return nullptr;
+    }
+    char * block = static_cast<char *>(ts_malloc_lock(size + padding));
+    if (block == nullptr){
+      return nullptr;
+    }
+    std::uintptr_t aligned = (reinterpret_cast<std::uintptr_t>(block) + sizeof(void *) + alignment - 1) & ~(std::uintptr_t)(alignment - 1);
+    reinterpret_cast<void **>(aligned)[-1] = block;
+    return reinterpret_cast<void *>(aligned);
+  }
+
+  inline void aligned_free(void * ptr, std::size_t alignment){
+    if ((ptr != nullptr) && (alignment > ALIGNMENT)){
+      ptr = static_cast<void **>(ptr)[-1];
+    }
+    ts_free_lock(ptr);
+  }
+
+
+  // Alignment guaranteed by plain new (__STDCPP_DEFAULT_NEW_ALIGNMENT__, 16
+  // on x86-64), and the least alignment of everything allocated below
+
+  constexpr std::size_t new_alignment = (__STDCPP_DEFAULT_NEW_ALIGNMENT__ > ALIGNMENT) ?
+    __STDCPP_DEFAULT_NEW_ALIGNMENT__ : ALIGNMENT;
+
+
+  // Allocates with new's semantics: retries through the new handler, then
+  // throws std::bad_alloc. Pointers are at least new_alignment aligned and
+  // are released with new_free and the same alignment.
+
+  inline void * new_malloc(std::size_t size, std::size_t alignment){
+    if (alignment < new_alignment){
+      alignment = new_alignment;
+    }
+    if (size == 0){
+      size = 1; // every new expression yields a distinct pointer
+    }
+    for (;;){
+      void * ptr = aligned_malloc(size, alignment);
+      if (ptr != nullptr){
+	return ptr;
+      }
+      std::new_handler handler = std::get_new_handler();
+      if (handler == nullptr){
+	throw std::bad_alloc();
+      }
+      handler();
+    }
+  }
+
+  inline void new_free(void * ptr, std::size_t alignment){
+    aligned_free(ptr, (alignment < new_alignment) ? new_alignment : alignment);
+  }
+
+
+  // STL allocator, aligned like new. As new_alignment is above ALIGNMENT
+  // on x86-64, every block carries new_alignment - ALIGNMENT bytes of
+  // padding and the back pointer, and is free'd unsized. Node containers
+  // spend most of their time in the locking heap's address-ordered free
+  // list though: turn on deferred coalescing (ts_set_deferred_coalescing)
+  // for them, which makes map churn more than ten times faster.
+
+  template <class T>
+  class allocator {
+  public:
+    typedef T value_type;
+
+    allocator() noexcept {}
+
+    template <class U>
+    allocator(const allocator<U> &) noexcept {}
+
+    T * allocate(std::size_t n){
+      if (n > SIZE_MAX / sizeof(T)){
+	throw std::bad_array_new_length();
+      }
+      return static_cast<T *>(new_malloc(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T * ptr, std::size_t) noexcept {
+      new_free(ptr, alignof(T));
+    }
+  };
+
+  template <class T, class U>
+  bool operator==(const allocator<T> &, const allocator<U> &) noexcept { return true; }
+
+  template <class T, class U>
+  bool operator!=(const allocator<T> &, const allocator<U> &) noexcept { return false; }
+
+
+  // Polymorphic memory resource over a region. Like 
+  // std::pmr::monotonic_buffer_resource, deallocate does nothing and it is
+  // not synchronized: use one per thread.
+
+  class region_resource : public std::pmr::memory_resource {
+  public:
+    region_resource() : region(ts_region_create()){
+      if (region == nullptr){
+	throw std::bad_alloc();
+      }
+    }
+
+    region_resource(const region_resource &) = delete;
+    region_resource & operator=(const region_resource &) = delete;
+
+    ~region_resource(){
+      ts_region_destroy(region);
+    }
+
+    // Frees everything allocated from the resource at once
+    void release(){
+      ts_region * fresh = ts_region_create();
+      if (fresh == nullptr){
+	throw std::bad_alloc();
+      }
+      ts_region_destroy(region);
+      region = fresh;
+    }
+
+  protected:
+    void * do_allocate(std::size_t bytes, std::size_t alignment) override {
+      if (alignment < new_alignment){
+	alignment = new_alignment;
+      }
+      if (alignment > ALIGNMENT){
+	if (bytes > SIZE_MAX - (alignment - ALIGNMENT)){
+	  throw std::bad_alloc();
+	}
+	bytes += alignment - ALIGNMENT; // room to align within the bump allocation
+      }
+      char * ptr = static_cast<char *>(ts_region_alloc(region, bytes));
+      if (ptr == nullptr){
+	throw std::bad_alloc();
+      }
+      if (alignment > ALIGNMENT){
+	std::uintptr_t aligned = (reinterpret_cast<std::uintptr_t>(ptr) + alignment - 1) & ~(std::uintptr_t)(alignment - 1);
+	ptr = reinterpret_cast<char *>(aligned);
+      }
+      return ptr;
+    }
+
+    void do_deallocate(void *, std::size_t, std::size_t) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource & other) const noexcept override {
+      return this == &other;
+    }
+
+  private:
+    ts_region * region;
+  };
+
+} // namespace ts
+
+
+#ifdef TS_MALLOC_REPLACE_NEW
+
+void * operator new(std::size_t size){ return ts::new_malloc(size, 0); }
+void * operator new[](std::size_t size){ return ts::new_malloc(size, 0); }
+void * operator new(std::size_t size, std::align_val_t al){ return ts::new_malloc(size, static_cast<std::size_t>(al)); }
+void * operator new[](std::size_t size, std::align_val_t al){ return ts::new_malloc(size, static_cast<std::size_t>(al)); }
+
+void * operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  try { return ts::new_malloc(size, 0); } catch (...) { return nullptr; }
+}
+void * operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  try { return ts::new_malloc(size, 0); } catch (...) { return nullptr; }
+}
+void * operator new(std::size_t size, std::align_val_t al, const std::nothrow_t &) noexcept {
+  try { return ts::new_malloc(size, static_cast<std::size_t>(al)); } catch (...) { return nullptr; }
+}
+void * operator new[](std::size_t size, std::align_val_t al, const std::nothrow_t &) noexcept {
+  try { return ts::new_malloc(size, static_cast<std::size_t>(al)); } catch (...) { return nullptr; }
+}
+
+void operator delete(void * ptr) noexcept { ts::new_free(ptr, 0); }
+void operator delete[](void * ptr) noexcept { ts::new_free(ptr, 0); }
+void operator delete(void * ptr, std::size_t) noexcept { ts::new_free(ptr, 0); }
+void operator delete[](void * ptr, std::size_t) noexcept { ts::new_free(ptr, 0); }
+void operator delete(void * ptr, std::align_val_t al) noexcept { ts::new_free(ptr, static_cast<std::size_t>(al)); }
+void operator delete[](void * ptr, std::align_val_t al) noexcept { ts::new_free(ptr, static_cast<std::size_t>(al)); }
+void operator delete(void * ptr, std::size_t, std::align_val_t al) noexcept { ts::new_free(ptr, static_cast<std::size_t>(al)); }
+void operator delete[](void * ptr, std::size_t, std::align_val_t al) noexcept { ts::new_free(ptr, static_cast<std::size_t>(al)); }
+void operator delete(void * ptr, const std::nothrow_t &) noexcept { ts::new_free(ptr, 0); }
+void operator delete[](void * ptr, const std::nothrow_t &) noexcept { ts::new_free(ptr, 0); }
+void operator delete(void * ptr, std::align_val_t al, const std::nothrow_t &) noexcept { ts::new_free(ptr, static_cast<std::size_t>(al)); }
+void operator delete[](void * ptr, std::align_val_t al, const std::nothrow_t &) noexcept { ts::new_free(ptr, static_cast<std::size_t>(al)); }
+
+#endif // TS_MALLOC_REPLACE_NEW
+
+#endif // TS_ALLOCATOR_HPP
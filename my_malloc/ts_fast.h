@@ -0,0 +1,64 @@
+#ifndef TS_FAST_H
+#define TS_FAST_H
+
+#include "my_malloc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Inline fast path for allocations whose size is known at compile time:
+//
+//   p = ts_malloc_fast(sizeof(struct node));
+//   ...
+//   ts_free_sized_fast(p, sizeof(struct node));
+//
+// When the size is a constant, __builtin_constant_p lets the compiler fold
+// the size class and the cache slot into the code, so a hit is a load, a
+// compare and a store on the thread cache with no call into the library.
+// Any other size, a miss, a full cache, a running profiler or tagged
+// blocks in use (whose headers must be read when free'd) take the
+// out-of-line path (ts_malloc_cached, ts_malloc_class, ts_free_sized_cached).
+//
+// Blocks come from the thread cache of thread_cache.c and must be free'd
+// with ts_free_fast/ts_free_cached (or sized, with the same size).
+
+
+static inline __attribute__((always_inline)) void * ts_malloc_fast(size_t size){
+  if (__builtin_constant_p(size) && (size <= SMALL_SIZE_MAX)){
+    const unsigned cls = SIZE_CLASS(size);
+    void * result = ts_tcache.bins[cls];
+    if (__builtin_expect((result != NULL) && (profile_rate == 0), 1)){
+      ts_tcache.bins[cls] = *(void **) result;
+      ts_tcache.counts[cls]--;
+      return result;
+    }
+    return ts_malloc_class(cls);
+  }
+  return ts_malloc_cached(size);
+}
+
+
+static inline __attribute__((always_inline)) void ts_free_sized_fast(void * ptr, size_t size){
+  if (__builtin_constant_p(size) && (size <= SMALL_SIZE_MAX)){
+    const unsigned cls = SIZE_CLASS(size);
+    if (__builtin_expect((ptr != NULL) && (ts_tcache.counts[cls] < ts_tcache.limit) && ((profile_live | tags_used) == 0), 1)){
+      *(void **) ptr = ts_tcache.bins[cls];
+      ts_tcache.bins[cls] = ptr;
+      ts_tcache.counts[cls]++;
+      return;
+    }
+  }
+  ts_free_sized_cached(ptr, size);
+}
+
+
+static inline void ts_free_fast(void * ptr){
+  ts_free_cached(ptr);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,279 @@
+#ifndef TS_LOCK_H
+#define TS_LOCK_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// Lock used for list_lock and sbrk_mutex, selected at compile time with
+// LOCK= in the Makefile (-DTS_LOCK_TYPE=...):
+//
+//   TS_LOCK_PTHREAD  pthread mutex (default)
+//   TS_LOCK_TTAS     test-and-test-and-set spinlock with exponential backoff
+//   TS_LOCK_TICKET   ticket lock, FIFO, backoff proportional to queue position
+//   TS_LOCK_MCS      MCS queue lock, each waiter spins on its own node
+//   TS_LOCK_FUTEX    spins briefly, then sleeps on a futex
+//
+// Code outside the library that inlines these functions must be built with
+// the same TS_LOCK_TYPE; thread_tests/Makefile takes the same LOCK=.
+//
+// The spinning locks yield the CPU after SPIN_LIMIT rounds, so a waiter
+// does not burn the holder's time slice on an oversubscribed machine. On a
+// single CPU the holder cannot make progress while anyone spins, so waiters
+// yield (or sleep) straight away.
+
+#define TS_LOCK_PTHREAD 0
+#define TS_LOCK_TTAS    1
+#define TS_LOCK_TICKET  2
+#define TS_LOCK_MCS     3
+#define TS_LOCK_FUTEX   4
+
+#ifndef TS_LOCK_TYPE
+#define TS_LOCK_TYPE TS_LOCK_PTHREAD
+#endif
+
+/* Spin rounds before a waiter yields (or sleeps, for the futex lock) */
+#define SPIN_LIMIT 64
+
+/* Longest backoff, in pause instructions */
+#define BACKOFF_MAX 1024
+
+/* Locks a thread can hold at once (MCS queue nodes per thread) */
+#define MCS_MAX_NESTING 4
+
+
+/* Tells the CPU this is a spin-wait loop */
+static inline void cpu_relax(){
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+
+/* Spin rounds before yielding on this machine, -1 until it is known 
+ * (defined in my_malloc.c) */
+extern int ts_spin_limit;
+
+/* SPIN_LIMIT, or 1 on a single CPU */
+static inline unsigned spin_limit(){
+  if (ts_spin_limit < 0){
+    ts_spin_limit = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? SPIN_LIMIT : 1;
+  }
+  return ts_spin_limit;
+}
+
+
+/* Waits out one spin round: pauses for backoff rounds, or yields once the
+ * waiter has spun spin_limit() times */
+static inline void spin_wait(unsigned * spins, unsigned backoff){
+  if (++(*spins) >= spin_limit()){
+    *spins = 0;
+    sched_yield();
+    return;
+  }
+  while (backoff--){
+    cpu_relax();
+  }
+}
+
+
+#if TS_LOCK_TYPE == TS_LOCK_PTHREAD
+
+typedef pthread_mutex_t ts_lock_t;
+
+#define TS_LOCK_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#define TS_LOCK_NAME "pthread"
+
+static inline void ts_lock_acquire(ts_lock_t * lock){ pthread_mutex_lock(lock); }
+static inline int ts_lock_trylock(ts_lock_t * lock){ return pthread_mutex_trylock(lock) == 0; }
+static inline void ts_lock_release(ts_lock_t * lock){ pthread_mutex_unlock(lock); }
+
+
+#elif TS_LOCK_TYPE == TS_LOCK_TTAS
+
+typedef struct ts_lock_ttas_t{
+
+  int locked;
+
+} ts_lock_t;
+
+#define TS_LOCK_INITIALIZER {0}
+#define TS_LOCK_NAME "ttas"
+
+static inline int ts_lock_trylock(ts_lock_t * lock){
+  return !__atomic_load_n(&lock->locked, __ATOMIC_RELAXED) &&
+    !__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE);
+}
+
+static inline void ts_lock_acquire(ts_lock_t * lock){
+  unsigned backoff = 1;
+  unsigned spins = 0;
+  while (!ts_lock_trylock(lock)){
+    // spin on a read so waiters share the cache line until it is released
+    while (__atomic_load_n(&lock->locked, __ATOMIC_RELAXED)){
+      spin_wait(&spins, backoff);
+      if (backoff < BACKOFF_MAX){
+	backoff <<= 1;
+      }
+    }
+  }
+}
+
+static inline void ts_lock_release(ts_lock_t * lock){
+  __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+
+#elif TS_LOCK_TYPE == TS_LOCK_TICKET
+
+typedef struct ts_lock_ticket_t{
+
+  unsigned next;     // ticket handed to the next arrival
+  unsigned serving;  // ticket holding the lock
+
+} ts_lock_t;
+
+#define TS_LOCK_INITIALIZER {0, 0}
+#define TS_LOCK_NAME "ticket"
+
+/* Pause rounds per waiter ahead in the queue */
+#define TICKET_BACKOFF 16
+
+static inline int ts_lock_trylock(ts_lock_t * lock){
+  unsigned serving = __atomic_load_n(&lock->serving, __ATOMIC_RELAXED);
+  unsigned expected = serving;
+  return __atomic_compare_exchange_n(&lock->next, &expected, serving + 1, 0,
+				     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline void ts_lock_acquire(ts_lock_t * lock){
+  unsigned ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+  unsigned spins = 0;
+  unsigned serving;
+  while ((serving = __atomic_load_n(&lock->serving, __ATOMIC_ACQUIRE)) != ticket){
+    spin_wait(&spins, (ticket - serving) * TICKET_BACKOFF);
+  }
+}
+
+static inline void ts_lock_release(ts_lock_t * lock){
+  __atomic_store_n(&lock->serving, lock->serving + 1, __ATOMIC_RELEASE);
+}
+
+
+#elif TS_LOCK_TYPE == TS_LOCK_MCS
+
+typedef struct mcs_node_t{
+
+  struct mcs_node_t * next;
+  int locked;
+
+} mcs_node;
+
+typedef struct ts_lock_mcs_t{
+
+  mcs_node * tail;    // last waiter, NULL when free
+  mcs_node * holder;  // node of the thread holding the lock
+
+} ts_lock_t;
+
+#define TS_LOCK_INITIALIZER {NULL, NULL}
+#define TS_LOCK_NAME "mcs"
+
+/* Each thread's queue nodes, one per lock it holds (defined in my_malloc.c) */
+extern __thread mcs_node mcs_nodes[MCS_MAX_NESTING];
+extern __thread int mcs_depth;
+
+static inline int ts_lock_trylock(ts_lock_t * lock){
+  mcs_node * node = &mcs_nodes[mcs_depth];
+  mcs_node * expected = NULL;
+  node->next = NULL;
+  if (!__atomic_compare_exchange_n(&lock->tail, &expected, node, 0,
+				   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+    return 0;
+  }
+  mcs_depth++;
+  lock->holder = node;
+  return 1;
+}
+
+static inline void ts_lock_acquire(ts_lock_t * lock){
+  mcs_node * node = &mcs_nodes[mcs_depth++];
+  node->next = NULL;
+  node->locked = 1;
+  mcs_node * prev = __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+  if (prev){
+    unsigned spins = 0;
+    __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE)){
+      spin_wait(&spins, 1);
+    }
+  }
+  lock->holder = node;
+}
+
+static inline void ts_lock_release(ts_lock_t * lock){
+  mcs_node * node = lock->holder;
+  mcs_node * next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+  mcs_depth--;
+  if (next == NULL){
+    mcs_node * expected = node;
+    if (__atomic_compare_exchange_n(&lock->tail, &expected, NULL, 0,
+				    __ATOMIC_RELEASE, __ATOMIC_RELAXED)){
+      return; // nobody waiting
+    }
+    unsigned spins = 0;
+    while ((next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) == NULL){
+      spin_wait(&spins, 1); // a waiter is linking itself in
+    }
+  }
+  __atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+}
+
+
+#elif TS_LOCK_TYPE == TS_LOCK_FUTEX
+
+typedef struct ts_lock_futex_t{
+
+  int state; // 0 free, 1 locked, 2 locked with sleepers
+
+} ts_lock_t;
+
+#define TS_LOCK_INITIALIZER {0}
+#define TS_LOCK_NAME "futex"
+
+static inline int ts_lock_trylock(ts_lock_t * lock){
+  int expected = 0;
+  return __atomic_compare_exchange_n(&lock->state, &expected, 1, 0,
+				     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline void ts_lock_acquire(ts_lock_t * lock){
+  unsigned spins;
+  unsigned limit = spin_limit();
+  for (spins = 0; spins < limit; spins++){
+    if (ts_lock_trylock(lock)){
+      return;
+    }
+    cpu_relax();
+  }
+  // mark the lock contended and sleep until it is free
+  while (__atomic_exchange_n(&lock->state, 2, __ATOMIC_ACQUIRE) != 0){
+    syscall(SYS_futex, &lock->state, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+  }
+}
+
+static inline void ts_lock_release(ts_lock_t * lock){
+  if (__atomic_exchange_n(&lock->state, 0, __ATOMIC_RELEASE) == 2){
+    syscall(SYS_futex, &lock->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+  }
+}
+
+#else
+#error "Unknown TS_LOCK_TYPE"
+#endif
+
+#endif